@@ -4,6 +4,9 @@
 #include <linux/fs.h>
 #include <asm/uaccess.h>
 #include <linux/uaccess.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "ddriver_ctl.h"
 /******************************************************************************
 * SECTION: Macro definitions
@@ -41,9 +44,8 @@
 #define SET_HEAD(disk, ofs)     (disk.head = disk.layout + ofs)
 #define RESET_HEAD(disk)        (SET_HEAD(disk, 0))
 
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
+#define STAT_INC(field)         this_cpu_inc(ddriver_pcpu_stats.field)
+#define STAT_ADD(field, val)    this_cpu_add(ddriver_pcpu_stats.field, val)
 /******************************************************************************
 * SECTION: Kernel Module Template
 *******************************************************************************/
@@ -54,13 +56,21 @@ MODULE_VERSION(DRIVER_VERSION);
 /******************************************************************************
 * SECTION: Type definitions
 *******************************************************************************/
+struct ddriver_stats
+{
+    u64  read_cnt;
+    u64  write_cnt;
+    u64  seek_cnt;
+    u64  read_bytes;
+    u64  write_bytes;
+    u64  seek_dist;                                   /* Total bytes the head travelled */
+};
+
 struct ddriver
 {
     char layout[CONFIG_DISK_SZ];                      /* Disk Layout */
     char *head;                                       /* Disk Head */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
+    struct dentry *debugfs_dir;                       /* /sys/kernel/debug/ddriver */
     int  major_num;
     int  open_count;
     int  layout_size;
@@ -69,14 +79,15 @@ struct ddriver
 
 static struct ddriver disk = {
     .head        = NULL,
-    .read_cnt    = 0,
-    .write_cnt   = 0,
-    .seek_cnt    = 0,
+    .debugfs_dir = NULL,
     .major_num   = 0,
     .open_count  = 0,
     .layout_size = CONFIG_DISK_SZ,
     .iounit_size = CONFIG_BLOCK_SZ
 };
+                                                      /* Counters are bumped lock-free on the local CPU
+                                                         and only summed up when someone reads them */
+static DEFINE_PER_CPU(struct ddriver_stats, ddriver_pcpu_stats);
 /******************************************************************************
 * SECTION: Helper Functions
 *******************************************************************************/
@@ -91,6 +102,30 @@ int check_valid(size_t size){
     }
     return 0;
 }
+
+static void stats_collect(struct ddriver_stats *stats) {
+    int cpu;
+    struct ddriver_stats *pcpu;
+
+    memset(stats, 0, sizeof(struct ddriver_stats));
+    for_each_possible_cpu(cpu) {
+        pcpu = per_cpu_ptr(&ddriver_pcpu_stats, cpu);
+        stats->read_cnt    += pcpu->read_cnt;
+        stats->write_cnt   += pcpu->write_cnt;
+        stats->seek_cnt    += pcpu->seek_cnt;
+        stats->read_bytes  += pcpu->read_bytes;
+        stats->write_bytes += pcpu->write_bytes;
+        stats->seek_dist   += pcpu->seek_dist;
+    }
+}
+
+static void stats_reset(void) {
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        memset(per_cpu_ptr(&ddriver_pcpu_stats, cpu), 0, sizeof(struct ddriver_stats));
+    }
+}
 /******************************************************************************
 * SECTION: Function definitions
 *******************************************************************************/
@@ -133,7 +168,8 @@ device_read(struct file *file, char *user_buffer, size_t size, loff_t *offset) {
     if (copy_to_user(user_buffer, disk.head, CONFIG_BLOCK_SZ))
         return -EFAULT;
     FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
-    INC_READCNT(disk);
+    STAT_INC(read_cnt);
+    STAT_ADD(read_bytes, CONFIG_BLOCK_SZ);
     return CONFIG_BLOCK_SZ;
 }
 /**
@@ -156,7 +192,8 @@ device_write(struct file *file, const char *user_buffer, size_t size, loff_t *of
     if (copy_from_user(disk.head, user_buffer, CONFIG_BLOCK_SZ))
         return -EFAULT;
     FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
-    INC_WRITECNT(disk);
+    STAT_INC(write_cnt);
+    STAT_ADD(write_bytes, CONFIG_BLOCK_SZ);
     return CONFIG_BLOCK_SZ;
 }
 /**
@@ -169,6 +206,7 @@ device_write(struct file *file, const char *user_buffer, size_t size, loff_t *of
  */
 static loff_t 
 device_seek(struct file *file, loff_t offset, int whence) {
+    loff_t origin = GET_HEAD_POS(disk);
     IGNORE_ARG(file);
     if (!IS_ADDR_ALIGN(offset)) {
         kernel_alert("offset %lld must be aligned to block size %d", 
@@ -186,7 +224,8 @@ device_seek(struct file *file, loff_t offset, int whence) {
     default:
         break;
     }
-    INC_SEEKCNT(disk);
+    STAT_INC(seek_cnt);
+    STAT_ADD(seek_dist, abs(GET_HEAD_POS(disk) - origin));
     return GET_HEAD_POS(disk);
 }
 /**
@@ -202,6 +241,8 @@ device_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
     IGNORE_ARG(file);
     int ret;
     struct ddriver_state state;
+    struct ddriver_state64 state64;
+    struct ddriver_stats stats;
     switch (cmd)
     {
     case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
@@ -210,18 +251,29 @@ device_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
             return -EFAULT;
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        stats_collect(&stats);
+        state.read_cnt = (int)stats.read_cnt;
+        state.write_cnt = (int)stats.write_cnt;
+        state.seek_cnt = (int)stats.seek_cnt;
         ret = copy_to_user((int __user *)arg, &state, sizeof(struct ddriver_state));
         if (ret) 
             return -EFAULT;
         break;
+    case IOC_REQ_DEVICE_STATE64:                      /* Device State, full width */
+        stats_collect(&stats);
+        state64.read_cnt = stats.read_cnt;
+        state64.write_cnt = stats.write_cnt;
+        state64.seek_cnt = stats.seek_cnt;
+        state64.read_bytes = stats.read_bytes;
+        state64.write_bytes = stats.write_bytes;
+        state64.seek_dist = stats.seek_dist;
+        ret = copy_to_user((void __user *)arg, &state64, sizeof(struct ddriver_state64));
+        if (ret) 
+            return -EFAULT;
+        break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
         disk.head = disk.layout;
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+        stats_reset();
         break;
     case IOC_REQ_DEVICE_IO_SZ:
         ret = copy_to_user((int __user *)arg, &disk.iounit_size, sizeof(int));
@@ -270,6 +322,28 @@ device_release(struct inode *inode, struct file *file) {
     module_put(THIS_MODULE);
     return 0;
 }
+/**
+ * @brief Dump statistics to /sys/kernel/debug/ddriver/stats
+ * 
+ * @param m             seq_file to print into
+ * @param v             Ignored
+ * @return int          state
+ */
+static int 
+stats_show(struct seq_file *m, void *v) {
+    struct ddriver_stats stats;
+    IGNORE_ARG(v);
+
+    stats_collect(&stats);
+    seq_printf(m, "read_cnt %llu\n", stats.read_cnt);
+    seq_printf(m, "write_cnt %llu\n", stats.write_cnt);
+    seq_printf(m, "seek_cnt %llu\n", stats.seek_cnt);
+    seq_printf(m, "read_bytes %llu\n", stats.read_bytes);
+    seq_printf(m, "write_bytes %llu\n", stats.write_bytes);
+    seq_printf(m, "seek_dist %llu\n", stats.seek_dist);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
 /******************************************************************************
 * SECTION: Module Register and Unregister
 *******************************************************************************/
@@ -286,6 +360,11 @@ ddriver_init(void)
         kernel_info("module loaded with device major number %d", major_num);
         disk.major_num = major_num;
         memset(disk.layout, 0, CONFIG_DISK_SZ);
+        stats_reset();
+                                                      /* Stats stay readable while the device is held
+                                                         open, debugfs failures are not fatal */
+        disk.debugfs_dir = debugfs_create_dir(DEVICE_NAME, NULL);
+        debugfs_create_file("stats", 0444, disk.debugfs_dir, NULL, &stats_fops);
         return 0;
     }
     return 0;
@@ -296,6 +375,7 @@ ddriver_exit(void)
 {   
     int major_num = disk.major_num;
     kernel_info("Goodbye %d", major_num);
+    debugfs_remove_recursive(disk.debugfs_dir);
     if(major_num != 0){
         unregister_chrdev(major_num, DEVICE_NAME);
     }
@@ -14,8 +14,19 @@ struct ddriver_state
     int seek_cnt;
 };
 
+struct ddriver_state64
+{
+    unsigned long long write_cnt;
+    unsigned long long read_cnt;
+    unsigned long long seek_cnt;
+    unsigned long long write_bytes;
+    unsigned long long read_bytes;
+    unsigned long long seek_dist;
+};
+
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define IOC_REQ_DEVICE_STATE64  _IOR(IOC_MAGIC, 4, struct ddriver_state64)
 #endif
\ No newline at end of file
@@ -53,9 +53,10 @@ extern int errno;
 #define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
 #define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
 
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
+#define INC_READCNT(disk)       (disk.read_cnt++, disk.read_bytes += CONFIG_BLOCK_SZ)
+#define INC_WRITECNT(disk)      (disk.write_cnt++, disk.write_bytes += CONFIG_BLOCK_SZ)
 #define INC_SEEKCNT(disk)       (disk.seek_cnt++)
+#define ADD_SEEKDIST(disk, d)   (disk.seek_dist += (d))
 
 #define RW_DELAY(disk, rw_ops)  (usleep(disk.rw_ops##_lat * 1000))
 /******************************************************************************
@@ -64,9 +65,12 @@ extern int errno;
 struct ddriver
 {
     int  ddriver_fd;                                 /* Disk ddriver_fd */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
+    unsigned long long read_cnt;
+    unsigned long long write_cnt;
+    unsigned long long seek_cnt;
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+    unsigned long long seek_dist;                    /* Total bytes the head travelled */
     int  read_lat;
     int  write_lat;
     int  seek_lat;
@@ -83,6 +87,9 @@ struct ddriver disk = {
     .read_cnt    = 0,
     .write_cnt   = 0,
     .seek_cnt    = 0,
+    .read_bytes  = 0,
+    .write_bytes = 0,
+    .seek_dist   = 0,
     .read_lat    = 2,       /* 2ms */       
     .write_lat   = 1,       /* 1ms */
     .seek_lat    = 4,       /* 4.17ms per 360 degree */
@@ -195,6 +202,7 @@ int ddriver_seek(int fd, off_t offset, int whence){
         user_panic("seek error: %s", strerror(errno));
         return ret;
     }
+    ADD_SEEKDIST(disk, abs(ret - cur));
     emulate_rotate(fd, cur, ret);
     return ret;
 }
@@ -246,17 +254,27 @@ int ddriver_read(int fd, char *buf, size_t size){
  */
 int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
     struct ddriver_state state;
+    struct ddriver_state64 state64;
     switch (cmd)
     {
     case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
         memcpy(arg, &disk.layout_size, sizeof(int));
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        state.read_cnt = (int)disk.read_cnt;
+        state.write_cnt = (int)disk.write_cnt;
+        state.seek_cnt = (int)disk.seek_cnt;
         memcpy(arg, &state, sizeof(struct ddriver_state));
         break;
+    case IOC_REQ_DEVICE_STATE64:                      /* Device State, full width */
+        state64.read_cnt = disk.read_cnt;
+        state64.write_cnt = disk.write_cnt;
+        state64.seek_cnt = disk.seek_cnt;
+        state64.read_bytes = disk.read_bytes;
+        state64.write_bytes = disk.write_bytes;
+        state64.seek_dist = disk.seek_dist;
+        memcpy(arg, &state64, sizeof(struct ddriver_state64));
+        break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
         lseek(fd, 0, SEEK_SET);
         char buf[4096] = {'\0'};
@@ -268,6 +286,9 @@ int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
         disk.read_cnt = 0;
         disk.write_cnt = 0;
         disk.seek_cnt = 0;
+        disk.read_bytes = 0;
+        disk.write_bytes = 0;
+        disk.seek_dist = 0;
         break;
     case IOC_REQ_DEVICE_IO_SZ:
         memcpy(arg, &disk.iounit_size, sizeof(int));
@@ -13,9 +13,20 @@ struct ddriver_state
     int seek_cnt;
 };
 
+struct ddriver_state64                  /* 完整的 64 位计数 */
+{
+    unsigned long long write_cnt;
+    unsigned long long read_cnt;
+    unsigned long long seek_cnt;
+    unsigned long long write_bytes;
+    unsigned long long read_bytes;
+    unsigned long long seek_dist;       /* 磁头移动的总字节数 */
+};
+
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)                     /* 请求查看设备大小 */
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)    /* 请求设备状态，返回 ddriver_state */
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)                           /* 请求重置设备 */
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)                     /* 请求设备IO大小 */
+#define IOC_REQ_DEVICE_STATE64  _IOR(IOC_MAGIC, 4, struct ddriver_state64)  /* 请求设备状态，返回 ddriver_state64 */
 
 #endif
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include "string.h"
 #include "fuse.h"
 #include <stddef.h>
+#include <pthread.h>
 #include "ddriver.h"
 #include "errno.h"
 #include "types.h"
@@ -41,24 +42,181 @@ int   			   newfs_truncate(const char *, off_t);
 			
 int   			   newfs_open(const char *, struct fuse_file_info *);
 int   			   newfs_opendir(const char *, struct fuse_file_info *);
+int   			   newfs_release(const char *, struct fuse_file_info *);
+int   			   newfs_releasedir(const char *, struct fuse_file_info *);
+int   			   newfs_fgetattr(const char *, struct stat *, struct fuse_file_info *);
+int   			   newfs_ftruncate(const char *, off_t, struct fuse_file_info *);
+#if FUSE_VERSION >= 29
+int   			   newfs_write_buf(const char *, struct fuse_bufvec *, off_t, struct fuse_file_info *);
+#endif
 
 // new_utils.c
 char*              newfs_get_fname(const char* path);
 int                newfs_calc_lvl(const char * path);
+int                newfs_dev_read(int blk, uint8_t *out_content, int blks);
+int                newfs_dev_write(int blk, uint8_t *in_content, int blks);
 int                newfs_driver_read(int offset, uint8_t *out_content, int size);
 int                newfs_driver_write(int offset, uint8_t *in_content, int size);
+int                newfs_dev_readv(int blk, uint8_t **bufs, int blks);
+int                newfs_dev_writev(int blk, uint8_t **bufs, int blks);
+int                newfs_driver_read_blks(int blk, uint8_t **bufs, int blks);
+int                newfs_driver_write_blks(int blk, uint8_t **bufs, int blks);
+int                newfs_bmap(struct newfs_inode* inode, int lblk, boolean create);
+int                newfs_bunmap(struct newfs_inode* inode, int lblk);
+int                newfs_bmap_set(struct newfs_inode* inode, int lblk, int pblk);
+int                newfs_inode_resize(struct newfs_inode* inode, int blks);
+int                newfs_file_read(struct newfs_inode* inode, char* buf, int size, int offset);
+int                newfs_file_write(struct newfs_inode* inode, const char* buf, int size, int offset);
+int                newfs_file_truncate(struct newfs_inode* inode, int size);
+int                newfs_inode_rw(struct newfs_inode* inode, char* buf, int size, int offset, boolean is_write);
+int                newfs_inode_setsize(struct newfs_inode* inode, int size);
+void               newfs_inode_stat(struct newfs_inode* inode, struct stat* st);
+void               newfs_dentry_stat(struct newfs_dentry* dentry, struct stat* st);
+void               newfs_touch_atime(struct newfs_inode* inode);
+void               newfs_touch_ctime(struct newfs_inode* inode);
+void               newfs_inode_set_times(struct newfs_inode* inode, const struct timespec tv[2]);
+#if FUSE_VERSION >= 29
+int                newfs_inode_read_buf(struct newfs_inode* inode, int size, int offset, newfs_buf_fn fn, void* arg);
+int                newfs_inode_write_buf(struct newfs_inode* inode, struct fuse_bufvec* src, int offset);
+#endif
+void               newfs_mark_dirty(struct newfs_inode* inode, flag16 flags);
 int                newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry);
 struct newfs_inode*     newfs_alloc_inode(struct newfs_dentry * dentry);
 int                newfs_sync_inode(struct newfs_inode * inode);
+int                newfs_sync_estimate();
+void               newfs_sync_begin();
+int                newfs_sync_all();
 struct newfs_inode*     newfs_read_inode(struct newfs_dentry * dentry, int ino);
 struct newfs_dentry*    newfs_get_dentry(struct newfs_inode * inode, int dir);
 struct newfs_dentry*    newfs_lookup(const char * path, boolean* is_find, boolean* is_root);
 
 int newfs_drop_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry);
 int newfs_drop_inode(struct newfs_inode * inode);
+void               newfs_inode_get(struct newfs_inode* inode);
+void               newfs_inode_put(struct newfs_inode* inode);
+void               newfs_inode_open(struct newfs_inode* inode);
+void               newfs_inode_close(struct newfs_inode* inode);
+void               newfs_inode_lookup(struct newfs_inode* inode);
+void               newfs_inode_forget(struct newfs_inode* inode, int nlookup);
 
 int 			   newfs_mount(struct custom_options options);
 int                newfs_umount();
 
+// newfs_cache.c
+int                newfs_cache_init(int nr_bufs);
+struct newfs_buf*  newfs_cache_lookup(int blk);
+struct newfs_buf*  newfs_cache_get(int blk, boolean fill);
+void               newfs_cache_dirty(struct newfs_buf* buf);
+void               newfs_cache_refresh(int blk, uint8_t* content, int blks);
+void               newfs_cache_insert(int blk, uint8_t* content);
+int                newfs_cache_flush();
+int                newfs_cache_destroy();
+
+// newfs_bitmap.c
+void               newfs_bitmap_init(struct newfs_bitmap* bm, uint8_t* map, int nbits);
+int                newfs_bitmap_alloc(struct newfs_bitmap* bm);
+int                newfs_bitmap_alloc_near(struct newfs_bitmap* bm, int goal);
+void               newfs_bitmap_free(struct newfs_bitmap* bm, int idx);
+boolean            newfs_bitmap_test(struct newfs_bitmap* bm, int idx);
+
+// newfs_extent.c
+int                newfs_extent_bmap(struct newfs_inode* inode, int lblk, boolean create);
+void               newfs_extent_truncate(struct newfs_inode* inode, int blks);
+int                newfs_extent_unmap(struct newfs_inode* inode, int lblk);
+int                newfs_extent_set(struct newfs_inode* inode, int lblk, int pblk);
+int                newfs_extent_load(struct newfs_inode* inode, struct newfs_inode_d* inode_d);
+int                newfs_extent_sync(struct newfs_inode* inode, struct newfs_inode_d* inode_d);
+void               newfs_extent_free(struct newfs_inode* inode);
+void               newfs_extent_release(struct newfs_inode* inode);
+int                newfs_extent_sync_blks(int blks);
+
+// newfs_indirect.c
+int                newfs_indirect_bmap(struct newfs_inode* inode, int lblk, boolean create);
+void               newfs_indirect_truncate(struct newfs_inode* inode, int blks);
+int                newfs_indirect_unmap(struct newfs_inode* inode, int lblk);
+int                newfs_indirect_set(struct newfs_inode* inode, int lblk, int pblk);
+int                newfs_indirect_load(struct newfs_inode* inode, struct newfs_inode_d* inode_d);
+int                newfs_indirect_sync(struct newfs_inode* inode, struct newfs_inode_d* inode_d);
+void               newfs_indirect_free(struct newfs_inode* inode);
+void               newfs_indirect_release(struct newfs_inode* inode);
+int                newfs_indirect_sync_blks(int blks);
+
+// newfs_dir.c
+uint32_t           newfs_name_hash(const char* name, int len);
+void               newfs_dir_hash_insert(struct newfs_inode* inode, struct newfs_dentry* dentry);
+void               newfs_dir_hash_remove(struct newfs_inode* inode, struct newfs_dentry* dentry);
+struct newfs_dentry* newfs_dir_find(struct newfs_inode* inode, const char* name, int len);
+void               newfs_dir_hash_free(struct newfs_inode* inode);
+
+// newfs_pcache.c
+int                newfs_pcache_init(int nr_ents);
+struct newfs_dentry* newfs_pcache_lookup(const char* path, int len, boolean* is_neg);
+void               newfs_pcache_insert(const char* path, int len, struct newfs_dentry* dentry);
+void               newfs_pcache_insert_neg(const char* path, int len, struct newfs_dentry* parent);
+void               newfs_pcache_forget(const char* path);
+void               newfs_pcache_invalidate();
+void               newfs_pcache_destroy();
+
+// newfs_flush.c
+void               newfs_stage_add(int blk, uint8_t* content, int blks);
+void               newfs_stage_overlay(int blk, uint8_t** bufs, int blks);
+void               newfs_stage_update(int blk, uint8_t* data);
+void               newfs_stage_wait();
+int                newfs_stage_sync();
+int                newfs_flush_round();
+void               newfs_flusher_kick();
+int                newfs_flusher_start();
+void               newfs_flusher_stop();
+
+// newfs_journal.c
+int                newfs_journal_init(int offset, int blks, boolean format);
+void               newfs_journal_begin();
+int                newfs_journal_add(int blk, uint8_t* content, int blks);
+int                newfs_journal_commit();
+void               newfs_journal_abort();
+void               newfs_journal_reserve();
+int                newfs_journal_write_now(int blk, uint8_t** bufs, int blks);
+void               newfs_journal_checkpointed();
+void               newfs_journal_overlay(int blk, uint8_t** bufs, int blks);
+int                newfs_journal_close();
+
+// newfs_readahead.c
+void               newfs_readahead(struct newfs_inode* inode, int lblk, int blks);
+int                newfs_readahead_start();
+void               newfs_readahead_stop();
+
+// newfs_lz.c
+int                newfs_lz_compress(const uint8_t* src, int len, uint8_t* dst, int cap);
+int                newfs_lz_decompress(const uint8_t* src, int len, uint8_t* dst, int cap);
+
+// newfs_compress.c
+boolean            newfs_comp_packed(struct newfs_inode* inode, int clu);
+int                newfs_comp_read(struct newfs_inode* inode, int clu, uint8_t** bufs);
+int                newfs_comp_write(struct newfs_inode* inode, int clu);
+
+// newfs_dedup.c
+int                newfs_dedup_init(int offset, int blks, boolean format);
+int                newfs_dedup_block(struct newfs_inode* inode, int lblk);
+void               newfs_dedup_put(int bno);
+int                newfs_dedup_sync();
+void               newfs_dedup_destroy();
+
+// newfs_crc.c
+uint32_t           newfs_crc32c(uint32_t crc, const void* data, size_t len);
+const char*        newfs_crc32c_impl();
+
+// newfs_csum.c
+int                newfs_csum_init(int offset, int blks, boolean format);
+boolean            newfs_csum_covered(int blk);
+void               newfs_csum_update(int blk, const uint8_t* data);
+int                newfs_csum_verify(int blk, uint8_t** bufs, int blks);
+int                newfs_csum_sync();
+void               newfs_csum_destroy();
+
+// newfs_ll.c
+int                newfs_ll_main(struct fuse_args* args);
+
+// newfs_debug.c
+void               newfs_dump_cache_stats();
 
 #endif  /* _newfs_H_ */
\ No newline at end of file
@@ -4,6 +4,11 @@
 typedef int          boolean;
 typedef uint16_t     flag16;
 
+typedef enum newfs_map_mode {
+    NFS_MAP_EXTENT,                         /* extent 映射 */
+    NFS_MAP_INDIRECT                        /* 直接块 + 一级/二级间接块 */
+} NFS_MAP_MODE;
+
 typedef enum newfs_file_type {
     NFS_REG_FILE,
     NFS_DIR,
@@ -14,9 +19,13 @@ typedef enum newfs_file_type {
 #define FALSE                   0
 #define UINT32_BITS             32
 #define UINT8_BITS              8
+#define NFS_BM_WORD_BITS        64          /* 位图按 64 位字扫描 */
 
-#define NFS_MAGIC_NUM           0x52415453  
+#define NFS_MAGIC_NUM           0x5241545C  /* 布局变化时修改，旧镜像会被重新格式化 */
 #define NFS_SUPER_OFS           0
+#define NFS_JOURNAL_MAGIC       0x4a484452  /* 日志头 */
+#define NFS_JDESC_MAGIC         0x4a444553  /* 事务描述块 */
+#define NFS_JCOMMIT_MAGIC       0x4a434d54  /* 事务提交块 */
 #define NFS_ROOT_INO            0
 
 #define NFS_ERROR_NONE          0
@@ -29,37 +38,90 @@ typedef enum newfs_file_type {
 #define NFS_ERROR_UNSUPPORTED   ENXIO
 #define NFS_ERROR_IO            EIO     /* Error Input/Output */
 #define NFS_ERROR_INVAL         EINVAL  /* Invalid Args */
+#define NFS_ERROR_NOTDIR        ENOTDIR
+#define NFS_ERROR_NAMETOOLONG   ENAMETOOLONG
 
 #define NFS_MAX_FILE_NAME       128
 #define NFS_INODE_PER_FILE      1
-#define NFS_DATA_PER_FILE       6
+#define NFS_INLINE_EXTENTS      8           /* inode 内直接存放的 extent 数 */
+#define NFS_DIRECT_BLKS         12          /* inode 内的直接块指针数 */
 #define NFS_DEFAULT_PERM        0777
+#define NFS_DEFAULT_CACHE_BLKS  256         /* 默认缓存块数 */
+#define NFS_MIN_CACHE_BLKS      8           /* 缓存块数下限 */
+#define NFS_DIR_HASH_MIN        16          /* 目录哈希表初始桶数 */
+#define NFS_PCACHE_ENTS         1024        /* 路径缓存项数 */
+#define NFS_PCACHE_NEG_MAX      256         /* 其中最多可以有多少条不存在的路径 */
+#define NFS_DEFAULT_FLUSH_MS    5000        /* 默认后台回写周期（毫秒） */
+#define NFS_DEFAULT_DIRTY_BYTES (1 << 20)   /* 脏数据超过这么多时提前回写 */
+#define NFS_DEFAULT_FILE_BLKS   1024        /* 默认常驻内存的文件数据块数 */
+#define NFS_RA_MIN_BLKS         4           /* 顺序读开始时的预读窗口 */
+#define NFS_DEFAULT_RA_BLKS     32          /* 默认预读窗口上限 */
+#define NFS_RA_QUEUE            16          /* 预读请求队列长度 */
+#define NFS_RA_GAP_BLKS         2           /* 设备上相距这么近的两段合成一次预读 */
+#define NFS_NSEC_PER_SEC        1000000000ULL
+#define NFS_RELATIME_SEC        (24 * 3600) /* atime 至少这么久更新一次 */
+#define NFS_ATTR_TIMEOUT        5.0         /* 内核缓存属性和目录项的秒数，所有改动都经过本进程 */
+#define NFS_NEG_TIMEOUT         5.0         /* 内核缓存不存在的名字的秒数 */
+#define NFS_COMP_CLUSTER_BLKS   4           /* 压缩文件每这么多块作为一簇一起压缩 */
+#define NFS_LZ_HASH_BITS        12          /* LZ 压缩匹配表大小 */
+#define NFS_LZ_MIN_MATCH        4           /* 最短匹配长度 */
+#define NFS_DEDUP_NONE          0           /* 去重表中表示没有登记指纹 */
+#define NFS_CSUM_NONE           0           /* 校验表中表示没有记录校验和 */
+#define NFS_CSUM_SCAN_BLKS      64          /* 崩溃恢复后重算校验和时每次读的块数 */
+
+/* inode 的脏标志 */
+#define NFS_DIRTY_INODE         0x1         /* 磁盘 inode（大小、映射、目录项数）需要重写 */
+#define NFS_DIRTY_DATA          0x2         /* 有脏数据块，见 blk_dirty */
+#define NFS_DIRTY_DIR           0x4         /* 有目录块需要重写，见 dir_dirty_from */
 
 #define NFS_SUPER_BLKS          1           /* 超级块块数 */
 #define NFS_MAP_INODE_BLKS      1           /* 索引块位图块数 */
 #define NFS_MAP_DATA_BLKS       1           /* 数据块位图块数 */
+#define NFS_JOURNAL_BLKS        256         /* 元数据日志块数，要放得下一轮回写的全部元数据 */
+#define NFS_DEDUP_BLKS          27          /* 去重表块数，每个数据块一项 */
+#define NFS_CSUM_BLKS           17          /* 校验表块数，每个逻辑块一项 */
 #define NFS_INODE_BLKS          585         /* 索引块数 */
-#define NFS_DATA_BLKS           3508        /* 数据块数 */
+#define NFS_DATA_BLKS           3208        /* 数据块数 */
 
 
 #define NFS_IO_SZ()                     (newfs_super.sz_io)
 #define NFS_DISK_SZ()                   (newfs_super.sz_disk)
 #define NFS_BLK_SZ()                    (newfs_super.sz_blk)
 #define NFS_DRIVER()                    (newfs_super.driver_fd)
+#define NFS_CACHE()                     (&newfs_super.cache)
+#define NFS_PCACHE()                    (&newfs_super.pcache)
+#define NFS_STAGE()                     (&newfs_super.stage)
+#define NFS_JOURNAL()                   (&newfs_super.journal)
+#define NFS_RA()                        (&newfs_super.ra)
+#define NFS_COMP()                      (&newfs_super.comp)
+#define NFS_DEDUP()                     (&newfs_super.dedup)
+#define NFS_CSUM()                      (&newfs_super.csum)
+#define NFS_LOCK()                      pthread_mutex_lock(&newfs_super.lock)
+#define NFS_UNLOCK()                    pthread_mutex_unlock(&newfs_super.lock)
 
 #define NFS_ROUND_DOWN(value, round)    (value % round == 0            ? value : (value / round) * round)
 #define NFS_ROUND_UP(value, round)      (value % round == 0 ? value : (value / round + 1) * round)
 
-#define NFS_BLKS_SZ(blks)               (blks * NFS_BLK_SZ()) // 计算所占空间大小
+#define NFS_BLKS_SZ(blks)               ((blks) * NFS_BLK_SZ()) // 计算所占空间大小
+#define NFS_BLKS_OF(size)               (((size) + NFS_BLK_SZ() - 1) / NFS_BLK_SZ()) // 覆盖 size 字节所需块数
 #define NFS_ASSIGN_FNAME(pnfs_dentry, _fname) memcpy(pnfs_dentry->fname, _fname, strlen(_fname))
-#define NFS_INO_OFS(ino)                (newfs_super.data_offset + ino * NFS_BLKS_SZ((\
-                                        NFS_INODE_PER_FILE + NFS_DATA_PER_FILE)))
-#define NFS_DATA_OFS(ino)               (NFS_INO_OFS(ino) + NFS_BLKS_SZ(NFS_INODE_PER_FILE))
+#define NFS_INO_OFS(ino)                (newfs_super.inode_offset + NFS_BLKS_SZ((ino) * NFS_INODE_PER_FILE))
+#define NFS_DATA_OFS(bno)               (newfs_super.data_offset + NFS_BLKS_SZ(bno))
+#define NFS_DATA_BLK(bno)               (NFS_DATA_OFS(bno) / NFS_BLK_SZ())   // 数据块在整个磁盘上的逻辑块号
+#define NFS_INLINE_SZ()                 (NFS_BLK_SZ() - (int)sizeof(struct newfs_inode_d))  // inode 块中能内联的数据字节数
+#define NFS_DENTRY_PER_BLK()            (NFS_BLK_SZ() / (int)sizeof(struct newfs_dentry_d))
+#define NFS_EXTENT_PER_BLK()            ((NFS_BLK_SZ() - (int)sizeof(struct newfs_extent_blk_d)) \
+                                        / (int)sizeof(struct newfs_extent))
+#define NFS_PTRS_PER_BLK()              (NFS_BLK_SZ() / (int)sizeof(int))  // 一个间接块中的块指针数
 
 #define NFS_IS_DIR(pinode)              (pinode->dentry->ftype == NFS_DIR)
 #define NFS_IS_REG(pinode)              (pinode->dentry->ftype == NFS_REG_FILE)
 #define NFS_IS_SYM_LINK(pinode)         (pinode->dentry->ftype == NFS_SYM_LINK)
 
+#if FUSE_VERSION >= 29
+typedef int (*newfs_buf_fn)(struct fuse_bufvec* blks, void* arg);   /* 处理指向文件块的缓冲区向量 */
+#endif
+
 /******************************************************************************
 * SECTION: FS Specific Structure - In memory structure
 *******************************************************************************/
@@ -70,8 +132,216 @@ struct newfs_super;
 struct custom_options
 {
     const char *device;
+    int         cache_blks;                             /* 块缓存大小（逻辑块数） */
+    int         indirect;                               /* 新文件使用间接块映射 */
+    int         flush_ms;                               /* 后台回写周期（毫秒），0 表示只在卸载时写 */
+    int         dirty_bytes;                            /* 脏数据达到这么多字节时立即回写 */
+    int         file_blks;                              /* 常驻内存的文件数据块上限，超出时淘汰干净块，0 表示不限 */
+    int         ra_blks;                                /* 预读窗口上限（块数），0 表示不预读 */
+    int         lowlevel;                               /* 使用 FUSE 低层接口，按 inode 寻址 */
+    int         compress;                               /* 新建的文件压缩存放 */
+    int         dedup;                                  /* 写回时内容相同的数据块共享存放 */
+};
+
+// 位图分配器，直接操作 map_inode / map_data 的内存
+struct newfs_bitmap
+{
+    uint64_t*          words;
+    int                nbits;                           /* 可分配的位数 */
+    int                hint;                            /* 下次从这个字开始找（next-fit） */
+    int                nfree;                           /* 空闲位数 */
+    boolean            dirty;                           /* 有改动尚未写回 */
+};
+
+// 块缓存中的一个缓冲块
+struct newfs_buf
+{
+    int                blk;                             /* 对应的逻辑块号, -1 表示空闲 */
+    uint8_t*           data;
+    boolean            dirty;                           /* 是否需要写回 */
+    struct newfs_buf*  hash_next;                       /* 哈希链 */
+    struct newfs_buf*  lru_prev;                        /* 越靠前越新 */
+    struct newfs_buf*  lru_next;
+};
+
+// 逻辑块缓存（哈希 + LRU），位于驱动读写之下
+struct newfs_cache
+{
+    struct newfs_buf*  bufs;                            /* 预分配的缓冲块数组 */
+    struct newfs_buf** hash;
+    int                nr_bufs;
+    int                nr_hash;                         /* 2 的幂 */
+    struct newfs_buf*  lru_head;                        /* 最近使用 */
+    struct newfs_buf*  lru_tail;                        /* 最久未使用，优先淘汰 */
+
+    uint64_t           hits;
+    uint64_t           misses;
+    uint64_t           evictions;
+    uint64_t           writebacks;
+};
+
+// 路径缓存中的一项：完整路径 -> dentry
+// 负项表示路径不存在，dentry 记录查找停下的那个目录
+struct newfs_pcache_ent
+{
+    char*              path;                            /* NULL 表示空闲 */
+    int                len;
+    uint32_t           hash;
+    uint32_t           gen;                             /* 插入时的代数，与当前代数不同即失效 */
+    boolean            negative;
+    uint32_t           neg_gen;                         /* 负项插入时目录的 neg_gen */
+    struct newfs_dentry* dentry;
+    struct newfs_pcache_ent* hash_next;
+    struct newfs_pcache_ent* lru_prev;                  /* 越靠前越新 */
+    struct newfs_pcache_ent* lru_next;
+};
+
+struct newfs_pcache_lru
+{
+    struct newfs_pcache_ent* head;                      /* 最近使用 */
+    struct newfs_pcache_ent* tail;                      /* 优先淘汰 */
+};
+
+// 全路径缓存（哈希 + LRU），命中时 newfs_lookup 不必从根逐级查找
+struct newfs_pcache
+{
+    struct newfs_pcache_ent*  ents;
+    struct newfs_pcache_ent** hash;
+    int                nr_ents;
+    int                nr_hash;                         /* 2 的幂 */
+    struct newfs_pcache_lru lru[2];                     /* [0] 正项和空闲项, [1] 负项 */
+    int                nr_neg;
+    uint32_t           gen;                             /* 目录被删除或改名时加一，整体失效 */
+
+    uint64_t           hits;
+    uint64_t           neg_hits;
+    uint64_t           misses;
+};
+
+// 暂存的一个待写块
+struct newfs_stage_ent
+{
+    int                blk;                             /* 逻辑块号 */
+    int                seq;                             /* 暂存顺序，同一块多次暂存时以最后一次为准 */
+    uint8_t*           data;
+};
+
+// 回写暂存区：持锁时把要写的块复制到这里，放锁后按设备顺序写盘
+struct newfs_stage
+{
+    struct newfs_stage_ent* ents;
+    int                cnt;
+    int                cap;
+    boolean            active;                          /* 此时整块写入进入暂存区而不直接写盘 */
+    boolean            sorted;                          /* 已按块号排序去重，可二分查找 */
+    boolean            writing;                         /* 已放锁写盘，内容只读 */
+};
+
+// 元数据日志（环形），一次回写中的全部元数据块作为一个事务提交
+struct newfs_journal
+{
+    int                offset;                          /* 日志区起始逻辑块号 */
+    int                blks;                            /* 日志区块数，第 0 块是日志头 */
+    int                max_txn;                         /* 一次提交最多的块数 */
+    uint32_t           seq;                             /* 下一个事务的序号 */
+    int                head;                            /* 下一个事务从日志区第几块开始写 */
+    uint32_t           ckpt_seq;                        /* 序号比它小的事务都已写回原位 */
+    boolean            active;                          /* 此时整块元数据写入进入事务 */
+    boolean            dirty;                           /* 日志头需要更新 */
+    boolean            overflow;                        /* 当前事务放不下，整个放弃 */
+    int*               txn_blks;                        /* 当前事务中各块的逻辑块号 */
+    uint8_t**          txn_data;
+    int                txn_cnt;
+
+    uint64_t           commits;
+    uint64_t           logged;                          /* 写进日志的块数 */
+    uint64_t           replayed;                        /* 挂载时重放的块数 */
+    int*               replay_blks;                     /* 重放过的各块的逻辑块号，共 replayed 个 */
+};
+
+// 一次预读：设备上连续的一段块
+struct newfs_ra_req
+{
+    int                blk;                             /* 起始逻辑块号 */
+    int                cnt;
+};
+
+// 预读线程和它的请求队列，读到的块放进块缓存
+struct newfs_ra
+{
+    struct newfs_ra_req reqs[NFS_RA_QUEUE];             /* 环形队列 */
+    int                head;
+    int                cnt;
+    pthread_t          thread;
+    pthread_cond_t     cond;                            /* 有新请求 */
+    boolean            running;
+    boolean            stop;
+
+    uint64_t           windows;                         /* 发起的预读窗口数 */
+    uint64_t           blks;                            /* 预读进缓存的块数 */
+    uint64_t           discards;                        /* 读的同时设备被写过而丢弃的块数 */
+    uint64_t           drops;                           /* 队列满时放弃的请求数 */
+};
+
+// 数据压缩统计
+struct newfs_comp
+{
+    uint64_t           packed;                          /* 压缩后写盘的簇数 */
+    uint64_t           raw;                             /* 压不小、原样写盘的簇数 */
+    uint64_t           in_blks;                         /* 写回的文件数据块数 */
+    uint64_t           out_blks;                        /* 实际写盘的块数 */
+    uint64_t           unpacked;                        /* 解压的簇数 */
+    uint64_t           comp_ns;                         /* 压缩用的 CPU 时间（纳秒） */
+    uint64_t           decomp_ns;                       /* 解压用的 CPU 时间（纳秒） */
 };
 
+// 块级去重：磁盘上每个数据块一项的指纹和引用计数表，以及内存中按指纹查块的哈希表
+struct newfs_dedup
+{
+    struct newfs_dedup_d* ents;                         /* 去重表内容，下标是数据块号 */
+    int                offset;                          /* 去重表起始逻辑块号 */
+    int                blks;                            /* 去重表块数 */
+    boolean*           blk_dirty;                       /* 去重表各块是否需要写回 */
+    int*               heads;                           /* 指纹哈希桶，-1 表示空 */
+    int*               next;                            /* 同一桶中的下一个数据块 */
+    int                nr_heads;                        /* 桶数，2 的幂 */
+
+    uint64_t           hashed;                          /* 算过指纹的块数 */
+    uint64_t           shared;                          /* 改为共享已有块、不必写盘的块数 */
+    uint64_t           cows;                            /* 改写共享块时另行分配的块数 */
+    uint64_t           collisions;                      /* 指纹相同但内容不同的次数 */
+};
+
+// 块校验：每个逻辑块一项 CRC32C，从设备读出时校验，缓存命中时不再算。
+// 超级块和日志区自带校验和，校验表的每块最后 4 字节是本块其余内容的校验和
+struct newfs_csum
+{
+    uint32_t*          ents;                            /* 校验表内容 */
+    int                offset;                          /* 校验表起始逻辑块号 */
+    int                blks;                            /* 校验表块数 */
+    int                per;                             /* 每块记录的逻辑块数 */
+    boolean*           blk_dirty;                       /* 校验表各块是否需要写回 */
+
+    uint64_t           verified;                        /* 从设备读出后校验过的块数 */
+    uint64_t           errors;                          /* 校验失败的块数 */
+    uint64_t           repaired;                        /* 崩溃恢复后按盘上内容重算的块数 */
+};
+
+// 一段连续映射：文件逻辑块 [lblk, lblk + len) -> 数据块 [pblk, pblk + len)
+struct newfs_extent
+{
+    uint32_t           lblk;                            /* 文件内起始逻辑块号 */
+    uint32_t           pblk;                            /* 数据区内起始块号 */
+    uint32_t           len;                             /* 连续块数 */
+};
+
+// 内存中的一个间接块，按需读入后常驻
+struct newfs_ind
+{
+    int                bno;                             /* 所在数据块号, -1 表示未分配 */
+    int*               ptrs;                            /* 块内容, NULL 表示尚未读入 */
+    boolean            dirty;
+};
 
 // 索引
 struct newfs_inode
@@ -79,11 +349,57 @@ struct newfs_inode
     uint32_t           ino;                             /* 在inode位图中的下标 */
     int                size;                            /* 文件已占用空间 */
     int                dir_cnt;
+    uint64_t           atime;                           /* 访问时间（纳秒），relatime 规则更新 */
+    uint64_t           mtime;                           /* 内容修改时间（纳秒） */
+    uint64_t           ctime;                           /* inode 改变时间（纳秒） */
     struct newfs_dentry* dentry;                        /* 指向该inode的dentry */
-    struct newfs_dentry* dentrys;                       /* 所有目录项 */
-    uint8_t*           block_pointer[NFS_DATA_PER_FILE];// 指向数据块的指针
-    uint8_t*           data;
-    int                bno[NFS_DATA_PER_FILE];             /* 数据块在磁盘中的块号 */           
+    struct newfs_dentry* dentrys;                       /* 所有目录项，按插入顺序 */
+    struct newfs_dentry* dentrys_tail;
+    struct newfs_dentry* rd_cursor;                     /* 上次按序号取到的目录项，顺序遍历时从这里继续 */
+    int                rd_pos;                          /* rd_cursor 的序号 */
+    struct newfs_dentry** dir_hash;                     /* 按名字索引目录项，首次查找时建立 */
+    int                dir_hash_size;                   /* 桶数，2 的幂 */
+    uint32_t           neg_gen;                         /* 目录中新增目录项时加一，使负项失效 */
+    uint8_t**          block_pointer;                   /* 文件数据，按文件逻辑块号索引，NULL 表示还没读入 */
+    uint8_t*           blk_dirty;                       /* 与 block_pointer 一一对应 */
+    int                blks;                            /* block_pointer 中的块数 */
+    int                blks_loaded;                     /* 已读入内存的块数 */
+    struct newfs_inode* res_prev;                       /* 有数据块在内存中的文件，越靠前越新 */
+    struct newfs_inode* res_next;
+    int                ra_next;                         /* 顺序读时下一次读应从这一块开始 */
+    int                ra_size;                         /* 当前预读窗口，0 表示不在顺序读 */
+    int                ra_end;                          /* 已经预读到这一块（不含） */
+    int                ra_mark;                         /* 读到这一块时发起下一个窗口 */
+    pthread_rwlock_t   rwlock;                          /* 文件数据：读共享，写独占 */
+    int                ref;                             /* 正在读写的操作数，由 newfs_super.lock 保护 */
+    int                opens;                           /* 打开的文件句柄数 */
+    int                nlookup;                         /* 内核持有的查找引用数（低层接口），forget 时减少 */
+    boolean            orphan;                          /* 已被删除但仍在使用，最后一个使用者释放 */
+
+    flag16             dirty;                           /* NFS_DIRTY_* */
+    int                dir_dirty_from;                  /* 从这个目录块起需要重写 */
+    struct newfs_inode* dirty_prev;                     /* 脏 inode 链表 */
+    struct newfs_inode* dirty_next;
+
+    struct newfs_extent* extents;                       /* 按 lblk 排序 */
+    int                extent_cnt;
+    int                extent_cap;
+    int*               extent_blks;                     /* 存放溢出 extent 的数据块号 */
+    int                extent_blk_cnt;
+    int                memo_ext;                        /* 上次命中的 extent 下标 */
+
+    NFS_MAP_MODE       map_mode;
+    int                bno[NFS_DIRECT_BLKS];            /* 直接块, -1 表示未分配 */
+    struct newfs_ind   ind;                             /* 一级间接块 */
+    struct newfs_ind   dind;                            /* 二级间接块 */
+    struct newfs_ind*  dind_sub;                        /* dind 指向的各个一级间接块 */
+    int*               memo_slots;                      /* 上次翻译所在的那组块指针 */
+    struct newfs_ind*  memo_owner;                      /* memo_slots 所属的间接块, 直接块时为 NULL */
+    int                memo_base;                       /* memo_slots[0] 对应的文件逻辑块号 */
+    int                memo_span;
+
+    boolean            inline_data;                     /* 数据存放在 inode 块中（只有第 0 块），不占数据块 */
+    boolean            compress;                        /* 数据按簇压缩存放，block_pointer 中是解压后的块 */
 }; 
 
 
@@ -96,6 +412,9 @@ struct newfs_dentry
     struct newfs_dentry* brother;                       // 兄弟
     struct newfs_inode*  inode;                         // 指向inode
     NFS_FILE_TYPE       ftype;
+    uint32_t            name_hash;                      // 文件名哈希
+    int                 name_len;
+    struct newfs_dentry* hash_next;                     // 目录哈希链
 };
 
 
@@ -119,17 +438,53 @@ struct newfs_super
     uint8_t*           map_inode;           /*  */
     int                map_inode_blks;      /* 索引位图块数 */
     int                map_inode_offset;
+    struct newfs_bitmap inode_bmap;         /* 索引位图分配器 */
 
     uint8_t*            map_data;           /* 指向数据块位图的内存起点 */ 
     int                 map_data_blks;      /* 数据块位图占用的块数 */
     int                 map_data_offset;    /* 数据块位图在磁盘上的偏移 */
+    struct newfs_bitmap data_bmap;          /* 数据块位图分配器 */
     
     int                inode_offset;        /* 索引结点的偏移 */
     int                data_offset;         /* 数据块偏移 */
 
     boolean            is_mounted;          /* 是否已经挂载 */
+    boolean            super_dirty;         /* 超级块有改动，卸载时写回（格式化时已同步写过） */
+    struct newfs_inode* dirty_head;         /* 所有脏 inode */
+    int                dirty_blks;          /* 估计的脏块数，用于触发提前回写 */
+    struct newfs_inode* res_head;           /* 有数据块在内存中的文件 */
+    struct newfs_inode* res_tail;           /* 最久未访问，优先淘汰 */
+    int                res_blks;            /* 内存中的文件数据块总数 */
+    uint64_t           faults;              /* 按需读入的块数 */
+    uint64_t           evicts;              /* 淘汰的干净块数 */
+
+    /*
+     * 加锁顺序：inode->rwlock -> lock -> dev_lock
+     * lock 保护除文件数据内容外的全部内存结构（目录树、位图、缓存、日志等），可重入；
+     * 读写文件时在 inode->rwlock 下放开 lock 拷贝数据。持有 lock 时对 inode 只能 trylock
+     */
+    pthread_mutex_t    lock;
+    pthread_mutex_t    dev_lock;            /* 保证 seek 与读写成对执行 */
+    uint32_t           dev_wgen;            /* 设备写入次数，由 dev_lock 保护 */
+    uint64_t           dev_seeks;           /* 设备读写请求数（每次一次寻道），由 dev_lock 保护 */
+    uint64_t           dev_wblks;           /* 写入设备的块数 */
+    pthread_cond_t     flush_cond;          /* 唤醒回写线程 */
+    pthread_cond_t     stage_cond;          /* 一轮回写写盘完成，或开始收集 */
+    pthread_t          flusher;
+    boolean            flusher_running;
+    boolean            flusher_stop;
+    struct newfs_stage stage;               /* 正在写盘的块 */
+    boolean            sync_gate;           /* 一轮回写在等拷贝中的文件，新的写者先等 stage_cond */
+    struct newfs_journal journal;           /* 元数据日志 */
+    struct newfs_ra    ra;                  /* 顺序读预读 */
+    struct newfs_comp  comp;                /* 压缩统计 */
+    struct newfs_dedup dedup;               /* 块级去重 */
+    struct newfs_csum  csum;                /* 块校验 */
 
     struct newfs_dentry* root_dentry;
+
+    struct newfs_cache cache;               /* 逻辑块缓存 */
+    struct newfs_pcache pcache;             /* 路径缓存 */
 };
 
 
@@ -143,6 +498,7 @@ static inline struct newfs_dentry* new_dentry(char * fname, NFS_FILE_TYPE ftype)
     struct newfs_dentry * dentry = (struct newfs_dentry *)malloc(sizeof(struct newfs_dentry)); /* dentry 在内存空间也是随机分配 */
     memset(dentry, 0, sizeof(struct newfs_dentry));
     NFS_ASSIGN_FNAME(dentry, fname);
+    dentry->name_len = strlen(dentry->fname);
     dentry->ftype   = ftype;
     dentry->ino     = -1;
     dentry->inode   = NULL;
@@ -167,8 +523,44 @@ struct newfs_super_d
     int         map_data_blks;      /* data 位图占用的块数 */
     int         map_data_offset;    /* data 位图在磁盘上的偏移 */
 
+    int         journal_offset;     /* 日志区在磁盘上的偏移 */
+    int         journal_blks;       /* 日志区块数 */
+
+    int         dedup_offset;       /* 去重表在磁盘上的偏移 */
+    int         dedup_blks;         /* 去重表块数 */
+
+    int         csum_offset;        /* 校验表在磁盘上的偏移 */
+    int         csum_blks;          /* 校验表块数 */
+
     int         inode_offset;       /* 索引结点的偏移 */
     int         data_offset;        /* 数据块的偏移*/
+
+    uint32_t    csum;               /* 超级块本身的 CRC32C，计算时此项为 0 */
+};
+
+// 日志头，位于日志区第 0 块
+struct newfs_journal_d
+{
+    uint32_t           magic;
+    uint32_t           seq;                                /* 从 start 处开始的第一个事务的序号 */
+    int                start;                              /* 挂载时从日志区第几块开始扫描 */
+};
+
+// 事务描述块，后面紧跟 cnt 个块的内容，最后是提交块
+struct newfs_jdesc_d
+{
+    uint32_t           magic;
+    uint32_t           seq;
+    uint32_t           ckpt_seq;                           /* 提交时序号比它小的事务都已写回原位 */
+    int                cnt;
+    int                blks[];                             /* 各块的逻辑块号 */
+};
+
+struct newfs_jcommit_d
+{
+    uint32_t           magic;
+    uint32_t           seq;
+    uint32_t           csum;                               /* 事务各块内容的校验和 */
 };
 
 struct newfs_inode_d
@@ -176,12 +568,49 @@ struct newfs_inode_d
     int                ino;                                /* 在inode位图中的下标 */
     int                size;                               /* 文件已占用空间 */
     int                dir_cnt;
-    /* 数据块的索引 */
-    int                block_pointer[NFS_DATA_PER_FILE];   // 数据块指针（可固定分配）
     NFS_FILE_TYPE      ftype;   
-    int                bno[NFS_DATA_PER_FILE];             /* 数据块在磁盘中的块号 */  
+    uint64_t           atime;                              /* 纳秒 */
+    uint64_t           mtime;
+    uint64_t           ctime;
+    boolean            inline_data;                        /* 文件数据紧跟在本结构之后，长度为 size */
+    boolean            compress;                           /* 数据按簇压缩存放 */
+    /* 数据块的索引 */
+    NFS_MAP_MODE       map_mode;
+    union {
+        struct {                                           /* NFS_MAP_EXTENT */
+            int                extent_cnt;                 /* extent 总数 */
+            int                extent_blk;                 /* 第一个溢出 extent 块, -1 表示没有 */
+            struct newfs_extent extents[NFS_INLINE_EXTENTS]; /* 前 NFS_INLINE_EXTENTS 个 extent */
+        };
+        struct {                                           /* NFS_MAP_INDIRECT */
+            int                bno[NFS_DIRECT_BLKS];
+            int                ind;                        /* 一级间接块, -1 表示没有 */
+            int                dind;                       /* 二级间接块, -1 表示没有 */
+        };
+    };
 };  
 
+// 溢出 extent 块的头部，后面紧跟 extent 数组
+struct newfs_extent_blk_d
+{
+    int                next;                               /* 下一个 extent 块, -1 表示结束 */
+    int                cnt;                                /* 本块中的 extent 数 */
+};
+
+// 压缩簇在盘上的头部，后面紧跟压缩数据，占簇的前几个块，其余块不映射
+struct newfs_comp_d
+{
+    uint32_t           len;                                /* 压缩后的字节数 */
+    uint32_t           raw_len;                            /* 压缩前的字节数 */
+};
+
+// 去重表项，下标是数据块号
+struct newfs_dedup_d
+{
+    uint32_t           hash;                               /* 内容指纹，NFS_DEDUP_NONE 表示没有登记 */
+    uint32_t           ref;                                /* 映射到这个块的文件块数，0 表示不参与去重 */
+};
+
 struct newfs_dentry_d
 {
     char               fname[NFS_MAX_FILE_NAME];
@@ -14,6 +14,15 @@
  *******************************************************************************/
 static const struct fuse_opt option_spec[] = {/* 用于FUSE文件系统解析参数 */
 											  OPTION("--device=%s", device),
+											  OPTION("--cache_blks=%d", cache_blks),
+											  OPTION("--indirect", indirect),
+											  OPTION("--flush_ms=%d", flush_ms),
+											  OPTION("--dirty_bytes=%d", dirty_bytes),
+											  OPTION("--file_blks=%d", file_blks),
+											  OPTION("--ra_blks=%d", ra_blks),
+											  OPTION("--lowlevel", lowlevel),
+											  OPTION("--compress", compress),
+											  OPTION("--dedup", dedup),
 											  FUSE_OPT_END};
 
 struct custom_options newfs_options; /* 全局选项 */
@@ -30,14 +39,21 @@ static struct fuse_operations operations = {
 	.mknod = newfs_mknod,	  /* 创建文件，touch相关 */
 	.write = newfs_write,	  /* 写入文件 */
 	.read = newfs_read,	      /* 读文件 */
-	.utimens = newfs_utimens, /* 修改时间，忽略，避免touch报错 */
-	.truncate = NULL,		  /* 改变文件大小 */
+	.utimens = newfs_utimens, /* 修改时间 */
+	.truncate = newfs_truncate, /* 改变文件大小 */
 	.unlink = newfs_unlink,	  /* 删除文件 */
 	.rmdir = newfs_rmdir,	  /* 删除目录， rm -r */
 	.rename = newfs_rename,	  /* 重命名，mv */
 
-	.open = NULL,
-	.opendir = NULL,
+	.open = newfs_open,		  /* 打开后的读写直接用句柄，不再查找路径 */
+	.opendir = newfs_opendir,
+	.release = newfs_release,
+	.releasedir = newfs_releasedir,
+	.fgetattr = newfs_fgetattr,
+	.ftruncate = newfs_ftruncate,
+#if FUSE_VERSION >= 29
+	.write_buf = newfs_write_buf, /* 写入的数据直接拷进文件块 */
+#endif
 	.access = NULL};
 /******************************************************************************
  * SECTION: 必做函数实现
@@ -51,12 +67,22 @@ static struct fuse_operations operations = {
 void *newfs_init(struct fuse_conn_info *conn_info)
 {
 	/* TODO: 在这里进行挂载 */
+#if FUSE_VERSION >= 29
+	/* 内核支持时用 splice 收发数据，写入的数据不经过临时缓冲区 */
+	conn_info->want |= conn_info->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE);
+#endif
 	if (newfs_mount(newfs_options) != NFS_ERROR_NONE)
 	{
 		NFS_DBG("[%s] mount error\n", __func__);
 		fuse_exit(fuse_get_context()->fuse);
 		return NULL;
 	}
+	if (newfs_flusher_start() != NFS_ERROR_NONE) {
+		NFS_DBG("[%s] flusher start error\n", __func__);
+	}
+	if (newfs_readahead_start() != NFS_ERROR_NONE) {
+		NFS_DBG("[%s] readahead start error\n", __func__);
+	}
 	/* 下面是一个控制设备的示例 */
 	// super.driver_fd = ddriver_open(newfs_options.device);
 
@@ -72,6 +98,8 @@ void *newfs_init(struct fuse_conn_info *conn_info)
 void newfs_destroy(void *p)
 {
 	/* TODO: 在这里进行卸载 */
+	newfs_readahead_stop();
+	newfs_flusher_stop();
 	if (newfs_umount() != NFS_ERROR_NONE) {
 		NFS_DBG("[%s] unmount error\n", __func__);
 		fuse_exit(fuse_get_context()->fuse);
@@ -95,15 +123,24 @@ int newfs_mkdir(const char *path, mode_t mode)
 	(void)mode;
 	boolean is_find, is_root;
 	char* fname;
-	struct newfs_dentry* last_dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_dentry* last_dentry;
 	struct newfs_dentry* dentry;
 	struct newfs_inode*  inode;
 
+	NFS_LOCK();
+	newfs_journal_reserve();
+	last_dentry = newfs_lookup(path, &is_find, &is_root);
+	if (last_dentry == NULL) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_IO;
+	}
 	if (is_find) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_EXISTS;
 	}
 
 	if (NFS_IS_REG(last_dentry->inode)) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_UNSUPPORTED;
 	}
 	// if(last_dentry->inode->dir_cnt<6){
@@ -112,17 +149,47 @@ int newfs_mkdir(const char *path, mode_t mode)
 	dentry->parent = last_dentry;
 	
 	inode  = newfs_alloc_inode(dentry);
+	if (inode == NULL) {
+		free(dentry);
+		NFS_UNLOCK();
+		return -NFS_ERROR_NOSPACE;
+	}
 	newfs_alloc_dentry(last_dentry->inode, dentry);
 	// }else{
 	// 	printf("子目录数不能大于6\n");
 	// 	return NFS_ERROR_NONE;
 	// }
-
+	NFS_UNLOCK();
 	
 	printf("*****mkdir: %s*****\n", path);
 	return NFS_ERROR_NONE;
 }
 
+/**
+ * @brief 取得操作的 inode：打开过的用句柄里的，否则按路径查找，调用时持有 newfs_super.lock
+ *
+ * @param path 相对于挂载点的路径
+ * @param fi 可以为NULL
+ * @param inode 返回找到的 inode
+ * @return int 0成功，不存在时 -NFS_ERROR_NOTFOUND，读不出 inode 时 -NFS_ERROR_IO
+ */
+static int newfs_fh_inode(const char *path, struct fuse_file_info *fi, struct newfs_inode** inode)
+{
+	boolean is_find, is_root;
+	struct newfs_dentry* dentry;
+
+	if (fi && fi->fh) {
+		*inode = (struct newfs_inode*)(uintptr_t)fi->fh;
+		return NFS_ERROR_NONE;
+	}
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		return -NFS_ERROR_IO;
+	}
+	*inode = is_find ? dentry->inode : NULL;
+	return is_find ? NFS_ERROR_NONE : -NFS_ERROR_NOTFOUND;
+}
+
 /**
  * @brief 获取文件或目录的属性，该函数非常重要
  *
@@ -133,37 +200,30 @@ int newfs_mkdir(const char *path, mode_t mode)
 int newfs_getattr(const char *path, struct stat *newfs_stat)
 {
 	/* TODO: 解析路径，获取Inode，填充newfs_stat，可参考/fs/simplefs/sfs.c的sfs_getattr()函数实现 */
-	boolean is_find = FALSE, is_root = FALSE;
-	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
-	if (is_find == FALSE) {
-		return -NFS_ERROR_NOTFOUND;
-	}
-
-	if (NFS_IS_DIR(dentry->inode)) {
-		newfs_stat->st_mode = __S_IFDIR | NFS_DEFAULT_PERM;
-		newfs_stat->st_size = dentry->inode->dir_cnt * sizeof(struct newfs_dentry_d);
-	}
-	else if (NFS_IS_REG(dentry->inode)) {
-		newfs_stat->st_mode = __S_IFREG | NFS_DEFAULT_PERM;
-		newfs_stat->st_size = dentry->inode->size;
-	}
-	// else if (NFS_IS_SYM_LINK(dentry->inode)) {
-	// 	newfs_stat->st_mode = __S_IFLNK | NFS_DEFAULT_PERM;
-	// 	newfs_stat->st_size = dentry->inode->size;
-	// }
+	return newfs_fgetattr(path, newfs_stat, NULL);
+}
 
-	newfs_stat->st_nlink = 1;
-	newfs_stat->st_uid 	 = getuid();
-	newfs_stat->st_gid 	 = getgid();
-	newfs_stat->st_atime   = time(NULL);
-	newfs_stat->st_mtime   = time(NULL);
-	newfs_stat->st_blksize = NFS_BLK_SZ();
+/**
+ * @brief 获取已打开文件的属性，不必查找路径
+ *
+ * @param path 相对于挂载点的路径
+ * @param newfs_stat 返回状态
+ * @param fi 文件句柄，为NULL时按路径查找
+ * @return int 0成功，否则失败
+ */
+int newfs_fgetattr(const char *path, struct stat *newfs_stat, struct fuse_file_info *fi)
+{
+	struct newfs_inode* inode;
+	int ret;
 
-	if (is_root) {
-		newfs_stat->st_size	= newfs_super.sz_usage; 
-		newfs_stat->st_blocks = NFS_DISK_SZ() / NFS_BLK_SZ();
-		newfs_stat->st_nlink  = 2;		/* !特殊，根目录link数为2 */
+	NFS_LOCK();
+	ret = newfs_fh_inode(path, fi, &inode);
+	if (ret != NFS_ERROR_NONE) {
+		NFS_UNLOCK();
+		return ret;
 	}
+	newfs_inode_stat(inode, newfs_stat);
+	NFS_UNLOCK();
 	return NFS_ERROR_NONE;
 }
 
@@ -178,10 +238,11 @@ int newfs_getattr(const char *path, struct stat *newfs_stat)
  *				const struct stat *stbuf, off_t off)
  * buf: name会被复制到buf中
  * name: dentry名字
- * stbuf: 文件状态，可忽略
- * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
+ * stbuf: 文件状态，只用到类型位
+ * off: 下一次offset从哪里开始，0、1 是 . 和 ..，之后是第 off - 2 个dentry
+ * 返回1表示buf已满
  *
- * @param offset 第几个目录项？
+ * @param offset 从这一项开始
  * @param fi 可忽略
  * @return int 0成功，否则失败
  */
@@ -189,74 +250,122 @@ int newfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t off
 				  struct fuse_file_info *fi)
 {
 	/* TODO: 解析路径，获取目录的Inode，并读取目录项，利用filler填充到buf，可参考/fs/simplefs/sfs.c的sfs_readdir()函数实现 */
-	boolean	is_find = FALSE, is_root = FALSE;
-	int	cur_dir = offset;
-
-	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_dentry* sub_dentry;
 	struct newfs_inode* inode;
-	if (is_find) {
-		inode = dentry->inode;
-		sub_dentry = newfs_get_dentry(inode, cur_dir);
-		if (sub_dentry) {
-			filler(buf, sub_dentry->fname, NULL, ++offset);
+	struct stat st;
+	int ret;
+
+	NFS_LOCK();
+	newfs_journal_reserve();
+	ret = newfs_fh_inode(path, fi, &inode);
+	if (ret != NFS_ERROR_NONE) {
+		NFS_UNLOCK();
+		return ret;
+	}
+	newfs_touch_atime(inode);
+	/* 一次填满buf，不再每次只给一项 */
+	for (;; offset++) {
+		memset(&st, 0, sizeof(struct stat));
+		if (offset < 2) {
+			sub_dentry = offset == 0 || inode->dentry->parent == NULL ? inode->dentry
+																	  : inode->dentry->parent;
+			newfs_dentry_stat(sub_dentry, &st);
+			if (filler(buf, offset == 0 ? "." : "..", &st, offset + 1)) {
+				break;
+			}
+			continue;
+		}
+		sub_dentry = newfs_get_dentry(inode, offset - 2);
+		if (sub_dentry == NULL) {
+			break;
+		}
+		newfs_dentry_stat(sub_dentry, &st);
+		if (filler(buf, sub_dentry->fname, &st, offset + 1)) {
+			break;
 		}
-		return NFS_ERROR_NONE;
 	}
-	return -NFS_ERROR_NOTFOUND;
+	NFS_UNLOCK();
+	return NFS_ERROR_NONE;
 }
 
 /**
- * @brief 创建文件
+ * @brief 按路径创建文件或目录，调用时持有 newfs_super.lock
  *
  * @param path 相对于挂载点的路径
- * @param mode 创建文件的模式，可忽略
- * @param dev 设备类型，可忽略
+ * @param mode 创建文件的模式，只看类型
  * @return int 0成功，否则失败
  */
-int newfs_mknod(const char *path, mode_t mode, dev_t dev)
+static int newfs_create(const char *path, mode_t mode)
 {
-	/* TODO: 解析路径，并创建相应的文件 */
-		boolean	is_find, is_root;
-	
-	struct newfs_dentry* last_dentry = newfs_lookup(path, &is_find, &is_root);
+	boolean	is_find, is_root;
+	struct newfs_dentry* last_dentry;
 	struct newfs_dentry* dentry;
 	struct newfs_inode* inode;
 	char* fname;
-	
+
+	last_dentry = newfs_lookup(path, &is_find, &is_root);
+	if (last_dentry == NULL) {
+		return -NFS_ERROR_IO;
+	}
 	if (is_find == TRUE) {
 		return -NFS_ERROR_EXISTS;
 	}
-	// if(last_dentry->inode->dir_cnt<6){
-		fname = newfs_get_fname(path);
-	
-	if (S_ISREG(mode)) {
-		dentry = new_dentry(fname, NFS_REG_FILE);
-	}
-	else if (S_ISDIR(mode)) {
-		dentry = new_dentry(fname, NFS_DIR);
-	}
+	fname = newfs_get_fname(path);
+	dentry = new_dentry(fname, S_ISDIR(mode) ? NFS_DIR : NFS_REG_FILE);
 	dentry->parent = last_dentry;
 	inode = newfs_alloc_inode(dentry);
+	if (inode == NULL) {
+		free(dentry);
+		return -NFS_ERROR_NOSPACE;
+	}
 	newfs_alloc_dentry(last_dentry->inode, dentry);
-	// }else {
-	// 	return NFS_ERROR_NONE;
-	// }
-	printf("*****touch*****\n");
 	return NFS_ERROR_NONE;
 }
 
 /**
- * @brief 修改时间，为了不让touch报错
+ * @brief 创建文件
+ *
+ * @param path 相对于挂载点的路径
+ * @param mode 创建文件的模式，可忽略
+ * @param dev 设备类型，可忽略
+ * @return int 0成功，否则失败
+ */
+int newfs_mknod(const char *path, mode_t mode, dev_t dev)
+{
+	int ret;
+
+	NFS_LOCK();
+	newfs_journal_reserve();
+	ret = newfs_create(path, mode);
+	NFS_UNLOCK();
+	if (ret == NFS_ERROR_NONE) {
+		printf("*****touch*****\n");
+	}
+	return ret;
+}
+
+/**
+ * @brief 修改访问时间和修改时间
  *
  * @param path 相对于挂载点的路径
- * @param tv 实践
+ * @param tv atime、mtime
  * @return int 0成功，否则失败
  */
 int newfs_utimens(const char *path, const struct timespec tv[2])
 {
-	(void)path;
-	return 0;
+	struct newfs_inode* inode;
+	int ret;
+
+	NFS_LOCK();
+	newfs_journal_reserve();
+	ret = newfs_fh_inode(path, NULL, &inode);
+	if (ret != NFS_ERROR_NONE) {
+		NFS_UNLOCK();
+		return ret;
+	}
+	newfs_inode_set_times(inode, tv);
+	NFS_UNLOCK();
+	return NFS_ERROR_NONE;
 }
 
 
@@ -277,29 +386,61 @@ int newfs_utimens(const char *path, const struct timespec tv[2])
 int newfs_write(const char *path, const char *buf, size_t size, off_t offset,
 				struct fuse_file_info *fi)
 {
-	boolean	is_find, is_root;
-	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_inode*  inode;
+	int ret;
 	
-	if (is_find == FALSE) {
-		return -NFS_ERROR_NOTFOUND;
+	NFS_LOCK();
+	newfs_journal_reserve();
+	ret = newfs_fh_inode(path, fi, &inode);
+	if (ret != NFS_ERROR_NONE) {
+		goto out;
 	}
-
-	inode = dentry->inode;
 	
 	if (NFS_IS_DIR(inode)) {
-		return -NFS_ERROR_ISDIR;	
+		ret = -NFS_ERROR_ISDIR;
+		goto out;
 	}
 
-	if (inode->size < offset) {
-		return -NFS_ERROR_SEEK;
+	ret = newfs_inode_rw(inode, (char*)buf, size, offset, TRUE);
+out:
+	NFS_UNLOCK();
+	return ret;
+}
+
+#if FUSE_VERSION >= 29
+/**
+ * @brief 写入文件，数据以缓冲区向量给出（splice 时是管道），直接拷进文件块
+ *
+ * @param path 相对于挂载点的路径
+ * @param buf 写入的内容
+ * @param offset 相对文件的偏移
+ * @param fi 文件句柄，为NULL时按路径查找
+ * @return int 写入大小
+ */
+int newfs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+					struct fuse_file_info *fi)
+{
+	struct newfs_inode*  inode;
+	int ret;
+
+	NFS_LOCK();
+	newfs_journal_reserve();
+	ret = newfs_fh_inode(path, fi, &inode);
+	if (ret != NFS_ERROR_NONE) {
+		goto out;
 	}
 
-	memcpy(inode->data + offset, buf, size);
-	inode->size = offset + size > inode->size ? offset + size : inode->size;
-	
-	return size;
+	if (NFS_IS_DIR(inode)) {
+		ret = -NFS_ERROR_ISDIR;
+		goto out;
+	}
+
+	ret = newfs_inode_write_buf(inode, buf, offset);
+out:
+	NFS_UNLOCK();
+	return ret;
 }
+#endif
 
 /**
  * @brief 读取文件
@@ -314,27 +455,25 @@ int newfs_write(const char *path, const char *buf, size_t size, off_t offset,
 int newfs_read(const char *path, char *buf, size_t size, off_t offset,
 			   struct fuse_file_info *fi)
 {
-	boolean	is_find, is_root;
-	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_inode*  inode;
-
-	if (is_find == FALSE) {
-		return -NFS_ERROR_NOTFOUND;
+	int ret;
+	
+	NFS_LOCK();
+	newfs_journal_reserve();
+	ret = newfs_fh_inode(path, fi, &inode);
+	if (ret != NFS_ERROR_NONE) {
+		goto out;
 	}
-
-	inode = dentry->inode;
 	
 	if (NFS_IS_DIR(inode)) {
-		return -NFS_ERROR_ISDIR;	
+		ret = -NFS_ERROR_ISDIR;
+		goto out;
 	}
 
-	if (inode->size < offset) {
-		return -NFS_ERROR_SEEK;
-	}
-
-	memcpy(buf, inode->data + offset, size);
-
-	return size;
+	ret = newfs_inode_rw(inode, buf, size, offset, FALSE);
+out:
+	NFS_UNLOCK();
+	return ret;
 }
 
 /**
@@ -346,17 +485,34 @@ int newfs_read(const char *path, char *buf, size_t size, off_t offset,
 int newfs_unlink(const char *path)
 {
 	boolean	is_find, is_root;
-	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_dentry* dentry;
 	struct newfs_inode*  inode;
 
+	NFS_LOCK();
+	newfs_journal_reserve();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_IO;
+	}
 	if (is_find == FALSE) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_NOTFOUND;
 	}
 
 	inode = dentry->inode;
 
+	/* 目录下的所有路径都会失效，普通文件只影响自己这一条 */
+	if (NFS_IS_DIR(inode)) {
+		newfs_pcache_invalidate();
+	}
+	else {
+		newfs_pcache_forget(path);
+	}
 	newfs_drop_inode(inode);
 	newfs_drop_dentry(dentry->parent->inode, dentry);
+	free(dentry);
+	NFS_UNLOCK();
 	return NFS_ERROR_NONE;
 }
 
@@ -388,15 +544,26 @@ int newfs_rename(const char *from, const char *to)
 {
 	int ret = NFS_ERROR_NONE;
 	boolean	is_find, is_root;
-	struct newfs_dentry* from_dentry = newfs_lookup(from, &is_find, &is_root);
+	struct newfs_dentry* from_dentry;
 	struct newfs_inode*  from_inode;
 	struct newfs_dentry* to_dentry;
+	struct newfs_dentry* sub_dentry;
 	mode_t mode = 0;
+
+	NFS_LOCK();
+	newfs_journal_reserve();
+	from_dentry = newfs_lookup(from, &is_find, &is_root);
+	if (from_dentry == NULL) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_IO;
+	}
 	if (is_find == FALSE) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_NOTFOUND;
 	}
 
 	if (strcmp(from, to) == 0) {
+		NFS_UNLOCK();
 		return NFS_ERROR_NONE;
 	}
 
@@ -409,24 +576,39 @@ int newfs_rename(const char *from, const char *to)
 		mode = __S_IFREG;
 	}
 	
-	ret = newfs_mknod(to, mode, NULL);
+	ret = newfs_create(to, mode);
 	if (ret != NFS_ERROR_NONE) {					  /* 保证目的文件不存在 */
+		NFS_UNLOCK();
 		return ret;
 	}
 	
+	if (NFS_IS_DIR(from_inode)) {
+		newfs_pcache_invalidate();
+	}
+	else {
+		newfs_pcache_forget(from);
+	}
+
 	to_dentry = newfs_lookup(to, &is_find, &is_root);	  
 	newfs_drop_inode(to_dentry->inode);				  /* 保证生成的inode被释放 */	
 	to_dentry->ino = from_inode->ino;				  /* 指向新的inode */
 	to_dentry->inode = from_inode;
+	from_inode->dentry = to_dentry;
+	newfs_touch_ctime(from_inode);
+	for (sub_dentry = from_inode->dentrys; sub_dentry; sub_dentry = sub_dentry->brother) {
+		sub_dentry->parent = to_dentry;
+	}
 	
 	newfs_drop_dentry(from_dentry->parent->inode, from_dentry);
+	free(from_dentry);
+	NFS_UNLOCK();
 	return ret;
 	// return 0;
 }
 
 /**
- * @brief 打开文件，可以在这里维护fi的信息，例如，fi->fh可以理解为一个64位指针，可以把自己想保存的数据结构
- * 保存在fh中
+ * @brief 打开文件，inode 存进 fi->fh，之后的读写不再查找路径
+ * 句柄关闭前 inode 不会被释放，期间被删除的文件仍可以通过句柄读写
  *
  * @param path 相对于挂载点的路径
  * @param fi 文件信息
@@ -434,8 +616,19 @@ int newfs_rename(const char *from, const char *to)
  */
 int newfs_open(const char *path, struct fuse_file_info *fi)
 {
-	/* 选做 */
-	return 0;
+	struct newfs_inode* inode;
+	int ret;
+
+	NFS_LOCK();
+	ret = newfs_fh_inode(path, NULL, &inode);
+	if (ret != NFS_ERROR_NONE) {
+		NFS_UNLOCK();
+		return ret;
+	}
+	newfs_inode_open(inode);
+	fi->fh = (uint64_t)(uintptr_t)inode;
+	NFS_UNLOCK();
+	return NFS_ERROR_NONE;
 }
 
 /**
@@ -447,8 +640,37 @@ int newfs_open(const char *path, struct fuse_file_info *fi)
  */
 int newfs_opendir(const char *path, struct fuse_file_info *fi)
 {
-	/* 选做 */
-	return 0;
+	return newfs_open(path, fi);
+}
+
+/**
+ * @brief 关闭文件，释放句柄
+ *
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int newfs_release(const char *path, struct fuse_file_info *fi)
+{
+	NFS_LOCK();
+	if (fi->fh) {
+		newfs_inode_close((struct newfs_inode*)(uintptr_t)fi->fh);
+		fi->fh = 0;
+	}
+	NFS_UNLOCK();
+	return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 关闭目录文件
+ *
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int newfs_releasedir(const char *path, struct fuse_file_info *fi)
+{
+	return newfs_release(path, fi);
 }
 
 /**
@@ -460,8 +682,37 @@ int newfs_opendir(const char *path, struct fuse_file_info *fi)
  */
 int newfs_truncate(const char *path, off_t offset)
 {
-	/* 选做 */
-	return 0;
+	return newfs_ftruncate(path, offset, NULL);
+}
+
+/**
+ * @brief 改变已打开文件的大小
+ *
+ * @param path 相对于挂载点的路径
+ * @param offset 改变后文件大小
+ * @param fi 文件句柄，为NULL时按路径查找
+ * @return int 0成功，否则失败
+ */
+int newfs_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi)
+{
+	struct newfs_inode* inode;
+	int ret;
+
+	NFS_LOCK();
+	newfs_journal_reserve();
+	ret = newfs_fh_inode(path, fi, &inode);
+	if (ret != NFS_ERROR_NONE) {
+		goto out;
+	}
+	if (NFS_IS_DIR(inode)) {
+		ret = -NFS_ERROR_ISDIR;
+		goto out;
+	}
+
+	ret = newfs_inode_setsize(inode, offset);
+out:
+	NFS_UNLOCK();
+	return ret;
 }
 
 /**
@@ -487,14 +738,29 @@ int newfs_access(const char *path, int type)
 int main(int argc, char **argv)
 {
 	int ret;
+	char cache_opts[128];
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
 	newfs_options.device = strdup("/home/students/210110128/fuse/user-land-filesystem/driver");
+	newfs_options.cache_blks = NFS_DEFAULT_CACHE_BLKS;
+	newfs_options.flush_ms = NFS_DEFAULT_FLUSH_MS;
+	newfs_options.dirty_bytes = NFS_DEFAULT_DIRTY_BYTES;
+	newfs_options.file_blks = NFS_DEFAULT_FILE_BLKS;
+	newfs_options.ra_blks = NFS_DEFAULT_RA_BLKS;
 
 	if (fuse_opt_parse(&args, &newfs_options, option_spec, NULL) == -1)
 		return -1;
 
-	ret = fuse_main(args.argc, args.argv, &operations, NULL);
+	if (newfs_options.lowlevel) {
+		ret = newfs_ll_main(&args);			/* 按 inode 寻址，不再解析路径 */
+	}
+	else {
+		/* 所有改动都经过本进程，内核可以放心缓存属性和查找结果；放在最前，命令行仍可覆盖 */
+		snprintf(cache_opts, sizeof(cache_opts), "-oattr_timeout=%g,entry_timeout=%g,negative_timeout=%g",
+				 NFS_ATTR_TIMEOUT, NFS_ATTR_TIMEOUT, NFS_NEG_TIMEOUT);
+		fuse_opt_insert_arg(&args, 1, cache_opts);
+		ret = fuse_main(args.argc, args.argv, &operations, NULL);
+	}
 	fuse_opt_free_args(&args);
 	return ret;
 }
\ No newline at end of file
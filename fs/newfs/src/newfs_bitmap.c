@@ -0,0 +1,124 @@
+#include "../include/newfs.h"
+#include <endian.h>
+
+/* 位图按字节存盘，第 i 位位于第 i/8 字节的第 i%8 位，按小端 64 位字解释时正好是第 i/64 个字的第 i%64 位 */
+#define NFS_BM_WORD(bm, i)              le64toh((bm)->words[i])
+#define NFS_BM_NWORDS(bm)               (((bm)->nbits + NFS_BM_WORD_BITS - 1) / NFS_BM_WORD_BITS)
+
+/**
+ * @brief 第 word 个字中超出 nbits 的位视为已占用
+ *
+ * @param bm
+ * @param word
+ * @return uint64_t 已占用位为 1
+ */
+static inline uint64_t newfs_bitmap_word_used(struct newfs_bitmap* bm, int word) {
+    uint64_t used = NFS_BM_WORD(bm, word);
+    int      tail = bm->nbits - word * NFS_BM_WORD_BITS;
+    if (tail < NFS_BM_WORD_BITS) {
+        used |= ~0ULL << tail;
+    }
+    return used;
+}
+
+/**
+ * @brief 在已读入内存的位图上建立分配器
+ *
+ * @param bm
+ * @param map   位图内存，大小需覆盖 nbits 且按 8 字节对齐
+ * @param nbits 有效位数（可分配的对象数）
+ */
+void newfs_bitmap_init(struct newfs_bitmap* bm, uint8_t* map, int nbits) {
+    int word;
+
+    bm->words = (uint64_t*)map;
+    bm->nbits = nbits;
+    bm->hint  = 0;
+    bm->nfree = 0;
+    bm->dirty = FALSE;
+    for (word = 0; word < NFS_BM_NWORDS(bm); word++) {
+        bm->nfree += NFS_BM_WORD_BITS - __builtin_popcountll(newfs_bitmap_word_used(bm, word));
+    }
+}
+
+/**
+ * @brief 分配一个空闲位，从上次分配的位置开始按字扫描（next-fit）
+ *
+ * @param bm
+ * @return int 分配到的下标，没有空闲位时返回 -1
+ */
+int newfs_bitmap_alloc(struct newfs_bitmap* bm) {
+    int      nwords = NFS_BM_NWORDS(bm);
+    int      word   = bm->hint;
+    int      i, bit;
+    uint64_t free_bits;
+
+    if (bm->nfree == 0) {
+        return -1;
+    }
+    for (i = 0; i < nwords; i++, word++) {
+        if (word == nwords) {
+            word = 0;
+        }
+        free_bits = ~newfs_bitmap_word_used(bm, word);
+        if (free_bits) {
+            bit = __builtin_ctzll(free_bits);
+            bm->words[word] |= htole64(1ULL << bit);
+            bm->nfree--;
+            bm->dirty = TRUE;
+            bm->hint = word;
+            return word * NFS_BM_WORD_BITS + bit;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 优先分配 goal 这一位，用于让文件的数据块保持连续
+ *
+ * @param bm
+ * @param goal 期望的下标，-1 表示没有期望
+ * @return int 分配到的下标，没有空闲位时返回 -1
+ */
+int newfs_bitmap_alloc_near(struct newfs_bitmap* bm, int goal) {
+    if (goal >= 0 && goal < bm->nbits && !newfs_bitmap_test(bm, goal)) {
+        bm->words[goal / NFS_BM_WORD_BITS] |= htole64(1ULL << (goal % NFS_BM_WORD_BITS));
+        bm->nfree--;
+        bm->dirty = TRUE;
+        bm->hint = goal / NFS_BM_WORD_BITS;
+        return goal;
+    }
+    return newfs_bitmap_alloc(bm);
+}
+
+/**
+ * @brief 按下标直接释放
+ *
+ * @param bm
+ * @param idx
+ */
+void newfs_bitmap_free(struct newfs_bitmap* bm, int idx) {
+    uint64_t mask;
+
+    if (idx < 0 || idx >= bm->nbits) {
+        return;
+    }
+    mask = htole64(1ULL << (idx % NFS_BM_WORD_BITS));
+    if (!(bm->words[idx / NFS_BM_WORD_BITS] & mask)) {
+        return;
+    }
+    bm->words[idx / NFS_BM_WORD_BITS] &= ~mask;
+    bm->nfree++;
+    bm->dirty = TRUE;
+}
+
+/**
+ * @brief 查询某一位是否已被占用
+ *
+ * @param bm
+ * @param idx
+ * @return boolean
+ */
+boolean newfs_bitmap_test(struct newfs_bitmap* bm, int idx) {
+    return (NFS_BM_WORD(bm, idx / NFS_BM_WORD_BITS) >> (idx % NFS_BM_WORD_BITS)) & 1;
+}
@@ -0,0 +1,305 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options newfs_options;
+
+#define NFS_CACHE_HASH(cache, blk)      ((uint32_t)(blk) & ((cache)->nr_hash - 1))
+
+/**
+ * @brief 将缓冲块从LRU链表中摘下
+ *
+ * @param cache
+ * @param buf
+ */
+static void newfs_lru_unlink(struct newfs_cache* cache, struct newfs_buf* buf) {
+    if (buf->lru_prev) {
+        buf->lru_prev->lru_next = buf->lru_next;
+    }
+    else {
+        cache->lru_head = buf->lru_next;
+    }
+    if (buf->lru_next) {
+        buf->lru_next->lru_prev = buf->lru_prev;
+    }
+    else {
+        cache->lru_tail = buf->lru_prev;
+    }
+    buf->lru_prev = NULL;
+    buf->lru_next = NULL;
+}
+
+/**
+ * @brief 将缓冲块放到LRU链表头（最近使用）
+ *
+ * @param cache
+ * @param buf
+ */
+static void newfs_lru_push(struct newfs_cache* cache, struct newfs_buf* buf) {
+    buf->lru_prev = NULL;
+    buf->lru_next = cache->lru_head;
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = buf;
+    }
+    cache->lru_head = buf;
+    if (cache->lru_tail == NULL) {
+        cache->lru_tail = buf;
+    }
+}
+
+/**
+ * @brief 将缓冲块从哈希链中摘下
+ *
+ * @param cache
+ * @param buf
+ */
+static void newfs_hash_unlink(struct newfs_cache* cache, struct newfs_buf* buf) {
+    struct newfs_buf** link = &cache->hash[NFS_CACHE_HASH(cache, buf->blk)];
+    while (*link) {
+        if (*link == buf) {
+            *link = buf->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    buf->hash_next = NULL;
+}
+
+/**
+ * @brief 将脏缓冲块写回磁盘，正在收集回写时放进暂存区
+ *
+ * @param buf
+ * @return int
+ */
+static int newfs_buf_writeback(struct newfs_buf* buf) {
+    if (!buf->dirty) {
+        return NFS_ERROR_NONE;
+    }
+    newfs_csum_update(buf->blk, buf->data);
+    if (NFS_STAGE()->active) {
+        newfs_stage_add(buf->blk, buf->data, 1);        /* 随本轮回写一起排序写盘 */
+    }
+    else if (newfs_csum_covered(buf->blk)) {            /* 回写之外：和校验表项一起提交 */
+        if (newfs_journal_write_now(buf->blk, &buf->data, 1) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+    }
+    else if (newfs_dev_write(buf->blk, buf->data, 1) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    buf->dirty = FALSE;
+    NFS_CACHE()->writebacks++;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 初始化块缓存
+ *
+ * @param nr_bufs 缓冲块数
+ * @return int
+ */
+int newfs_cache_init(int nr_bufs) {
+    struct newfs_cache* cache = NFS_CACHE();
+    int i;
+
+    if (nr_bufs < NFS_MIN_CACHE_BLKS) {
+        nr_bufs = NFS_MIN_CACHE_BLKS;
+    }
+    memset(cache, 0, sizeof(struct newfs_cache));
+    cache->nr_bufs = nr_bufs;
+    cache->nr_hash = 1;
+    while (cache->nr_hash < nr_bufs) {
+        cache->nr_hash <<= 1;
+    }
+
+    cache->bufs = (struct newfs_buf*)calloc(nr_bufs, sizeof(struct newfs_buf));
+    cache->hash = (struct newfs_buf**)calloc(cache->nr_hash, sizeof(struct newfs_buf*));
+    if (cache->bufs == NULL || cache->hash == NULL) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    for (i = 0; i < nr_bufs; i++) {
+        cache->bufs[i].blk  = -1;
+        cache->bufs[i].data = (uint8_t*)malloc(NFS_BLK_SZ());
+        if (cache->bufs[i].data == NULL) {
+            return -NFS_ERROR_NOSPACE;
+        }
+        newfs_lru_push(cache, &cache->bufs[i]);
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 在缓存中查找逻辑块，不改变LRU顺序
+ *
+ * @param blk 逻辑块号
+ * @return struct newfs_buf* 未命中返回NULL
+ */
+struct newfs_buf* newfs_cache_lookup(int blk) {
+    struct newfs_cache* cache = NFS_CACHE();
+    struct newfs_buf*   buf   = cache->hash[NFS_CACHE_HASH(cache, blk)];
+    while (buf) {
+        if (buf->blk == blk) {
+            return buf;
+        }
+        buf = buf->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 腾出最久未使用的缓冲块给 blk，尚未挂入哈希表
+ *
+ * @param cache
+ * @param blk
+ * @return struct newfs_buf* 写回出错返回NULL
+ */
+static struct newfs_buf* newfs_cache_victim(struct newfs_cache* cache, int blk) {
+    struct newfs_buf* buf = cache->lru_tail;
+    if (buf->blk != -1) {
+        if (newfs_buf_writeback(buf) != NFS_ERROR_NONE) {
+            NFS_DBG("[%s] writeback blk %d error\n", __func__, buf->blk);
+            return NULL;
+        }
+        newfs_hash_unlink(cache, buf);
+        cache->evictions++;
+    }
+    buf->blk = blk;
+    buf->dirty = FALSE;
+    return buf;
+}
+
+/**
+ * @brief 将缓冲块挂入哈希表并放到LRU链表头
+ *
+ * @param cache
+ * @param buf
+ */
+static void newfs_cache_install(struct newfs_cache* cache, struct newfs_buf* buf) {
+    buf->hash_next = cache->hash[NFS_CACHE_HASH(cache, buf->blk)];
+    cache->hash[NFS_CACHE_HASH(cache, buf->blk)] = buf;
+    newfs_lru_unlink(cache, buf);
+    newfs_lru_push(cache, buf);
+}
+
+/**
+ * @brief 获取逻辑块对应的缓冲块，未命中时淘汰最久未使用的块
+ *
+ * @param blk  逻辑块号
+ * @param fill 未命中时是否从磁盘读入（整块覆盖写时不需要）
+ * @return struct newfs_buf* 出错返回NULL
+ */
+struct newfs_buf* newfs_cache_get(int blk, boolean fill) {
+    struct newfs_cache* cache = NFS_CACHE();
+    struct newfs_buf*   buf   = newfs_cache_lookup(blk);
+
+    if (buf) {
+        cache->hits++;
+        newfs_lru_unlink(cache, buf);
+        newfs_lru_push(cache, buf);
+        return buf;
+    }
+
+    cache->misses++;
+    buf = newfs_cache_victim(cache, blk);
+    if (buf == NULL) {
+        return NULL;
+    }
+    if (fill) {
+        if (newfs_dev_read(blk, buf->data, 1) != NFS_ERROR_NONE) {
+            buf->blk = -1;
+            return NULL;
+        }
+        newfs_stage_overlay(blk, &buf->data, 1);        /* 可能还没写到盘上 */
+        if (newfs_csum_verify(blk, &buf->data, 1) != NFS_ERROR_NONE) {
+            buf->blk = -1;
+            return NULL;
+        }
+    }
+    newfs_cache_install(cache, buf);
+    return buf;
+}
+
+/**
+ * @brief 把预读到的块放进缓存，已在缓存中的以缓存中的为准
+ *
+ * @param blk 逻辑块号
+ * @param content
+ */
+void newfs_cache_insert(int blk, uint8_t* content) {
+    struct newfs_cache* cache = NFS_CACHE();
+    struct newfs_buf*   buf;
+
+    if (newfs_cache_lookup(blk)) {
+        return;
+    }
+    buf = newfs_cache_victim(cache, blk);
+    if (buf == NULL) {
+        return;
+    }
+    memcpy(buf->data, content, NFS_BLK_SZ());
+    newfs_cache_install(cache, buf);
+}
+
+/**
+ * @brief 标记缓冲块为脏
+ *
+ * @param buf
+ */
+void newfs_cache_dirty(struct newfs_buf* buf) {
+    buf->dirty = TRUE;
+}
+
+/**
+ * @brief 数据已经直接写盘后，用新内容刷新仍在缓存中的副本
+ *
+ * @param blk 起始逻辑块号
+ * @param content 已写盘的内容
+ * @param blks 块数
+ */
+void newfs_cache_refresh(int blk, uint8_t* content, int blks) {
+    struct newfs_buf* buf;
+    int i;
+    for (i = 0; i < blks; i++) {
+        buf = newfs_cache_lookup(blk + i);
+        if (buf) {
+            memcpy(buf->data, content + NFS_BLKS_SZ(i), NFS_BLK_SZ());
+            buf->dirty = FALSE;
+        }
+    }
+}
+
+/**
+ * @brief 写回所有脏缓冲块
+ *
+ * @return int
+ */
+int newfs_cache_flush() {
+    struct newfs_cache* cache = NFS_CACHE();
+    int i;
+    for (i = 0; i < cache->nr_bufs; i++) {
+        if (cache->bufs[i].blk != -1 &&
+            newfs_buf_writeback(&cache->bufs[i]) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 写回并释放块缓存
+ *
+ * @return int
+ */
+int newfs_cache_destroy() {
+    struct newfs_cache* cache = NFS_CACHE();
+    int ret = newfs_cache_flush();
+    int i;
+    for (i = 0; i < cache->nr_bufs; i++) {
+        free(cache->bufs[i].data);
+    }
+    free(cache->bufs);
+    free(cache->hash);
+    cache->bufs = NULL;
+    cache->hash = NULL;
+    cache->nr_bufs = 0;
+    return ret;
+}
@@ -0,0 +1,224 @@
+#include "../include/newfs.h"
+#include <time.h>
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options newfs_options;
+
+/*
+ * 压缩文件每 NFS_COMP_CLUSTER_BLKS 块为一簇。压得小的簇只映射前 k 块，
+ * 依次存放 newfs_comp_d 头部和压缩数据，其余块不映射；压不小的簇原样存放。
+ * 文件除此之外没有空洞（变长时新块都会映射），所以簇中有未映射的块就说明它是压缩的
+ */
+
+/**
+ * @brief 当前线程用掉的 CPU 时间
+ *
+ * @return uint64_t 纳秒
+ */
+static uint64_t newfs_comp_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * NFS_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * @brief 簇在文件中的块数，最后一簇可能不满
+ *
+ * @param inode
+ * @param clu
+ * @return int
+ */
+static int newfs_comp_cnt(struct newfs_inode* inode, int clu) {
+    int cnt = inode->blks - clu * NFS_COMP_CLUSTER_BLKS;
+    return cnt < NFS_COMP_CLUSTER_BLKS ? cnt : NFS_COMP_CLUSTER_BLKS;
+}
+
+/**
+ * @brief 簇是否压缩存放
+ *
+ * @param inode 压缩文件
+ * @param clu 簇号
+ * @return boolean
+ */
+boolean newfs_comp_packed(struct newfs_inode* inode, int clu) {
+    int base = clu * NFS_COMP_CLUSTER_BLKS, i;
+
+    for (i = newfs_comp_cnt(inode, clu) - 1; i > 0; i--) {
+        if (newfs_bmap(inode, base + i, FALSE) < 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief 依次读出簇中映射的前 cnt 块，物理上连续的合并成一次读
+ *
+ * @param inode
+ * @param base 簇的起始文件块号
+ * @param bufs
+ * @param cnt
+ * @return int
+ */
+static int newfs_comp_read_blks(struct newfs_inode* inode, int base, uint8_t** bufs, int cnt) {
+    int i, run, pblk;
+
+    for (i = 0; i < cnt; i += run) {
+        pblk = newfs_bmap(inode, base + i, FALSE);
+        for (run = 1; i + run < cnt && newfs_bmap(inode, base + i + run, FALSE) == pblk + run; run++)
+            ;
+        if (newfs_driver_read_blks(NFS_DATA_BLK(pblk), bufs + i, run) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 读出簇的内容，压缩的簇读出前几块解压
+ *
+ * @param inode 压缩文件
+ * @param clu 簇号
+ * @param bufs 簇中各块的缓冲区，NULL 表示这一块不需要
+ * @return int
+ */
+int newfs_comp_read(struct newfs_inode* inode, int clu, uint8_t** bufs) {
+    struct newfs_comp_d* hdr;
+    uint8_t* area = (uint8_t*)malloc(NFS_BLKS_SZ(2 * NFS_COMP_CLUSTER_BLKS));
+    uint8_t* raw  = area + NFS_BLKS_SZ(NFS_COMP_CLUSTER_BLKS);  /* 前一半放压缩数据，后一半放解压结果 */
+    uint8_t* blks[NFS_COMP_CLUSTER_BLKS];
+    int base = clu * NFS_COMP_CLUSTER_BLKS, cnt = newfs_comp_cnt(inode, clu);
+    int k, len, i, ret = -NFS_ERROR_IO;
+    uint64_t start;
+
+    if (!newfs_comp_packed(inode, clu)) {
+        for (i = 0; i < cnt; i++) {
+            if (bufs[i] && newfs_comp_read_blks(inode, base + i, bufs + i, 1) != NFS_ERROR_NONE) {
+                goto out;
+            }
+        }
+        ret = NFS_ERROR_NONE;
+        goto out;
+    }
+
+    for (k = 0; k < cnt && newfs_bmap(inode, base + k, FALSE) >= 0; k++) {
+        blks[k] = area + NFS_BLKS_SZ(k);
+    }
+    if (newfs_comp_read_blks(inode, base, blks, k) != NFS_ERROR_NONE) {
+        goto out;
+    }
+    hdr = (struct newfs_comp_d*)area;
+    if (hdr->len > NFS_BLKS_SZ(k) - sizeof(struct newfs_comp_d) ||
+        hdr->raw_len > NFS_BLKS_SZ(NFS_COMP_CLUSTER_BLKS)) {
+        NFS_DBG("[%s] bad cluster %d of inode %d\n", __func__, clu, inode->ino);
+        goto out;
+    }
+    start = newfs_comp_clock();
+    len = newfs_lz_decompress(area + sizeof(struct newfs_comp_d), hdr->len,
+                              raw, NFS_BLKS_SZ(NFS_COMP_CLUSTER_BLKS));
+    NFS_COMP()->decomp_ns += newfs_comp_clock() - start;
+    NFS_COMP()->unpacked++;
+    if (len < 0 || len != (int)hdr->raw_len) {
+        NFS_DBG("[%s] bad cluster %d of inode %d\n", __func__, clu, inode->ino);
+        goto out;
+    }
+    memset(raw + len, 0, NFS_BLKS_SZ(NFS_COMP_CLUSTER_BLKS) - len);  /* 压缩之后文件又变长了 */
+    for (i = 0; i < cnt; i++) {
+        if (bufs[i]) {
+            memcpy(bufs[i], raw + NFS_BLKS_SZ(i), NFS_BLK_SZ());
+        }
+    }
+    ret = NFS_ERROR_NONE;
+out:
+    free(area);
+    return ret;
+}
+
+/**
+ * @brief 把簇压缩后写盘，按压缩结果调整映射
+ * 不在内存中的块先从盘上读出；压缩后省不下一块时原样写
+ *
+ * @param inode 压缩文件
+ * @param clu 簇号
+ * @return int
+ */
+int newfs_comp_write(struct newfs_inode* inode, int clu) {
+    struct newfs_comp_d* hdr;
+    uint8_t* area   = (uint8_t*)calloc(2, NFS_BLKS_SZ(NFS_COMP_CLUSTER_BLKS));
+    uint8_t* raw    = area;                             /* 前一半放原文，后一半放压缩结果 */
+    uint8_t* packed = area + NFS_BLKS_SZ(NFS_COMP_CLUSTER_BLKS);
+    uint8_t* src;
+    uint8_t* missing[NFS_COMP_CLUSTER_BLKS];
+    uint8_t* blks[NFS_COMP_CLUSTER_BLKS];
+    int base = clu * NFS_COMP_CLUSTER_BLKS, cnt = newfs_comp_cnt(inode, clu);
+    int k, len = -1, i, run, pblk, ret = NFS_ERROR_NONE;
+    boolean need = FALSE;
+    uint64_t start;
+
+    for (i = 0; i < cnt; i++) {
+        missing[i] = inode->block_pointer[base + i] ? NULL : raw + NFS_BLKS_SZ(i);
+        need |= missing[i] != NULL;
+    }
+    if (need && newfs_comp_read(inode, clu, missing) != NFS_ERROR_NONE) {
+        ret = -NFS_ERROR_IO;
+        goto out;
+    }
+    for (i = 0; i < cnt; i++) {
+        if (missing[i] == NULL) {
+            memcpy(raw + NFS_BLKS_SZ(i), inode->block_pointer[base + i], NFS_BLK_SZ());
+        }
+    }
+
+    if (cnt > 1) {
+        start = newfs_comp_clock();
+        len = newfs_lz_compress(raw, NFS_BLKS_SZ(cnt), packed + sizeof(struct newfs_comp_d),
+                                NFS_BLKS_SZ(cnt - 1) - sizeof(struct newfs_comp_d));
+        NFS_COMP()->comp_ns += newfs_comp_clock() - start;
+    }
+    if (len >= 0) {
+        hdr = (struct newfs_comp_d*)packed;
+        hdr->len     = len;
+        hdr->raw_len = NFS_BLKS_SZ(cnt);
+        k   = NFS_BLKS_OF(sizeof(struct newfs_comp_d) + len);
+        src = packed;
+        NFS_COMP()->packed++;
+    }
+    else {
+        k   = cnt;
+        src = raw;
+        NFS_COMP()->raw++;
+    }
+
+    /* 前 k 块映射，其余的释放 */
+    for (i = 0; i < cnt; i++) {
+        pblk = newfs_bmap(inode, base + i, FALSE);
+        if (i >= k && pblk >= 0) {
+            if (newfs_bunmap(inode, base + i) != NFS_ERROR_NONE) {
+                ret = -NFS_ERROR_NOSPACE;
+                goto out;
+            }
+        }
+        else if (i < k && pblk < 0) {
+            if (newfs_bmap(inode, base + i, TRUE) < 0) {
+                ret = -NFS_ERROR_NOSPACE;
+                goto out;
+            }
+            newfs_mark_dirty(inode, NFS_DIRTY_INODE);
+        }
+        blks[i] = src + NFS_BLKS_SZ(i);
+    }
+    for (i = 0; i < k; i += run) {
+        pblk = newfs_bmap(inode, base + i, FALSE);
+        for (run = 1; i + run < k && newfs_bmap(inode, base + i + run, FALSE) == pblk + run; run++)
+            ;
+        if (newfs_driver_write_blks(NFS_DATA_BLK(pblk), blks + i, run) != NFS_ERROR_NONE) {
+            ret = -NFS_ERROR_IO;
+            goto out;
+        }
+    }
+    NFS_COMP()->in_blks  += cnt;
+    NFS_COMP()->out_blks += k;
+out:
+    free(area);
+    return ret;
+}
@@ -0,0 +1,153 @@
+#include "../include/newfs.h"
+#include <endian.h>
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+/*
+ * CRC32C（Castagnoli，反射多项式 0x82F63B78）。x86-64 上 CPU 支持 SSE4.2 时用 crc32 指令，
+ * 编译目标带 CRC 扩展的 ARMv8 上用 crc32c 指令，否则查表（slice-by-8，每次处理 8 字节）
+ */
+#define NFS_CRC32C_POLY         0x82F63B78u
+
+typedef uint32_t (*newfs_crc_fn)(uint32_t crc, const uint8_t* p, size_t len);
+
+static uint32_t         newfs_crc_tab[8][256];
+static newfs_crc_fn     newfs_crc_impl;
+static const char*      newfs_crc_name;
+static pthread_once_t   newfs_crc_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief 查表实现，crc 为取反之前的中间值
+ *
+ * @param crc
+ * @param p
+ * @param len
+ * @return uint32_t
+ */
+static uint32_t newfs_crc32c_sw(uint32_t crc, const uint8_t* p, size_t len) {
+    uint64_t v;
+
+    while (len >= 8) {
+        memcpy(&v, p, sizeof(v));
+        v   = le64toh(v) ^ crc;
+        crc = newfs_crc_tab[7][v & 0xff] ^ newfs_crc_tab[6][(v >> 8) & 0xff] ^
+              newfs_crc_tab[5][(v >> 16) & 0xff] ^ newfs_crc_tab[4][(v >> 24) & 0xff] ^
+              newfs_crc_tab[3][(v >> 32) & 0xff] ^ newfs_crc_tab[2][(v >> 40) & 0xff] ^
+              newfs_crc_tab[1][(v >> 48) & 0xff] ^ newfs_crc_tab[0][v >> 56];
+        p   += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = newfs_crc_tab[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief SSE4.2 crc32 指令实现
+ *
+ * @param crc
+ * @param p
+ * @param len
+ * @return uint32_t
+ */
+__attribute__((target("sse4.2")))
+static uint32_t newfs_crc32c_sse42(uint32_t crc, const uint8_t* p, size_t len) {
+    uint64_t c = crc, v;
+
+    while (len >= 8) {
+        memcpy(&v, p, sizeof(v));
+        c    = __builtin_ia32_crc32di(c, v);
+        p   += 8;
+        len -= 8;
+    }
+    while (len--) {
+        c = __builtin_ia32_crc32qi((uint32_t)c, *p++);
+    }
+    return (uint32_t)c;
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+/**
+ * @brief ARMv8 crc32c 指令实现
+ *
+ * @param crc
+ * @param p
+ * @param len
+ * @return uint32_t
+ */
+static uint32_t newfs_crc32c_armv8(uint32_t crc, const uint8_t* p, size_t len) {
+    uint64_t v;
+
+    while (len >= 8) {
+        memcpy(&v, p, sizeof(v));
+        crc  = __crc32cd(crc, v);
+        p   += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+/**
+ * @brief 生成查表用的表，按 CPU 选择实现
+ *
+ */
+static void newfs_crc_setup() {
+    uint32_t c;
+    int i, j;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (j = 0; j < 8; j++) {
+            c = c & 1 ? (c >> 1) ^ NFS_CRC32C_POLY : c >> 1;
+        }
+        newfs_crc_tab[0][i] = c;
+    }
+    for (i = 0; i < 256; i++) {
+        for (j = 1; j < 8; j++) {
+            newfs_crc_tab[j][i] = newfs_crc_tab[0][newfs_crc_tab[j - 1][i] & 0xff] ^ (newfs_crc_tab[j - 1][i] >> 8);
+        }
+    }
+
+    newfs_crc_impl = newfs_crc32c_sw;
+    newfs_crc_name = "slice-by-8";
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        newfs_crc_impl = newfs_crc32c_sse42;
+        newfs_crc_name = "sse4.2";
+    }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    newfs_crc_impl = newfs_crc32c_armv8;
+    newfs_crc_name = "armv8";
+#endif
+}
+
+/**
+ * @brief 计算 CRC32C，可以分段累加：newfs_crc32c(newfs_crc32c(0, a, n), b, m) 等于整段的结果
+ *
+ * @param crc 前一段的结果，第一段为 0
+ * @param data
+ * @param len
+ * @return uint32_t
+ */
+uint32_t newfs_crc32c(uint32_t crc, const void* data, size_t len) {
+    pthread_once(&newfs_crc_once, newfs_crc_setup);
+    return ~newfs_crc_impl(~crc, (const uint8_t*)data, len);
+}
+
+/**
+ * @brief 当前使用的实现，统计信息用
+ *
+ * @return const char*
+ */
+const char* newfs_crc32c_impl() {
+    pthread_once(&newfs_crc_once, newfs_crc_setup);
+    return newfs_crc_name;
+}
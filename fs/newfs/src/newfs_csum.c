@@ -0,0 +1,266 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options newfs_options;
+
+/*
+ * 校验表为磁盘上每个逻辑块记一个 CRC32C，第 blk 块的校验和在第 blk / per 个表块的第 blk % per 项，
+ * 表块最后一项是本块其余内容的校验和。NFS_CSUM_NONE 表示没有记录（刚格式化、还没写过），不校验。
+ * 整块写入时（进日志、进暂存区之前）更新，表本身在回写的最后写进同一个事务；
+ * 回写之外的整块写入连同表块单独提交一个小事务，表项不会只改在内存里；
+ * 只在从设备读出后校验，块缓存命中不再计算
+ */
+
+/**
+ * @brief 存进表里的校验和，避开 NFS_CSUM_NONE
+ *
+ * @param data 一整块
+ * @return uint32_t
+ */
+static uint32_t newfs_csum_of(const uint8_t* data) {
+    uint32_t crc = newfs_crc32c(0, data, NFS_BLK_SZ());
+    return crc == NFS_CSUM_NONE ? 1 : crc;
+}
+
+/**
+ * @brief 逻辑块是否由校验表保护
+ *
+ * @param blk
+ * @return boolean
+ */
+boolean newfs_csum_covered(int blk) {
+    struct newfs_csum* cs = NFS_CSUM();
+
+    if (cs->ents == NULL || blk < NFS_SUPER_BLKS || blk >= cs->blks * cs->per) {
+        return FALSE;                                   /* 超级块自带校验和 */
+    }
+    if (blk >= NFS_JOURNAL()->offset && blk < NFS_JOURNAL()->offset + NFS_JOURNAL()->blks) {
+        return FALSE;                                   /* 事务有自己的校验和 */
+    }
+    return blk < cs->offset || blk >= cs->offset + cs->blks;
+}
+
+/**
+ * @brief 第 i 个表块的内容，最后一项是它自己的校验和
+ *
+ * @param i 表块序号
+ * @return uint32_t*
+ */
+static uint32_t* newfs_csum_blk(int i) {
+    return NFS_CSUM()->ents + i * (NFS_BLK_SZ() / (int)sizeof(uint32_t));
+}
+
+/**
+ * @brief 第 blk 块在表中的位置
+ *
+ * @param blk
+ * @return uint32_t*
+ */
+static uint32_t* newfs_csum_ent(int blk) {
+    return newfs_csum_blk(blk / NFS_CSUM()->per) + blk % NFS_CSUM()->per;
+}
+
+/**
+ * @brief 表块自身内容的校验和
+ *
+ * @param i 表块序号
+ * @return uint32_t
+ */
+static uint32_t newfs_csum_self(int i) {
+    return newfs_crc32c(0, newfs_csum_blk(i), NFS_BLK_SZ() - sizeof(uint32_t));
+}
+
+/**
+ * @brief 记下要写盘的一整块的校验和
+ *
+ * @param blk 逻辑块号
+ * @param data
+ */
+void newfs_csum_update(int blk, const uint8_t* data) {
+    struct newfs_csum* cs = NFS_CSUM();
+
+    if (!newfs_csum_covered(blk)) {
+        return;
+    }
+    *newfs_csum_ent(blk)         = newfs_csum_of(data);
+    cs->blk_dirty[blk / cs->per] = TRUE;
+}
+
+/**
+ * @brief 校验刚从设备读出（并已覆盖上暂存内容）的块
+ *
+ * @param blk 起始逻辑块号
+ * @param bufs 每个逻辑块对应的缓冲区
+ * @param blks 块数
+ * @return int 有块不符时返回 -NFS_ERROR_IO
+ */
+int newfs_csum_verify(int blk, uint8_t** bufs, int blks) {
+    struct newfs_csum* cs = NFS_CSUM();
+    uint32_t want;
+    int i;
+
+    for (i = 0; i < blks; i++) {
+        if (!newfs_csum_covered(blk + i)) {
+            continue;
+        }
+        want = *newfs_csum_ent(blk + i);
+        if (want == NFS_CSUM_NONE) {
+            continue;
+        }
+        cs->verified++;
+        if (newfs_csum_of(bufs[i]) != want) {
+            cs->errors++;
+            NFS_DBG("[%s] checksum mismatch on blk %d\n", __func__, blk + i);
+            return -NFS_ERROR_IO;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 崩溃恢复后重算重放涉及的块的校验和
+ * 文件数据在提交映射它的事务之前已写回原位，表里的校验和与盘上内容一致；
+ * 只有重放的事务里的块以盘上内容为准，其余不符的块照常报告，读到时返回 EIO
+ *
+ * @return int
+ */
+static int newfs_csum_rescan() {
+    struct newfs_csum*    cs      = NFS_CSUM();
+    struct newfs_journal* journal = NFS_JOURNAL();
+    int       cap  = cs->blks * cs->per;
+    int       last = newfs_super.sz_disk / NFS_BLK_SZ();
+    boolean*  allow = (boolean*)calloc(cap, sizeof(boolean));
+    uint8_t*  area  = (uint8_t*)malloc(NFS_BLKS_SZ(NFS_CSUM_SCAN_BLKS));
+    uint8_t*  bufs[NFS_CSUM_SCAN_BLKS];
+    uint32_t* ent;
+    uint32_t  crc;
+    int blk, cnt, i, ret = NFS_ERROR_NONE;
+
+    for (i = 0; i < (int)journal->replayed; i++) {
+        blk = journal->replay_blks[i];
+        if (blk < cap) {
+            allow[blk] = TRUE;
+        }
+    }
+
+    for (i = 0; i < NFS_CSUM_SCAN_BLKS; i++) {
+        bufs[i] = area + NFS_BLKS_SZ(i);
+    }
+    if (last > cap) {
+        last = cap;
+    }
+    for (blk = 0; blk < last; blk += cnt) {
+        cnt = last - blk < NFS_CSUM_SCAN_BLKS ? last - blk : NFS_CSUM_SCAN_BLKS;
+        if (newfs_dev_readv(blk, bufs, cnt) != NFS_ERROR_NONE) {
+            ret = -NFS_ERROR_IO;
+            break;
+        }
+        for (i = 0; i < cnt; i++) {
+            if (!newfs_csum_covered(blk + i)) {
+                continue;
+            }
+            ent = newfs_csum_ent(blk + i);
+            crc = newfs_csum_of(bufs[i]);
+            if (*ent == NFS_CSUM_NONE || *ent == crc) {
+                continue;
+            }
+            if (allow[blk + i]) {
+                *ent = crc;
+                cs->blk_dirty[(blk + i) / cs->per] = TRUE;
+                cs->repaired++;
+            }
+            else {                                      /* 与这次崩溃无关的损坏 */
+                cs->errors++;
+                NFS_DBG("[%s] checksum mismatch on blk %d\n", __func__, blk + i);
+            }
+        }
+    }
+    free(area);
+    free(allow);
+    return ret;
+}
+
+/**
+ * @brief 读入校验表，需在日志重放之后、读取其他元数据之前调用
+ *
+ * @param offset 校验表起始逻辑块号
+ * @param blks 校验表块数
+ * @param format 刚格式化，表清空写盘
+ * @return int
+ */
+int newfs_csum_init(int offset, int blks, boolean format) {
+    struct newfs_csum* cs = NFS_CSUM();
+    uint32_t* ents;
+    int i;
+
+    memset(cs, 0, sizeof(struct newfs_csum));
+    cs->offset    = offset;
+    cs->blks      = blks;
+    cs->per       = NFS_BLK_SZ() / (int)sizeof(uint32_t) - 1;
+    cs->blk_dirty = (boolean*)calloc(blks, sizeof(boolean));
+    ents          = (uint32_t*)calloc(blks, NFS_BLK_SZ());
+    if (ents == NULL || cs->blk_dirty == NULL) {
+        free(ents);
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (format) {
+        cs->ents = ents;
+        for (i = 0; i < blks; i++) {
+            cs->blk_dirty[i] = TRUE;
+        }
+        return newfs_csum_sync();
+    }
+
+    if (newfs_driver_read(NFS_BLKS_SZ(offset), (uint8_t*)ents, NFS_BLKS_SZ(blks)) != NFS_ERROR_NONE) {
+        free(ents);
+        return -NFS_ERROR_IO;
+    }
+    cs->ents = ents;
+    for (i = 0; i < blks; i++) {
+        if (newfs_csum_blk(i)[cs->per] != newfs_csum_self(i)) {
+            NFS_DBG("[%s] checksum table blk %d corrupted, dropped\n", __func__, i);
+            memset(newfs_csum_blk(i), 0, NFS_BLK_SZ());     /* 这部分块不再校验 */
+            cs->blk_dirty[i] = TRUE;
+            cs->errors++;
+        }
+    }
+    if (NFS_JOURNAL()->replayed) {
+        return newfs_csum_rescan();
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 写回改动过的校验表块，回写中最后调用，之前写的块的校验和都已记下
+ *
+ * @return int
+ */
+int newfs_csum_sync() {
+    struct newfs_csum* cs = NFS_CSUM();
+    int i;
+
+    for (i = 0; i < cs->blks; i++) {
+        if (!cs->blk_dirty[i]) {
+            continue;
+        }
+        newfs_csum_blk(i)[cs->per] = newfs_csum_self(i);
+        if (newfs_driver_write(NFS_BLKS_SZ(cs->offset + i), (uint8_t*)newfs_csum_blk(i),
+                               NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+        cs->blk_dirty[i] = FALSE;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放校验表占用的内存
+ *
+ */
+void newfs_csum_destroy() {
+    struct newfs_csum* cs = NFS_CSUM();
+    free(cs->ents);
+    free(cs->blk_dirty);
+    cs->ents      = NULL;
+    cs->blk_dirty = NULL;
+}
@@ -0,0 +1,76 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super; 
+extern struct custom_options newfs_options;
+
+/**
+ * @brief 打印块缓存、路径缓存的命中统计，文件数据按需读入、预读、压缩、日志和设备读写统计
+ * 
+ */
+void newfs_dump_cache_stats() {
+    struct newfs_cache*  cache  = NFS_CACHE();
+    struct newfs_pcache* pcache = NFS_PCACHE();
+    uint64_t total = cache->hits + cache->misses;
+
+    printf("cache: %d blks, hits %llu, misses %llu (%.1f%% hit), "
+           "evictions %llu, writebacks %llu\n",
+           cache->nr_bufs,
+           (unsigned long long)cache->hits,
+           (unsigned long long)cache->misses,
+           total ? cache->hits * 100.0 / total : 0.0,
+           (unsigned long long)cache->evictions,
+           (unsigned long long)cache->writebacks);
+
+    total = pcache->hits + pcache->neg_hits + pcache->misses;
+    printf("pcache: %d ents (%d negative), hits %llu, negative hits %llu, misses %llu (%.1f%% hit)\n",
+           pcache->nr_ents,
+           pcache->nr_neg,
+           (unsigned long long)pcache->hits,
+           (unsigned long long)pcache->neg_hits,
+           (unsigned long long)pcache->misses,
+           total ? (pcache->hits + pcache->neg_hits) * 100.0 / total : 0.0);
+
+    printf("file data: %d blks resident, faulted %llu, evicted %llu\n",
+           newfs_super.res_blks,
+           (unsigned long long)newfs_super.faults,
+           (unsigned long long)newfs_super.evicts);
+
+    printf("readahead: windows %llu, prefetched %llu blks, discarded %llu blks, dropped %llu reqs\n",
+           (unsigned long long)NFS_RA()->windows,
+           (unsigned long long)NFS_RA()->blks,
+           (unsigned long long)NFS_RA()->discards,
+           (unsigned long long)NFS_RA()->drops);
+
+    printf("compress: %llu clusters packed, %llu raw, %llu -> %llu blks (%.1f%%), "
+           "unpacked %llu, cpu %.3f ms compress, %.3f ms decompress\n",
+           (unsigned long long)NFS_COMP()->packed,
+           (unsigned long long)NFS_COMP()->raw,
+           (unsigned long long)NFS_COMP()->in_blks,
+           (unsigned long long)NFS_COMP()->out_blks,
+           NFS_COMP()->in_blks ? NFS_COMP()->out_blks * 100.0 / NFS_COMP()->in_blks : 0.0,
+           (unsigned long long)NFS_COMP()->unpacked,
+           NFS_COMP()->comp_ns / 1e6,
+           NFS_COMP()->decomp_ns / 1e6);
+
+    printf("dedup: hashed %llu blks, shared %llu, copied on write %llu, hash collisions %llu\n",
+           (unsigned long long)NFS_DEDUP()->hashed,
+           (unsigned long long)NFS_DEDUP()->shared,
+           (unsigned long long)NFS_DEDUP()->cows,
+           (unsigned long long)NFS_DEDUP()->collisions);
+
+    printf("csum: crc32c %s, verified %llu blks, errors %llu, recomputed after replay %llu\n",
+           newfs_crc32c_impl(),
+           (unsigned long long)NFS_CSUM()->verified,
+           (unsigned long long)NFS_CSUM()->errors,
+           (unsigned long long)NFS_CSUM()->repaired);
+
+    printf("journal: %d blks, commits %llu, logged %llu blks, replayed %llu blks\n",
+           NFS_JOURNAL()->blks,
+           (unsigned long long)NFS_JOURNAL()->commits,
+           (unsigned long long)NFS_JOURNAL()->logged,
+           (unsigned long long)NFS_JOURNAL()->replayed);
+
+    printf("device: %llu seeks, %llu blks written\n",
+           (unsigned long long)newfs_super.dev_seeks,
+           (unsigned long long)newfs_super.dev_wblks);
+}
@@ -0,0 +1,261 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options newfs_options;
+
+/*
+ * 去重表为每个数据块记一项 newfs_dedup_d。ref 为 0 的块不参与去重，只有一个主人；
+ * 开启 --dedup 后写回的文件块登记内容指纹，之后内容相同的块（指纹相同且逐字节比较一致）
+ * 直接映射到已登记的块上，ref 记录映射到它的文件块数，减到 0 才真正释放。
+ * 共享块不会被原地改写：写回 ref > 1 的块时先换一个新块（写时复制）。
+ * 去重表和位图、inode 在同一个日志事务中写回；不开 --dedup 时也照常维护引用计数
+ */
+
+/**
+ * @brief 块内容的指纹，按 8 字节一组混合，不是密码学哈希，匹配后还要逐字节比较
+ *
+ * @param data 一整块
+ * @return uint32_t 不会是 NFS_DEDUP_NONE
+ */
+static uint32_t newfs_dedup_hash(const uint8_t* data) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL, v;
+    int i;
+
+    for (i = 0; i < NFS_BLK_SZ(); i += sizeof(v)) {
+        memcpy(&v, data + i, sizeof(v));
+        h ^= v * 0xff51afd7ed558ccdULL;
+        h  = (h << 31 | h >> 33) * 0xc4ceb9fe1a85ec53ULL;
+    }
+    h ^= h >> 29;
+    return (uint32_t)(h ^ h >> 32) | 1;
+}
+
+/**
+ * @brief 去重表第 bno 项所在的块需要写回
+ *
+ * @param bno
+ */
+static void newfs_dedup_dirty(int bno) {
+    struct newfs_dedup* dd = NFS_DEDUP();
+    dd->blk_dirty[bno * (int)sizeof(struct newfs_dedup_d) / NFS_BLK_SZ()] = TRUE;
+}
+
+/**
+ * @brief 把已登记指纹的块挂进哈希表
+ *
+ * @param bno
+ */
+static void newfs_dedup_link(int bno) {
+    struct newfs_dedup* dd = NFS_DEDUP();
+    int h = dd->ents[bno].hash & (dd->nr_heads - 1);
+
+    dd->next[bno] = dd->heads[h];
+    dd->heads[h]  = bno;
+}
+
+/**
+ * @brief 从哈希表中摘下并清除这一项
+ *
+ * @param bno
+ */
+static void newfs_dedup_unlink(int bno) {
+    struct newfs_dedup* dd = NFS_DEDUP();
+    int* pp = &dd->heads[dd->ents[bno].hash & (dd->nr_heads - 1)];
+
+    while (*pp >= 0 && *pp != bno) {
+        pp = &dd->next[*pp];
+    }
+    if (*pp == bno) {
+        *pp = dd->next[bno];
+    }
+    dd->ents[bno].hash = NFS_DEDUP_NONE;
+    dd->ents[bno].ref  = 0;
+    newfs_dedup_dirty(bno);
+}
+
+/**
+ * @brief 找内容与 data 相同的已登记块，指纹相同的再读出来逐字节比较
+ *
+ * @param hash
+ * @param data
+ * @return int 数据块号，没有时返回 -1
+ */
+static int newfs_dedup_find(uint32_t hash, const uint8_t* data) {
+    struct newfs_dedup* dd = NFS_DEDUP();
+    uint8_t* buf = (uint8_t*)malloc(NFS_BLK_SZ());
+    int bno, ret = -1;
+
+    for (bno = dd->heads[hash & (dd->nr_heads - 1)]; bno >= 0; bno = dd->next[bno]) {
+        if (dd->ents[bno].hash != hash) {
+            continue;
+        }
+        if (newfs_driver_read(NFS_DATA_OFS(bno), buf, NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+            continue;                                   /* 读不出或校验失败的块不拿来共享 */
+        }
+        if (memcmp(buf, data, NFS_BLK_SZ()) == 0) {
+            ret = bno;
+            break;
+        }
+        dd->collisions++;
+    }
+    free(buf);
+    return ret;
+}
+
+/**
+ * @brief 写回一个文件数据块之前调用，决定它写到哪里
+ * 开启去重时先找内容相同的块，找到就改为共享它；要写的块正被共享时另分配一块，
+ * 原地改写的块旧指纹作废。调用时持有 newfs_super.lock，映射可能改变
+ *
+ * @param inode 普通文件，不压缩
+ * @param lblk 已映射的脏块
+ * @return int 1 表示已与盘上的块共享、不必再写，0 表示照常写到当前映射的块，负数为错误码
+ */
+int newfs_dedup_block(struct newfs_inode* inode, int lblk) {
+    struct newfs_dedup* dd   = NFS_DEDUP();
+    uint8_t*            data = inode->block_pointer[lblk];
+    uint32_t            hash = NFS_DEDUP_NONE;
+    int pblk = newfs_bmap(inode, lblk, FALSE), cand, nblk, prev;
+
+    if (newfs_options.dedup) {
+        hash = newfs_dedup_hash(data);
+        dd->hashed++;
+        cand = newfs_dedup_find(hash, data);
+        if (cand == pblk) {
+            return 1;                                   /* 盘上已经是这些内容 */
+        }
+        if (cand >= 0) {
+            if (newfs_bmap_set(inode, lblk, cand) != NFS_ERROR_NONE) {
+                return -NFS_ERROR_NOSPACE;
+            }
+            dd->ents[cand].ref++;
+            newfs_dedup_dirty(cand);
+            dd->shared++;
+            return 1;
+        }
+    }
+
+    if (dd->ents[pblk].ref > 1) {                       /* 写时复制 */
+        prev = lblk > 0 ? newfs_bmap(inode, lblk - 1, FALSE) : -1;
+        nblk = newfs_bitmap_alloc_near(&newfs_super.data_bmap, prev >= 0 ? prev + 1 : -1);
+        if (nblk < 0) {
+            return -NFS_ERROR_NOSPACE;
+        }
+        if (newfs_bmap_set(inode, lblk, nblk) != NFS_ERROR_NONE) {
+            newfs_bitmap_free(&newfs_super.data_bmap, nblk);
+            return -NFS_ERROR_NOSPACE;
+        }
+        dd->cows++;
+        pblk = nblk;
+    }
+    else if (dd->ents[pblk].hash != NFS_DEDUP_NONE) {
+        newfs_dedup_unlink(pblk);                       /* 要原地改写 */
+    }
+
+    if (hash != NFS_DEDUP_NONE) {
+        dd->ents[pblk].hash = hash;
+        dd->ents[pblk].ref  = 1;
+        newfs_dedup_link(pblk);
+        newfs_dedup_dirty(pblk);
+    }
+    return 0;
+}
+
+/**
+ * @brief 文件不再使用一个数据块：共享的块只减引用，最后一个使用者放手时才释放
+ *
+ * @param bno
+ */
+void newfs_dedup_put(int bno) {
+    struct newfs_dedup* dd = NFS_DEDUP();
+
+    if (dd->ents[bno].ref > 1) {
+        dd->ents[bno].ref--;
+        newfs_dedup_dirty(bno);
+        return;
+    }
+    if (dd->ents[bno].hash != NFS_DEDUP_NONE) {
+        newfs_dedup_unlink(bno);
+    }
+    newfs_bitmap_free(&newfs_super.data_bmap, bno);
+}
+
+/**
+ * @brief 读入去重表并建立指纹哈希表，需在日志重放之后调用
+ *
+ * @param offset 去重表起始逻辑块号
+ * @param blks 去重表块数
+ * @param format 刚格式化，表清零写盘
+ * @return int
+ */
+int newfs_dedup_init(int offset, int blks, boolean format) {
+    struct newfs_dedup* dd = NFS_DEDUP();
+    int bno;
+
+    memset(dd, 0, sizeof(struct newfs_dedup));
+    dd->offset   = offset;
+    dd->blks     = blks;
+    dd->nr_heads = 1;
+    while (dd->nr_heads < newfs_super.max_data) {
+        dd->nr_heads <<= 1;
+    }
+    dd->ents      = (struct newfs_dedup_d*)calloc(blks, NFS_BLK_SZ());
+    dd->blk_dirty = (boolean*)calloc(blks, sizeof(boolean));
+    dd->heads     = (int*)malloc(dd->nr_heads * sizeof(int));
+    dd->next      = (int*)malloc(newfs_super.max_data * sizeof(int));
+    if (dd->ents == NULL || dd->blk_dirty == NULL || dd->heads == NULL || dd->next == NULL) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    memset(dd->heads, 0xff, dd->nr_heads * sizeof(int));
+
+    if (format) {
+        return newfs_driver_write(NFS_BLKS_SZ(offset), (uint8_t*)dd->ents, NFS_BLKS_SZ(blks));
+    }
+    if (newfs_driver_read(NFS_BLKS_SZ(offset), (uint8_t*)dd->ents, NFS_BLKS_SZ(blks)) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    for (bno = 0; bno < newfs_super.max_data; bno++) {
+        if (dd->ents[bno].hash != NFS_DEDUP_NONE) {
+            newfs_dedup_link(bno);
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 写回改动过的去重表块，与位图在同一个事务中
+ *
+ * @return int
+ */
+int newfs_dedup_sync() {
+    struct newfs_dedup* dd = NFS_DEDUP();
+    int i;
+
+    for (i = 0; i < dd->blks; i++) {
+        if (!dd->blk_dirty[i]) {
+            continue;
+        }
+        if (newfs_driver_write(NFS_BLKS_SZ(dd->offset + i), (uint8_t*)dd->ents + NFS_BLKS_SZ(i),
+                               NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+        dd->blk_dirty[i] = FALSE;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放去重表占用的内存
+ *
+ */
+void newfs_dedup_destroy() {
+    struct newfs_dedup* dd = NFS_DEDUP();
+    free(dd->ents);
+    free(dd->blk_dirty);
+    free(dd->heads);
+    free(dd->next);
+    dd->ents      = NULL;
+    dd->blk_dirty = NULL;
+    dd->heads     = NULL;
+    dd->next      = NULL;
+}
@@ -0,0 +1,150 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options newfs_options;
+
+#define NFS_DIR_BUCKET(inode, hash)     ((hash) & ((inode)->dir_hash_size - 1))
+
+/**
+ * @brief 文件名哈希（FNV-1a）
+ *
+ * @param name
+ * @param len
+ * @return uint32_t
+ */
+uint32_t newfs_name_hash(const char* name, int len) {
+    uint32_t hash = 2166136261u;
+    int i;
+    for (i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief 按新的桶数重建目录哈希表
+ *
+ * @param inode
+ * @param size 桶数，2 的幂
+ * @return int
+ */
+static int newfs_dir_hash_resize(struct newfs_inode* inode, int size) {
+    struct newfs_dentry** table;
+    struct newfs_dentry*  dentry;
+    uint32_t bucket;
+
+    table = (struct newfs_dentry**)calloc(size, sizeof(struct newfs_dentry*));
+    if (table == NULL) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    free(inode->dir_hash);
+    inode->dir_hash      = table;
+    inode->dir_hash_size = size;
+    for (dentry = inode->dentrys; dentry; dentry = dentry->brother) {
+        bucket = NFS_DIR_BUCKET(inode, dentry->name_hash);
+        dentry->hash_next = table[bucket];
+        table[bucket] = dentry;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 为目录建立哈希表，各目录项的 name_hash 已在加入目录时算好
+ *
+ * @param inode
+ * @return int
+ */
+static int newfs_dir_hash_build(struct newfs_inode* inode) {
+    int size = NFS_DIR_HASH_MIN;
+
+    while (size < inode->dir_cnt) {
+        size <<= 1;
+    }
+    return newfs_dir_hash_resize(inode, size);
+}
+
+/**
+ * @brief 目录项加入目录时同步更新哈希表，表太满时扩容
+ *
+ * @param inode
+ * @param dentry 已经挂到 inode->dentrys 上的目录项
+ */
+void newfs_dir_hash_insert(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    uint32_t bucket;
+
+    dentry->name_hash = newfs_name_hash(dentry->fname, dentry->name_len);
+    if (inode->dir_hash == NULL) {
+        return;                                         /* 还没建表，等第一次查找 */
+    }
+    if (inode->dir_cnt > inode->dir_hash_size &&
+        newfs_dir_hash_resize(inode, inode->dir_hash_size << 1) == NFS_ERROR_NONE) {
+        return;                                         /* 重建时已包含 dentry */
+    }
+    bucket = NFS_DIR_BUCKET(inode, dentry->name_hash);
+    dentry->hash_next = inode->dir_hash[bucket];
+    inode->dir_hash[bucket] = dentry;
+}
+
+/**
+ * @brief 目录项移出目录时同步更新哈希表
+ *
+ * @param inode
+ * @param dentry
+ */
+void newfs_dir_hash_remove(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    struct newfs_dentry** link;
+
+    if (inode->dir_hash == NULL) {
+        return;
+    }
+    link = &inode->dir_hash[NFS_DIR_BUCKET(inode, dentry->name_hash)];
+    while (*link) {
+        if (*link == dentry) {
+            *link = dentry->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    dentry->hash_next = NULL;
+}
+
+/**
+ * @brief 在目录中按名字查找目录项
+ *
+ * @param inode 目录
+ * @param name  不要求以 '\0' 结尾
+ * @param len
+ * @return struct newfs_dentry* 没有时返回NULL
+ */
+struct newfs_dentry* newfs_dir_find(struct newfs_inode* inode, const char* name, int len) {
+    struct newfs_dentry* dentry;
+    uint32_t hash = newfs_name_hash(name, len);
+
+    if (inode->dir_hash == NULL && newfs_dir_hash_build(inode) != NFS_ERROR_NONE) {
+        for (dentry = inode->dentrys; dentry; dentry = dentry->brother) {
+            if (dentry->name_len == len && memcmp(dentry->fname, name, len) == 0) {
+                return dentry;
+            }
+        }
+        return NULL;
+    }
+    for (dentry = inode->dir_hash[NFS_DIR_BUCKET(inode, hash)]; dentry; dentry = dentry->hash_next) {
+        if (dentry->name_hash == hash && dentry->name_len == len &&
+            memcmp(dentry->fname, name, len) == 0) {
+            return dentry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 释放目录哈希表
+ *
+ * @param inode
+ */
+void newfs_dir_hash_free(struct newfs_inode* inode) {
+    free(inode->dir_hash);
+    inode->dir_hash      = NULL;
+    inode->dir_hash_size = 0;
+}
@@ -0,0 +1,377 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options newfs_options;
+
+/**
+ * @brief 二分查找起始块号不大于 lblk 的最后一个 extent
+ *
+ * @param inode
+ * @param lblk 文件逻辑块号
+ * @return int extent 下标，没有时返回 -1
+ */
+static int newfs_extent_search(struct newfs_inode* inode, uint32_t lblk) {
+    struct newfs_extent* ext = inode->extents;
+    int cnt = inode->extent_cnt, memo = inode->memo_ext;
+    int lo = 0, hi = cnt - 1, mid;
+    int ret = -1;
+
+    /* 顺序访问时通常还落在上次的 extent 或紧随其后的那个里，不必二分 */
+    if (memo < cnt && ext[memo].lblk <= lblk) {
+        if (memo + 1 == cnt || ext[memo + 1].lblk > lblk) {
+            return memo;
+        }
+        if (memo + 2 == cnt || ext[memo + 2].lblk > lblk) {
+            inode->memo_ext = memo + 1;
+            return memo + 1;
+        }
+    }
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (inode->extents[mid].lblk <= lblk) {
+            ret = mid;
+            lo  = mid + 1;
+        }
+        else {
+            hi  = mid - 1;
+        }
+    }
+    if (ret >= 0) {
+        inode->memo_ext = ret;
+    }
+    return ret;
+}
+
+/**
+ * @brief 保证 extent 数组至少能放下 cnt 个
+ *
+ * @param inode
+ * @param cnt
+ * @return int
+ */
+static int newfs_extent_reserve(struct newfs_inode* inode, int cnt) {
+    struct newfs_extent* extents;
+    int cap = inode->extent_cap ? inode->extent_cap : NFS_INLINE_EXTENTS;
+
+    if (cnt <= inode->extent_cap) {
+        return NFS_ERROR_NONE;
+    }
+    while (cap < cnt) {
+        cap *= 2;
+    }
+    extents = (struct newfs_extent*)realloc(inode->extents, cap * sizeof(struct newfs_extent));
+    if (extents == NULL) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    inode->extents    = extents;
+    inode->extent_cap = cap;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 插入映射 lblk -> pblk，能接上前后 extent 时合并
+ * 调用者保证 lblk 未映射且数组还能再放一个 extent
+ *
+ * @param inode
+ * @param idx  起始块号不大于 lblk 的最后一个 extent，没有时为 -1
+ * @param lblk
+ * @param pblk
+ */
+static void newfs_extent_insert(struct newfs_inode* inode, int idx, int lblk, int pblk) {
+    struct newfs_extent* ext  = idx >= 0 ? &inode->extents[idx] : NULL;
+    struct newfs_extent* next = idx + 1 < inode->extent_cnt ? &inode->extents[idx + 1] : NULL;
+
+    if (ext && ext->lblk + ext->len == (uint32_t)lblk && ext->pblk + ext->len == (uint32_t)pblk) {
+        ext->len++;                                     /* 接在前一个 extent 后面 */
+        if (next && next->lblk == (uint32_t)lblk + 1 && next->pblk == (uint32_t)pblk + 1) {
+            ext->len += next->len;                      /* 填上了两段之间的空洞 */
+            memmove(next, next + 1, (inode->extent_cnt - idx - 2) * sizeof(struct newfs_extent));
+            inode->extent_cnt--;
+        }
+    }
+    else if (next && next->lblk == (uint32_t)lblk + 1 && next->pblk == (uint32_t)pblk + 1) {
+        next->lblk--;                                   /* 接在后一个 extent 前面 */
+        next->pblk--;
+        next->len++;
+    }
+    else {
+        ext = &inode->extents[idx + 1];
+        memmove(ext + 1, ext, (inode->extent_cnt - idx - 1) * sizeof(struct newfs_extent));
+        ext->lblk = lblk;
+        ext->pblk = pblk;
+        ext->len  = 1;
+        inode->extent_cnt++;
+    }
+}
+
+/**
+ * @brief 将文件逻辑块映射到数据块
+ * 新分配时优先取紧跟在前一个 extent 之后的块，使文件尽量连续
+ *
+ * @param inode
+ * @param lblk   文件逻辑块号
+ * @param create 未映射时是否分配
+ * @return int 数据块号，未映射或空间不足时返回 -1
+ */
+int newfs_extent_bmap(struct newfs_inode* inode, int lblk, boolean create) {
+    int idx  = newfs_extent_search(inode, lblk);
+    int goal = -1, pblk;
+    struct newfs_extent* ext;
+
+    if (idx >= 0) {
+        ext = &inode->extents[idx];
+        if (lblk < ext->lblk + ext->len) {
+            return ext->pblk + (lblk - ext->lblk);
+        }
+        if (ext->lblk + ext->len == lblk) {
+            goal = ext->pblk + ext->len;
+        }
+    }
+    if (!create) {
+        return -1;
+    }
+    if (newfs_extent_reserve(inode, inode->extent_cnt + 1) != NFS_ERROR_NONE) {
+        return -1;
+    }
+    pblk = newfs_bitmap_alloc_near(&newfs_super.data_bmap, goal);
+    if (pblk < 0) {
+        return -1;
+    }
+    newfs_extent_insert(inode, idx, lblk, pblk);
+    return pblk;
+}
+
+/**
+ * @brief 释放文件逻辑块号不小于 blks 的所有数据块
+ *
+ * @param inode
+ * @param blks 保留的块数
+ */
+void newfs_extent_truncate(struct newfs_inode* inode, int blks) {
+    struct newfs_extent* ext;
+    uint32_t keep, i;
+
+    while (inode->extent_cnt > 0) {
+        ext  = &inode->extents[inode->extent_cnt - 1];
+        keep = ext->lblk >= (uint32_t)blks ? 0 : blks - ext->lblk;
+        if (keep >= ext->len) {
+            break;
+        }
+        for (i = keep; i < ext->len; i++) {
+            newfs_dedup_put(ext->pblk + i);
+        }
+        ext->len = keep;
+        if (keep != 0) {
+            break;
+        }
+        inode->extent_cnt--;
+    }
+}
+
+/**
+ * @brief 解除一个文件逻辑块的映射并释放它，落在 extent 中间时把 extent 一分为二
+ *
+ * @param inode
+ * @param lblk
+ * @return int
+ */
+int newfs_extent_unmap(struct newfs_inode* inode, int lblk) {
+    int idx = newfs_extent_search(inode, lblk);
+    struct newfs_extent* ext;
+    uint32_t off;
+
+    if (idx < 0 || (uint32_t)lblk >= inode->extents[idx].lblk + inode->extents[idx].len) {
+        return NFS_ERROR_NONE;                          /* 本来就没有映射 */
+    }
+    if (newfs_extent_reserve(inode, inode->extent_cnt + 1) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    ext = &inode->extents[idx];
+    off = lblk - ext->lblk;
+    newfs_dedup_put(ext->pblk + off);
+    if (ext->len == 1) {
+        memmove(ext, ext + 1, (inode->extent_cnt - idx - 1) * sizeof(struct newfs_extent));
+        inode->extent_cnt--;
+    }
+    else if (off == 0) {
+        ext->lblk++;
+        ext->pblk++;
+        ext->len--;
+    }
+    else if (off == ext->len - 1) {
+        ext->len--;
+    }
+    else {
+        memmove(ext + 2, ext + 1, (inode->extent_cnt - idx - 1) * sizeof(struct newfs_extent));
+        ext[1].lblk = lblk + 1;
+        ext[1].pblk = ext->pblk + off + 1;
+        ext[1].len  = ext->len - off - 1;
+        ext->len    = off;
+        inode->extent_cnt++;
+    }
+    inode->memo_ext = 0;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 把一个文件逻辑块改映射到指定的数据块，原来的块交给去重表释放
+ *
+ * @param inode
+ * @param lblk
+ * @param pblk
+ * @return int
+ */
+int newfs_extent_set(struct newfs_inode* inode, int lblk, int pblk) {
+    /* 拆分 extent 和插入各可能多一个，先留够，失败时映射不变 */
+    if (newfs_extent_reserve(inode, inode->extent_cnt + 2) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    newfs_extent_unmap(inode, lblk);
+    newfs_extent_insert(inode, newfs_extent_search(inode, lblk), lblk, pblk);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 从磁盘 inode 及其溢出 extent 块读入映射
+ *
+ * @param inode
+ * @param inode_d
+ * @return int
+ */
+int newfs_extent_load(struct newfs_inode* inode, struct newfs_inode_d* inode_d) {
+    struct newfs_extent_blk_d* hdr;
+    uint8_t* blk_buf;
+    int      blk    = inode_d->extent_blk;
+    int      loaded = inode_d->extent_cnt < NFS_INLINE_EXTENTS ?
+                      inode_d->extent_cnt : NFS_INLINE_EXTENTS;
+
+    inode->extents        = NULL;
+    inode->extent_cnt     = 0;
+    inode->extent_cap     = 0;
+    inode->extent_blks    = NULL;
+    inode->extent_blk_cnt = 0;
+    inode->memo_ext       = 0;
+    if (newfs_extent_reserve(inode, inode_d->extent_cnt) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (loaded) {                                       /* 空文件没有分配 extents */
+        memcpy(inode->extents, inode_d->extents, loaded * sizeof(struct newfs_extent));
+    }
+
+    blk_buf = (uint8_t*)malloc(NFS_BLK_SZ());
+    hdr     = (struct newfs_extent_blk_d*)blk_buf;
+    while (blk != -1 && loaded < inode_d->extent_cnt) {
+        if (newfs_driver_read(NFS_DATA_OFS(blk), blk_buf, NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+            free(blk_buf);
+            return -NFS_ERROR_IO;
+        }
+        memcpy(inode->extents + loaded, blk_buf + sizeof(struct newfs_extent_blk_d),
+               hdr->cnt * sizeof(struct newfs_extent));
+        loaded += hdr->cnt;
+
+        inode->extent_blks = (int*)realloc(inode->extent_blks,
+                                           (inode->extent_blk_cnt + 1) * sizeof(int));
+        inode->extent_blks[inode->extent_blk_cnt++] = blk;
+        blk = hdr->next;
+    }
+    inode->extent_cnt = loaded;
+    free(blk_buf);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将映射写入磁盘 inode，放不下的部分写到溢出 extent 块
+ * 溢出块按需增减
+ *
+ * @param inode
+ * @param inode_d
+ * @return int
+ */
+int newfs_extent_sync(struct newfs_inode* inode, struct newfs_inode_d* inode_d) {
+    struct newfs_extent_blk_d* hdr;
+    uint8_t* blk_buf;
+    int      inline_cnt = inode->extent_cnt < NFS_INLINE_EXTENTS ?
+                          inode->extent_cnt : NFS_INLINE_EXTENTS;
+    int      over = inode->extent_cnt - inline_cnt;
+    int      need = (over + NFS_EXTENT_PER_BLK() - 1) / NFS_EXTENT_PER_BLK();
+    int      i, blk, goal;
+
+    inode_d->extent_cnt = inode->extent_cnt;
+    memset(inode_d->extents, 0, sizeof(inode_d->extents));
+    if (inline_cnt) {
+        memcpy(inode_d->extents, inode->extents, inline_cnt * sizeof(struct newfs_extent));
+    }
+
+    while (inode->extent_blk_cnt < need) {
+        goal = inode->extent_blk_cnt ? inode->extent_blks[inode->extent_blk_cnt - 1] + 1 : -1;
+        blk  = newfs_bitmap_alloc_near(&newfs_super.data_bmap, goal);
+        if (blk < 0) {
+            return -NFS_ERROR_NOSPACE;
+        }
+        inode->extent_blks = (int*)realloc(inode->extent_blks,
+                                           (inode->extent_blk_cnt + 1) * sizeof(int));
+        inode->extent_blks[inode->extent_blk_cnt++] = blk;
+    }
+    while (inode->extent_blk_cnt > need) {
+        newfs_bitmap_free(&newfs_super.data_bmap, inode->extent_blks[--inode->extent_blk_cnt]);
+    }
+    inode_d->extent_blk = need ? inode->extent_blks[0] : -1;
+
+    blk_buf = (uint8_t*)malloc(NFS_BLK_SZ());
+    hdr     = (struct newfs_extent_blk_d*)blk_buf;
+    for (i = 0; i < need; i++) {
+        memset(blk_buf, 0, NFS_BLK_SZ());
+        hdr->next = i + 1 < need ? inode->extent_blks[i + 1] : -1;
+        hdr->cnt  = over < NFS_EXTENT_PER_BLK() ? over : NFS_EXTENT_PER_BLK();
+        memcpy(blk_buf + sizeof(struct newfs_extent_blk_d),
+               inode->extents + inode->extent_cnt - over,
+               hdr->cnt * sizeof(struct newfs_extent));
+        over -= hdr->cnt;
+        if (newfs_driver_write(NFS_DATA_OFS(inode->extent_blks[i]), blk_buf,
+                               NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+            free(blk_buf);
+            return -NFS_ERROR_IO;
+        }
+    }
+    free(blk_buf);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 有 blks 个数据块的文件写回映射时最多写几个溢出 extent 块（每块至少一个 extent）
+ *
+ * @param blks
+ * @return int
+ */
+int newfs_extent_sync_blks(int blks) {
+    int over = blks - NFS_INLINE_EXTENTS;
+    return over > 0 ? (over + NFS_EXTENT_PER_BLK() - 1) / NFS_EXTENT_PER_BLK() : 0;
+}
+
+/**
+ * @brief 释放 inode 占用的全部数据块、溢出 extent 块以及内存中的映射
+ *
+ * @param inode
+ */
+void newfs_extent_free(struct newfs_inode* inode) {
+    newfs_extent_truncate(inode, 0);
+    while (inode->extent_blk_cnt > 0) {
+        newfs_bitmap_free(&newfs_super.data_bmap, inode->extent_blks[--inode->extent_blk_cnt]);
+    }
+    newfs_extent_release(inode);
+}
+
+/**
+ * @brief 只释放内存中的映射，盘上的块保持不变，读 inode 失败时丢弃半成品
+ *
+ * @param inode
+ */
+void newfs_extent_release(struct newfs_inode* inode) {
+    free(inode->extents);
+    free(inode->extent_blks);
+    inode->extents        = NULL;
+    inode->extent_cnt     = 0;
+    inode->extent_cap     = 0;
+    inode->extent_blks    = NULL;
+    inode->extent_blk_cnt = 0;
+}
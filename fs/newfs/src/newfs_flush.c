@@ -0,0 +1,340 @@
+#include "../include/newfs.h"
+#include <sys/time.h>
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options newfs_options;
+
+/**
+ * @brief 暂存区排序用，先按块号，同一块按暂存顺序
+ *
+ * @param a
+ * @param b
+ * @return int
+ */
+static int newfs_stage_cmp(const void* a, const void* b) {
+    const struct newfs_stage_ent* x = (const struct newfs_stage_ent*)a;
+    const struct newfs_stage_ent* y = (const struct newfs_stage_ent*)b;
+    if (x->blk != y->blk) {
+        return x->blk < y->blk ? -1 : 1;
+    }
+    return x->seq - y->seq;
+}
+
+/**
+ * @brief 按块号排序，同一块只保留最后一次暂存的内容
+ *
+ */
+static void newfs_stage_sort() {
+    struct newfs_stage* stage = NFS_STAGE();
+    int i, n = 0;
+
+    qsort(stage->ents, stage->cnt, sizeof(struct newfs_stage_ent), newfs_stage_cmp);
+    for (i = 0; i < stage->cnt; i++) {
+        if (i + 1 < stage->cnt && stage->ents[i + 1].blk == stage->ents[i].blk) {
+            free(stage->ents[i].data);                  /* 被后一次覆盖 */
+            continue;
+        }
+        stage->ents[n]     = stage->ents[i];
+        stage->ents[n].seq = n;                         /* 写盘失败留下时，之后暂存的排在后面 */
+        n++;
+    }
+    stage->cnt    = n;
+    stage->sorted = TRUE;
+}
+
+/**
+ * @brief 在暂存区中找一个块
+ *
+ * @param blk
+ * @return struct newfs_stage_ent* 没有时返回NULL
+ */
+static struct newfs_stage_ent* newfs_stage_find(int blk) {
+    struct newfs_stage* stage = NFS_STAGE();
+    int lo = 0, hi = stage->cnt - 1, mid, i;
+
+    if (!stage->sorted) {
+        for (i = stage->cnt - 1; i >= 0; i--) {         /* 从后往前，取最新的 */
+            if (stage->ents[i].blk == blk) {
+                return &stage->ents[i];
+            }
+        }
+        return NULL;
+    }
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (stage->ents[mid].blk == blk) {
+            return &stage->ents[mid];
+        }
+        if (stage->ents[mid].blk < blk) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 把要写盘的整块复制进暂存区
+ *
+ * @param blk 起始逻辑块号
+ * @param content
+ * @param blks 块数
+ */
+void newfs_stage_add(int blk, uint8_t* content, int blks) {
+    struct newfs_stage*     stage = NFS_STAGE();
+    struct newfs_stage_ent* ents;
+    int i, cap;
+
+    if (stage->cnt + blks > stage->cap) {
+        cap = stage->cap ? stage->cap : 64;
+        while (cap < stage->cnt + blks) {
+            cap *= 2;
+        }
+        ents = (struct newfs_stage_ent*)realloc(stage->ents, cap * sizeof(struct newfs_stage_ent));
+        if (ents == NULL) {
+            return;
+        }
+        stage->ents = ents;
+        stage->cap  = cap;
+    }
+    for (i = 0; i < blks; i++) {
+        ents = &stage->ents[stage->cnt];
+        ents->blk  = blk + i;
+        ents->seq  = stage->cnt;
+        ents->data = (uint8_t*)malloc(NFS_BLK_SZ());
+        memcpy(ents->data, content + NFS_BLKS_SZ(i), NFS_BLK_SZ());
+        stage->cnt++;
+    }
+    stage->sorted = FALSE;
+}
+
+/**
+ * @brief 刚从设备读出的块如果还在暂存区里等待写盘，用暂存区的新内容覆盖；
+ * 还在未提交事务里的块更新，再用事务中的内容覆盖
+ *
+ * @param blk 起始逻辑块号
+ * @param bufs 每个逻辑块对应的缓冲区
+ * @param blks 块数
+ */
+void newfs_stage_overlay(int blk, uint8_t** bufs, int blks) {
+    struct newfs_stage_ent* ent;
+    int i;
+
+    for (i = 0; i < blks && NFS_STAGE()->cnt != 0; i++) {
+        ent = newfs_stage_find(blk + i);
+        if (ent) {
+            memcpy(bufs[i], ent->data, NFS_BLK_SZ());
+        }
+    }
+    newfs_journal_overlay(blk, bufs, blks);
+}
+
+/**
+ * @brief 暂存区写盘期间前台直接写盘的块，同时更新暂存的副本，
+ * 否则随后写出的旧副本会覆盖新内容。调用时持有 dev_lock
+ *
+ * @param blk 逻辑块号
+ * @param data 要写盘的新内容
+ */
+void newfs_stage_update(int blk, uint8_t* data) {
+    struct newfs_stage_ent* ent;
+
+    if (!NFS_STAGE()->writing) {
+        return;
+    }
+    ent = newfs_stage_find(blk);
+    if (ent && ent->data != data) {                     /* 回写线程自己写盘时 data 就是副本 */
+        memcpy(ent->data, data, NFS_BLK_SZ());
+    }
+}
+
+/**
+ * @brief 将暂存区按块号顺序写盘，连续的块合并成一次设备写
+ * 调用时不持有 newfs_super.lock，暂存区此时只读
+ *
+ * @return int
+ */
+static int newfs_stage_write() {
+    struct newfs_stage* stage = NFS_STAGE();
+    uint8_t** bufs = (uint8_t**)malloc((stage->cnt + 1) * sizeof(uint8_t*));
+    int i, run = 0, ret = NFS_ERROR_NONE;
+
+    for (i = 0; i < stage->cnt; i++) {
+        bufs[i] = stage->ents[i].data;
+        run++;
+        if (i + 1 < stage->cnt && stage->ents[i + 1].blk == stage->ents[i].blk + 1) {
+            continue;
+        }
+        if (newfs_dev_writev(stage->ents[i + 1 - run].blk, bufs + i + 1 - run, run) != NFS_ERROR_NONE) {
+            ret = -NFS_ERROR_IO;
+        }
+        run = 0;
+    }
+    free(bufs);
+    return ret;
+}
+
+/**
+ * @brief 清空暂存区
+ *
+ */
+static void newfs_stage_clear() {
+    struct newfs_stage* stage = NFS_STAGE();
+    int i;
+    for (i = 0; i < stage->cnt; i++) {
+        free(stage->ents[i].data);
+    }
+    stage->cnt    = 0;
+    stage->sorted = FALSE;
+}
+
+/**
+ * @brief 等待正在进行的一轮回写写完，调用时持有 newfs_super.lock（只持有一层）
+ *
+ */
+void newfs_stage_wait() {
+    while (NFS_STAGE()->writing) {
+        pthread_cond_wait(&newfs_super.stage_cond, &newfs_super.lock);
+    }
+}
+
+/**
+ * @brief 持锁立即把暂存区写盘并清空，写盘失败时留着下次重试
+ * 用于没有回写线程时，以及提交事务前先把本轮的文件数据写回原位
+ *
+ * @return int
+ */
+int newfs_stage_sync() {
+    struct newfs_stage* stage = NFS_STAGE();
+    int ret;
+
+    newfs_stage_wait();
+    if (stage->cnt == 0) {
+        return NFS_ERROR_NONE;
+    }
+    newfs_stage_sort();
+    ret = newfs_stage_write();
+    if (ret == NFS_ERROR_NONE) {
+        newfs_stage_clear();
+    }
+    return ret;
+}
+
+/**
+ * @brief 做一轮回写，调用时持有 newfs_super.lock（只持有一层）
+ * 持锁把所有改动收进暂存区，提交时文件数据先写回原位、元数据再进日志；
+ * 放锁后把已提交的元数据按设备顺序写回原位，前台操作在这段写盘期间不被阻塞。
+ * 出错时没提交的事务和暂存的块都留着，脏块计数也不清，下一轮重试
+ *
+ * @return int
+ */
+int newfs_flush_round() {
+    struct newfs_stage* stage = NFS_STAGE();
+    int ret;
+
+    newfs_sync_begin();                                 /* 同一时间只有一轮在写盘 */
+    ret = newfs_sync_all();
+    stage->active = FALSE;
+    if (ret != NFS_ERROR_NONE) {                        /* 没有提交，暂存区里的数据不能当作已提交写回 */
+        return ret;
+    }
+    newfs_super.dirty_blks = 0;
+    if (stage->cnt == 0) {
+        newfs_journal_checkpointed();
+        return ret;
+    }
+    newfs_stage_sort();
+
+    stage->writing = TRUE;
+    NFS_UNLOCK();
+    ret = newfs_stage_write();
+    NFS_LOCK();
+    stage->writing = FALSE;
+    pthread_cond_broadcast(&newfs_super.stage_cond);
+    if (ret != NFS_ERROR_NONE) {                        /* 已提交的块留在暂存区，下次写盘时重试 */
+        return -NFS_ERROR_IO;
+    }
+
+    newfs_journal_checkpointed();
+    newfs_stage_clear();
+    return ret;
+}
+
+/**
+ * @brief 回写线程：按周期或被脏数据量唤醒
+ *
+ * @param arg
+ * @return void*
+ */
+static void* newfs_flusher(void* arg) {
+    struct timeval  now;
+    struct timespec deadline;
+    (void)arg;
+
+    NFS_LOCK();
+    while (!newfs_super.flusher_stop) {
+        gettimeofday(&now, NULL);
+        deadline.tv_sec  = now.tv_sec + newfs_options.flush_ms / 1000;
+        deadline.tv_nsec = now.tv_usec * 1000 + (newfs_options.flush_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&newfs_super.flush_cond, &newfs_super.lock, &deadline);
+        if (newfs_super.flusher_stop) {
+            break;
+        }
+        if (newfs_flush_round() != NFS_ERROR_NONE) {
+            NFS_DBG("[%s] writeback error\n", __func__);
+        }
+    }
+    NFS_UNLOCK();
+    return NULL;
+}
+
+/**
+ * @brief 脏数据超过阈值时唤醒回写线程，调用时持有 newfs_super.lock
+ *
+ */
+void newfs_flusher_kick() {
+    if (newfs_super.flusher_running &&
+        NFS_BLKS_SZ(newfs_super.dirty_blks) >= newfs_options.dirty_bytes) {
+        pthread_cond_signal(&newfs_super.flush_cond);
+    }
+}
+
+/**
+ * @brief 启动回写线程
+ *
+ * @return int
+ */
+int newfs_flusher_start() {
+    newfs_super.flusher_stop    = FALSE;
+    newfs_super.flusher_running = FALSE;
+    if (newfs_options.flush_ms <= 0) {
+        return NFS_ERROR_NONE;
+    }
+    if (pthread_create(&newfs_super.flusher, NULL, newfs_flusher, NULL) != 0) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    newfs_super.flusher_running = TRUE;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 停止回写线程并等待它做完当前一轮，调用时不持有 newfs_super.lock
+ *
+ */
+void newfs_flusher_stop() {
+    if (!newfs_super.flusher_running) {
+        return;
+    }
+    NFS_LOCK();
+    newfs_super.flusher_stop = TRUE;
+    pthread_cond_signal(&newfs_super.flush_cond);
+    NFS_UNLOCK();
+    pthread_join(newfs_super.flusher, NULL);
+    newfs_super.flusher_running = FALSE;
+}
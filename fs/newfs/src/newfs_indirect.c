@@ -0,0 +1,412 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options newfs_options;
+
+/**
+ * @brief 取得间接块的内容，第一次访问时才从磁盘读入
+ *
+ * @param ind
+ * @param create 尚未分配时是否分配一个全空的间接块
+ * @return int* 块指针数组，未分配或出错时返回NULL
+ */
+static int* newfs_ind_get(struct newfs_ind* ind, boolean create) {
+    int* ptrs;
+
+    if (ind->ptrs) {
+        return ind->ptrs;
+    }
+    if (ind->bno < 0 && !create) {
+        return NULL;
+    }
+    ptrs = (int*)malloc(NFS_BLK_SZ());
+    if (ptrs == NULL) {
+        return NULL;
+    }
+    if (ind->bno < 0) {
+        ind->bno = newfs_bitmap_alloc(&newfs_super.data_bmap);
+        if (ind->bno < 0) {
+            free(ptrs);
+            return NULL;
+        }
+        memset(ptrs, 0xff, NFS_BLK_SZ());               /* 全部为 -1 */
+        ind->dirty = TRUE;
+    }
+    else if (newfs_driver_read(NFS_DATA_OFS(ind->bno), (uint8_t*)ptrs,
+                               NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+        free(ptrs);
+        return NULL;
+    }
+    ind->ptrs = ptrs;
+    return ptrs;
+}
+
+/**
+ * @brief 释放间接块本身（不含它指向的数据块）
+ *
+ * @param ind
+ */
+static void newfs_ind_put(struct newfs_ind* ind) {
+    newfs_bitmap_free(&newfs_super.data_bmap, ind->bno);
+    free(ind->ptrs);
+    ind->bno   = -1;
+    ind->ptrs  = NULL;
+    ind->dirty = FALSE;
+}
+
+/**
+ * @brief 释放一组块指针中文件逻辑块号不小于 blks 的数据块
+ *
+ * @param ptrs
+ * @param base ptrs[0] 对应的文件逻辑块号
+ * @param cnt
+ * @param blks 保留的块数
+ * @return boolean 是否有指针被修改
+ */
+static boolean newfs_ind_trunc_slots(int* ptrs, int base, int cnt, int blks) {
+    boolean changed = FALSE;
+    int i = blks > base ? blks - base : 0;
+    for (; i < cnt; i++) {
+        if (ptrs[i] >= 0) {
+            newfs_dedup_put(ptrs[i]);
+            ptrs[i] = -1;
+            changed = TRUE;
+        }
+    }
+    return changed;
+}
+
+/**
+ * @brief 找到 dind 下第 idx 个一级间接块
+ *
+ * @param inode
+ * @param idx
+ * @param create
+ * @return struct newfs_ind* 未分配或出错时返回NULL
+ */
+static struct newfs_ind* newfs_dind_sub(struct newfs_inode* inode, int idx, boolean create) {
+    int* top = newfs_ind_get(&inode->dind, create);
+    int  i;
+
+    if (top == NULL) {
+        return NULL;
+    }
+    if (inode->dind_sub == NULL) {
+        inode->dind_sub = (struct newfs_ind*)calloc(NFS_PTRS_PER_BLK(), sizeof(struct newfs_ind));
+        if (inode->dind_sub == NULL) {
+            return NULL;
+        }
+        for (i = 0; i < NFS_PTRS_PER_BLK(); i++) {
+            inode->dind_sub[i].bno = top[i];
+        }
+    }
+    if (newfs_ind_get(&inode->dind_sub[idx], create) == NULL) {
+        return NULL;
+    }
+    if (top[idx] != inode->dind_sub[idx].bno) {         /* 新分配的一级间接块 */
+        top[idx] = inode->dind_sub[idx].bno;
+        inode->dind.dirty = TRUE;
+    }
+    return &inode->dind_sub[idx];
+}
+
+/**
+ * @brief 找到 lblk 所在的那组块指针，并记为 memo
+ *
+ * @param inode
+ * @param lblk
+ * @param create 途经的间接块未分配时是否分配
+ * @return boolean 是否找到
+ */
+static boolean newfs_indirect_walk(struct newfs_inode* inode, int lblk, boolean create) {
+    int per = NFS_PTRS_PER_BLK();
+    struct newfs_ind* sub;
+
+    if (lblk < NFS_DIRECT_BLKS) {
+        inode->memo_slots = inode->bno;
+        inode->memo_owner = NULL;
+        inode->memo_base  = 0;
+        inode->memo_span  = NFS_DIRECT_BLKS;
+        return TRUE;
+    }
+    lblk -= NFS_DIRECT_BLKS;
+    if (lblk < per) {
+        if (newfs_ind_get(&inode->ind, create) == NULL) {
+            return FALSE;
+        }
+        sub = &inode->ind;
+        inode->memo_base = NFS_DIRECT_BLKS;
+    }
+    else {
+        lblk -= per;
+        if (lblk / per >= per) {
+            return FALSE;                               /* 超出二级间接块的范围 */
+        }
+        sub = newfs_dind_sub(inode, lblk / per, create);
+        if (sub == NULL) {
+            return FALSE;
+        }
+        inode->memo_base = NFS_DIRECT_BLKS + per + lblk / per * per;
+    }
+    inode->memo_slots = sub->ptrs;
+    inode->memo_owner = sub;
+    inode->memo_span  = per;
+    return TRUE;
+}
+
+/**
+ * @brief 将文件逻辑块映射到数据块
+ * 顺序访问时 lblk 多半还在上次那组块指针里，直接下标访问，不必重新走间接块
+ *
+ * @param inode
+ * @param lblk   文件逻辑块号
+ * @param create 未映射时是否分配
+ * @return int 数据块号，未映射或空间不足时返回 -1
+ */
+int newfs_indirect_bmap(struct newfs_inode* inode, int lblk, boolean create) {
+    int* slot;
+    int  goal;
+
+    if (inode->memo_slots == NULL || lblk < inode->memo_base ||
+        lblk >= inode->memo_base + inode->memo_span) {
+        if (!newfs_indirect_walk(inode, lblk, create)) {
+            return -1;
+        }
+    }
+    slot = &inode->memo_slots[lblk - inode->memo_base];
+    if (*slot >= 0 || !create) {
+        return *slot;
+    }
+
+    /* 优先接在前一块之后 */
+    if (lblk > inode->memo_base) {
+        goal = slot[-1];
+    }
+    else if (lblk > 0) {                                /* 前一块在另一组块指针里 */
+        goal = newfs_indirect_bmap(inode, lblk - 1, FALSE);
+        newfs_indirect_walk(inode, lblk, FALSE);
+        slot = &inode->memo_slots[lblk - inode->memo_base];
+    }
+    else {
+        goal = -1;
+    }
+    *slot = newfs_bitmap_alloc_near(&newfs_super.data_bmap, goal >= 0 ? goal + 1 : -1);
+    if (*slot >= 0 && inode->memo_owner) {
+        inode->memo_owner->dirty = TRUE;
+    }
+    return *slot;
+}
+
+/**
+ * @brief 释放文件逻辑块号不小于 blks 的所有数据块，以及因此变空的间接块
+ *
+ * @param inode
+ * @param blks 保留的块数
+ */
+void newfs_indirect_truncate(struct newfs_inode* inode, int blks) {
+    int per = NFS_PTRS_PER_BLK();
+    int base, i;
+    struct newfs_ind* sub;
+
+    inode->memo_slots = NULL;
+    newfs_ind_trunc_slots(inode->bno, 0, NFS_DIRECT_BLKS, blks);
+
+    base = NFS_DIRECT_BLKS;
+    if (blks < base + per && newfs_ind_get(&inode->ind, FALSE)) {
+        if (newfs_ind_trunc_slots(inode->ind.ptrs, base, per, blks)) {
+            inode->ind.dirty = TRUE;
+        }
+        if (blks <= base) {
+            newfs_ind_put(&inode->ind);
+        }
+    }
+
+    base += per;
+    if (blks < base + per * per && newfs_ind_get(&inode->dind, FALSE)) {
+        for (i = 0; i < per; i++) {
+            if (inode->dind.ptrs[i] < 0 || base + (i + 1) * per <= blks) {
+                continue;
+            }
+            sub = newfs_dind_sub(inode, i, FALSE);
+            if (sub == NULL) {
+                continue;
+            }
+            if (newfs_ind_trunc_slots(sub->ptrs, base + i * per, per, blks)) {
+                sub->dirty = TRUE;
+            }
+            if (blks <= base + i * per) {
+                newfs_ind_put(sub);
+                inode->dind.ptrs[i] = -1;
+                inode->dind.dirty   = TRUE;
+            }
+        }
+        if (blks <= base) {
+            newfs_ind_put(&inode->dind);
+            free(inode->dind_sub);
+            inode->dind_sub = NULL;
+        }
+    }
+}
+
+/**
+ * @brief 解除一个文件逻辑块的映射并释放它，间接块留到截断时再释放
+ *
+ * @param inode
+ * @param lblk
+ * @return int
+ */
+int newfs_indirect_unmap(struct newfs_inode* inode, int lblk) {
+    int* slot;
+
+    if (!newfs_indirect_walk(inode, lblk, FALSE)) {
+        return NFS_ERROR_NONE;
+    }
+    slot = &inode->memo_slots[lblk - inode->memo_base];
+    if (*slot >= 0) {
+        newfs_dedup_put(*slot);
+        *slot = -1;
+        if (inode->memo_owner) {
+            inode->memo_owner->dirty = TRUE;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 把一个文件逻辑块改映射到指定的数据块，原来的块交给去重表释放
+ *
+ * @param inode
+ * @param lblk
+ * @param pblk
+ * @return int
+ */
+int newfs_indirect_set(struct newfs_inode* inode, int lblk, int pblk) {
+    int* slot;
+
+    if (!newfs_indirect_walk(inode, lblk, TRUE)) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    slot = &inode->memo_slots[lblk - inode->memo_base];
+    if (*slot >= 0) {
+        newfs_dedup_put(*slot);
+    }
+    *slot = pblk;
+    if (inode->memo_owner) {
+        inode->memo_owner->dirty = TRUE;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 从磁盘 inode 读入直接块和间接块号，间接块本身等到用时再读
+ *
+ * @param inode
+ * @param inode_d
+ * @return int
+ */
+int newfs_indirect_load(struct newfs_inode* inode, struct newfs_inode_d* inode_d) {
+    memcpy(inode->bno, inode_d->bno, sizeof(inode->bno));
+    inode->ind.bno    = inode_d->ind;
+    inode->ind.ptrs   = NULL;
+    inode->ind.dirty  = FALSE;
+    inode->dind.bno   = inode_d->dind;
+    inode->dind.ptrs  = NULL;
+    inode->dind.dirty = FALSE;
+    inode->dind_sub   = NULL;
+    inode->memo_slots = NULL;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将间接块写回磁盘
+ *
+ * @param ind
+ * @return int
+ */
+static int newfs_ind_sync(struct newfs_ind* ind) {
+    if (!ind->dirty) {
+        return NFS_ERROR_NONE;
+    }
+    if (newfs_driver_write(NFS_DATA_OFS(ind->bno), (uint8_t*)ind->ptrs,
+                           NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    ind->dirty = FALSE;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 写回修改过的间接块，并把块号填入磁盘 inode
+ *
+ * @param inode
+ * @param inode_d
+ * @return int
+ */
+int newfs_indirect_sync(struct newfs_inode* inode, struct newfs_inode_d* inode_d) {
+    int i;
+
+    memcpy(inode_d->bno, inode->bno, sizeof(inode->bno));
+    inode_d->ind  = inode->ind.bno;
+    inode_d->dind = inode->dind.bno;
+    if (newfs_ind_sync(&inode->ind) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    if (inode->dind_sub) {
+        for (i = 0; i < NFS_PTRS_PER_BLK(); i++) {
+            if (inode->dind_sub[i].ptrs &&
+                newfs_ind_sync(&inode->dind_sub[i]) != NFS_ERROR_NONE) {
+                return -NFS_ERROR_IO;
+            }
+        }
+    }
+    return newfs_ind_sync(&inode->dind);
+}
+
+/**
+ * @brief 有 blks 个数据块的文件写回映射时最多写几个间接块
+ *
+ * @param blks
+ * @return int
+ */
+int newfs_indirect_sync_blks(int blks) {
+    int over = blks - NFS_DIRECT_BLKS - NFS_PTRS_PER_BLK();
+
+    if (blks <= NFS_DIRECT_BLKS) {
+        return 0;
+    }
+    if (over <= 0) {
+        return 1;                                       /* 一级间接块 */
+    }
+    return 2 + (over + NFS_PTRS_PER_BLK() - 1) / NFS_PTRS_PER_BLK();
+}
+
+/**
+ * @brief 释放 inode 占用的全部数据块和间接块
+ *
+ * @param inode
+ */
+void newfs_indirect_free(struct newfs_inode* inode) {
+    newfs_indirect_truncate(inode, 0);
+}
+
+/**
+ * @brief 只释放内存中读入的间接块，盘上的块保持不变，读 inode 失败时丢弃半成品
+ *
+ * @param inode
+ */
+void newfs_indirect_release(struct newfs_inode* inode) {
+    int i;
+
+    if (inode->dind_sub) {
+        for (i = 0; i < NFS_PTRS_PER_BLK(); i++) {
+            free(inode->dind_sub[i].ptrs);
+        }
+        free(inode->dind_sub);
+        inode->dind_sub = NULL;
+    }
+    free(inode->ind.ptrs);
+    free(inode->dind.ptrs);
+    inode->ind.ptrs   = NULL;
+    inode->dind.ptrs  = NULL;
+    inode->memo_slots = NULL;
+}
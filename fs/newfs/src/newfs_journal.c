@@ -0,0 +1,416 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options newfs_options;
+
+/**
+ * @brief 事务内容的校验和（CRC32C，以事务序号为初值逐块累加）
+ *
+ * @param seq
+ * @param bufs
+ * @param cnt
+ * @return uint32_t
+ */
+static uint32_t newfs_journal_csum(uint32_t seq, uint8_t** bufs, int cnt) {
+    uint32_t crc = seq;
+    int i;
+    for (i = 0; i < cnt; i++) {
+        crc = newfs_crc32c(crc, bufs[i], NFS_BLK_SZ());
+    }
+    return crc;
+}
+
+/**
+ * @brief 重写日志头：之后的挂载从 start 处、以序号 seq 开始扫描
+ *
+ * @param start
+ * @return int
+ */
+static int newfs_journal_write_head(int start) {
+    struct newfs_journal*   journal = NFS_JOURNAL();
+    struct newfs_journal_d* head_d  = (struct newfs_journal_d*)calloc(1, NFS_BLK_SZ());
+    int ret;
+
+    head_d->magic = NFS_JOURNAL_MAGIC;
+    head_d->seq   = journal->seq;
+    head_d->start = start < journal->blks ? start : 1;  /* 日志区恰好用完 */
+    ret = newfs_dev_write(journal->offset, (uint8_t*)head_d, 1);
+    free(head_d);
+    if (ret != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    journal->dirty = FALSE;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 重放日志区中尚未写回原位的事务
+ * 整个日志区一次顺序读入，在内存里找出从日志头开始连续有效的事务，
+ * 最后一个事务记录的 ckpt_seq 之前的事务都已写回，不必重放
+ *
+ * @return int
+ */
+static int newfs_journal_replay() {
+    struct newfs_journal*    journal = NFS_JOURNAL();
+    struct newfs_journal_d*  head_d;
+    struct newfs_jdesc_d*    desc;
+    struct newfs_jcommit_d*  commit;
+    uint8_t*  area = (uint8_t*)malloc(NFS_BLKS_SZ(journal->blks));
+    uint8_t** bufs = (uint8_t**)malloc(journal->blks * sizeof(uint8_t*));
+    int*      txn_pos = (int*)malloc(journal->blks * sizeof(int));
+    uint32_t  replay_from = 0;
+    int i, j, pos, ntxn = 0, ret = NFS_ERROR_NONE;
+
+    for (i = 0; i < journal->blks; i++) {
+        bufs[i] = area + NFS_BLKS_SZ(i);
+    }
+    if (newfs_dev_readv(journal->offset, bufs, journal->blks) != NFS_ERROR_NONE) {
+        ret = -NFS_ERROR_IO;
+        goto out;
+    }
+    head_d = (struct newfs_journal_d*)bufs[0];
+    if (head_d->magic != NFS_JOURNAL_MAGIC || head_d->start < 1 || head_d->start >= journal->blks) {
+        journal->seq  = 1;
+        journal->head = 1;
+        ret = newfs_journal_write_head(1);              /* 日志头损坏，当作空日志 */
+        goto out;
+    }
+
+    /* 找出连续有效的事务 */
+    journal->seq = head_d->seq;
+    pos = head_d->start;
+    while (pos < journal->blks) {
+        desc = (struct newfs_jdesc_d*)bufs[pos];
+        if (desc->magic != NFS_JDESC_MAGIC || desc->seq != journal->seq ||
+            desc->cnt <= 0 || desc->cnt > journal->max_txn || pos + desc->cnt + 2 > journal->blks) {
+            break;
+        }
+        commit = (struct newfs_jcommit_d*)bufs[pos + desc->cnt + 1];
+        if (commit->magic != NFS_JCOMMIT_MAGIC || commit->seq != desc->seq ||
+            commit->csum != newfs_journal_csum(desc->seq, bufs + pos + 1, desc->cnt)) {
+            break;                                      /* 提交前崩溃，丢弃 */
+        }
+        replay_from = desc->ckpt_seq;
+        txn_pos[ntxn++] = pos;
+        pos += desc->cnt + 2;
+        journal->seq++;
+    }
+    journal->head = pos;
+
+    journal->replay_blks = (int*)malloc(journal->blks * sizeof(int));  /* 重放的块不会比日志区多 */
+    for (i = 0; i < ntxn; i++) {
+        desc = (struct newfs_jdesc_d*)bufs[txn_pos[i]];
+        if (desc->seq < replay_from) {
+            continue;
+        }
+        for (j = 0; j < desc->cnt; j++) {
+            if (newfs_dev_write(desc->blks[j], bufs[txn_pos[i] + 1 + j], 1) != NFS_ERROR_NONE) {
+                ret = -NFS_ERROR_IO;
+                goto out;
+            }
+            newfs_cache_refresh(desc->blks[j], bufs[txn_pos[i] + 1 + j], 1);
+            journal->replay_blks[journal->replayed++] = desc->blks[j];
+        }
+    }
+    if (journal->replayed) {
+        ret = newfs_journal_write_head(journal->head);  /* 已写回原位，下次不必再重放 */
+    }
+out:
+    journal->ckpt_seq = journal->seq;
+    free(txn_pos);
+    free(bufs);
+    free(area);
+    return ret;
+}
+
+/**
+ * @brief 初始化日志，挂载时调用，必须早于读取位图和 inode
+ *
+ * @param offset 日志区起始逻辑块号
+ * @param blks 日志区块数
+ * @param format 是否是新格式化的磁盘
+ * @return int
+ */
+int newfs_journal_init(int offset, int blks, boolean format) {
+    struct newfs_journal* journal = NFS_JOURNAL();
+    int per_desc;
+
+    memset(journal, 0, sizeof(struct newfs_journal));
+    journal->offset  = offset;
+    journal->blks    = blks;
+    per_desc = (NFS_BLK_SZ() - (int)sizeof(struct newfs_jdesc_d)) / (int)sizeof(int);
+    journal->max_txn = blks - 3 < per_desc ? blks - 3 : per_desc;   /* 日志头、描述块、提交块 */
+    journal->txn_blks = (int*)malloc(journal->max_txn * sizeof(int));
+    journal->txn_data = (uint8_t**)calloc(journal->max_txn, sizeof(uint8_t*));
+    if (journal->txn_blks == NULL || journal->txn_data == NULL) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (format) {
+        journal->seq      = 1;
+        journal->head     = 1;
+        journal->ckpt_seq = 1;
+        return newfs_journal_write_head(1);
+    }
+    return newfs_journal_replay();
+}
+
+/**
+ * @brief 开始一个事务，此后整块的元数据写入都先收进事务
+ *
+ */
+void newfs_journal_begin() {
+    NFS_JOURNAL()->active = TRUE;
+}
+
+/**
+ * @brief 把当前事务写进日志，再安排写回原位
+ * 有序写：暂存区里此时只有不进日志的文件数据块，先把它们写回原位，
+ * 提交后的事务映射到的块不会还是上一个主人的内容；
+ * 描述块、各块内容、提交块连在一起一次顺序写入；
+ * 元数据的原位写回在回写线程中随暂存区一起进行，否则立即写
+ *
+ * @return int
+ */
+static int newfs_journal_write_txn() {
+    struct newfs_journal*   journal = NFS_JOURNAL();
+    struct newfs_stage*     stage   = NFS_STAGE();
+    struct newfs_jdesc_d*   desc;
+    struct newfs_jcommit_d* commit;
+    uint8_t** bufs;
+    int i, need = journal->txn_cnt + 2, ret = NFS_ERROR_NONE;
+
+    if (journal->txn_cnt == 0) {
+        return NFS_ERROR_NONE;
+    }
+    if (newfs_stage_sync() != NFS_ERROR_NONE) {          /* 数据先于映射它的元数据落盘 */
+        return -NFS_ERROR_IO;
+    }
+
+    /* 回绕：之前的事务必须都已写回原位，日志头才能指向开头 */
+    if (journal->head + need > journal->blks) {
+        journal->ckpt_seq = journal->seq;               /* 上面已把暂存区写盘 */
+        if (newfs_journal_write_head(1) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+        journal->head = 1;
+    }
+
+    bufs   = (uint8_t**)malloc(need * sizeof(uint8_t*));
+    desc   = (struct newfs_jdesc_d*)calloc(1, NFS_BLK_SZ());
+    commit = (struct newfs_jcommit_d*)calloc(1, NFS_BLK_SZ());
+    desc->magic    = NFS_JDESC_MAGIC;
+    desc->seq      = journal->seq;
+    desc->ckpt_seq = journal->ckpt_seq;
+    desc->cnt      = journal->txn_cnt;
+    memcpy(desc->blks, journal->txn_blks, journal->txn_cnt * sizeof(int));
+    bufs[0] = (uint8_t*)desc;
+    memcpy(bufs + 1, journal->txn_data, journal->txn_cnt * sizeof(uint8_t*));
+    commit->magic = NFS_JCOMMIT_MAGIC;
+    commit->seq   = journal->seq;
+    commit->csum  = newfs_journal_csum(journal->seq, bufs + 1, journal->txn_cnt);
+    bufs[need - 1] = (uint8_t*)commit;
+
+    if (newfs_dev_writev(journal->offset + journal->head, bufs, need) != NFS_ERROR_NONE) {
+        ret = -NFS_ERROR_IO;
+        goto out;
+    }
+    journal->head += need;
+    journal->seq++;
+    journal->dirty = TRUE;
+    journal->commits++;
+    journal->logged += journal->txn_cnt;
+
+    /* 已经提交，原位写回可以推迟 */
+    if (!stage->active) {
+        newfs_stage_wait();                             /* 回写线程写完之前暂存区只读 */
+    }
+    for (i = 0; i < journal->txn_cnt; i++) {
+        newfs_stage_add(journal->txn_blks[i], journal->txn_data[i], 1);
+    }
+    if (!stage->active) {
+        ret = newfs_stage_sync();
+        if (ret == NFS_ERROR_NONE) {
+            journal->ckpt_seq = journal->seq;
+        }
+    }
+    journal->txn_cnt = 0;
+out:
+    free(commit);
+    free(desc);
+    free(bufs);
+    return ret;
+}
+
+/**
+ * @brief 把整块的元数据写入收进当前事务，同一块只保留最后一次的内容
+ *
+ * @param blk 起始逻辑块号
+ * @param content
+ * @param blks 块数
+ * @return int
+ */
+int newfs_journal_add(int blk, uint8_t* content, int blks) {
+    struct newfs_journal* journal = NFS_JOURNAL();
+    int i, j;
+
+    for (i = 0; i < blks; i++) {
+        for (j = 0; j < journal->txn_cnt; j++) {
+            if (journal->txn_blks[j] == blk + i) {
+                break;
+            }
+        }
+        if (j == journal->txn_cnt) {
+            if (j == journal->max_txn) {                /* 预留保证不会发生；拆开提交会让崩溃后只剩半轮 */
+                NFS_DBG("[%s] transaction full\n", __func__);
+                journal->overflow = TRUE;
+                return -NFS_ERROR_NOSPACE;
+            }
+            if (journal->txn_data[j] == NULL) {
+                journal->txn_data[j] = (uint8_t*)malloc(NFS_BLK_SZ());
+            }
+            journal->txn_blks[j] = blk + i;
+            journal->txn_cnt++;
+        }
+        memcpy(journal->txn_data[j], content + NFS_BLKS_SZ(i), NFS_BLK_SZ());
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 提交当前事务（组提交：一次回写中的全部元数据改动作为一个事务）
+ * 事务没收全时整个放弃，盘上保持上一轮的状态
+ *
+ * @return int
+ */
+int newfs_journal_commit() {
+    struct newfs_journal* journal = NFS_JOURNAL();
+
+    if (journal->overflow) {
+        newfs_journal_abort();
+        return -NFS_ERROR_NOSPACE;
+    }
+    journal->active = FALSE;
+    return newfs_journal_write_txn();
+}
+
+/**
+ * @brief 回写出错时代替提交：收进的块留在事务里，下一轮连同补上的改动一起提交；
+ * 事务放不下时整个放弃，盘上保持上一轮的状态
+ *
+ */
+void newfs_journal_abort() {
+    struct newfs_journal* journal = NFS_JOURNAL();
+
+    journal->active = FALSE;
+    if (journal->overflow) {
+        journal->overflow = FALSE;
+        journal->txn_cnt  = 0;
+    }
+}
+
+/**
+ * @brief 一次操作最多让本轮多写进日志的块数：至多四个 inode 块（改名时两个父目录、
+ * 被移动的和被替换的），两个父目录的全部目录块（目录项总数不超过 inode 数，各自可能多一块），
+ * 最大文件的全部映射块，以及两个目录各多一个映射块
+ *
+ * @return int
+ */
+static int newfs_journal_op_blks() {
+    int dir_blks = (newfs_super.max_ino + NFS_DENTRY_PER_BLK() - 1) / NFS_DENTRY_PER_BLK() + 2;
+    int ext_blks = newfs_extent_sync_blks(newfs_super.max_data);
+    int ind_blks = newfs_indirect_sync_blks(newfs_super.max_data);
+
+    return 4 + dir_blks + (ext_blks > ind_blks ? ext_blks : ind_blks) + 2;
+}
+
+/**
+ * @brief 会改动元数据的操作开始前调用，调用时持有 newfs_super.lock（只持有一层）
+ * 一轮回写只提交一个事务：已有的改动、上一轮出错留下的事务加上这次操作最多的改动
+ * 可能放不下时先做一轮回写，事务总在两次操作之间结束，不会落在一次操作的中间
+ *
+ */
+void newfs_journal_reserve() {
+    struct newfs_journal* journal = NFS_JOURNAL();
+
+    if (newfs_sync_estimate() + journal->txn_cnt + newfs_journal_op_blks() <= journal->max_txn) {
+        return;
+    }
+    if (newfs_flush_round() != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] writeback error\n", __func__);
+    }
+}
+
+/**
+ * @brief 回写之外（没有事务也没有暂存区）的整块写入单独提交一个小事务：
+ * 块和它的校验表项一起进日志，崩溃后不会只有一个落盘、读出来永远校验不过
+ *
+ * @param blk 起始逻辑块号
+ * @param bufs 每个逻辑块对应的缓冲区
+ * @param blks 块数
+ * @return int
+ */
+int newfs_journal_write_now(int blk, uint8_t** bufs, int blks) {
+    int i, ret = NFS_ERROR_NONE;
+
+    newfs_journal_begin();
+    for (i = 0; i < blks && ret == NFS_ERROR_NONE; i++) {
+        ret = newfs_journal_add(blk + i, bufs[i], 1);
+    }
+    if (ret == NFS_ERROR_NONE) {
+        ret = newfs_csum_sync();
+    }
+    if (newfs_journal_commit() != NFS_ERROR_NONE) {     /* 暂存区不在收集，提交后立即写回原位 */
+        ret = -NFS_ERROR_IO;
+    }
+    return ret;
+}
+
+/**
+ * @brief 回写线程已把暂存区写盘，到目前为止提交的事务都已写回原位
+ *
+ */
+void newfs_journal_checkpointed() {
+    NFS_JOURNAL()->ckpt_seq = NFS_JOURNAL()->seq;
+}
+
+/**
+ * @brief 刚从设备读出的块如果在尚未提交的事务里，用事务中的内容覆盖
+ *
+ * @param blk 起始逻辑块号
+ * @param bufs 每个逻辑块对应的缓冲区
+ * @param blks 块数
+ */
+void newfs_journal_overlay(int blk, uint8_t** bufs, int blks) {
+    struct newfs_journal* journal = NFS_JOURNAL();
+    int j;
+
+    for (j = 0; j < journal->txn_cnt; j++) {
+        if (journal->txn_blks[j] >= blk && journal->txn_blks[j] < blk + blks) {
+            memcpy(bufs[journal->txn_blks[j] - blk], journal->txn_data[j], NFS_BLK_SZ());
+        }
+    }
+}
+
+/**
+ * @brief 卸载时调用，所有事务都已写回，更新日志头使下次挂载不必扫描
+ *
+ * @return int
+ */
+int newfs_journal_close() {
+    struct newfs_journal* journal = NFS_JOURNAL();
+    int i, ret = NFS_ERROR_NONE;
+
+    if (journal->dirty) {
+        ret = newfs_journal_write_head(journal->head);
+    }
+    for (i = 0; i < journal->max_txn; i++) {
+        free(journal->txn_data[i]);
+    }
+    free(journal->txn_data);
+    free(journal->txn_blks);
+    free(journal->replay_blks);
+    journal->txn_data    = NULL;
+    journal->txn_blks    = NULL;
+    journal->replay_blks = NULL;
+    return ret;
+}
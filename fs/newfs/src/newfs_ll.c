@@ -0,0 +1,701 @@
+#include "../include/newfs.h"
+#include "fuse_lowlevel.h"
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options newfs_options;
+
+static struct fuse_session* newfs_ll_se;                /* 挂载失败时用来结束会话 */
+
+/**
+ * @brief 内核用的 inode 号就是 inode 的地址，根目录除外
+ * 内核 forget 之前 inode 不会被释放，地址不会被别的文件重用
+ *
+ * @param ino
+ * @return struct newfs_inode*
+ */
+static struct newfs_inode* newfs_ll_inode(fuse_ino_t ino) {
+    if (ino == FUSE_ROOT_ID) {
+        return newfs_super.root_dentry->inode;
+    }
+    return (struct newfs_inode*)(uintptr_t)ino;
+}
+
+/**
+ * @brief 填充查找的回复，内核记住一次查找，调用时持有 newfs_super.lock
+ *
+ * @param inode 为NULL时回复不存在（负项也被内核缓存）
+ * @param e
+ */
+static void newfs_ll_entry(struct newfs_inode* inode, struct fuse_entry_param* e) {
+    memset(e, 0, sizeof(struct fuse_entry_param));
+    e->attr_timeout  = NFS_ATTR_TIMEOUT;
+    e->entry_timeout = NFS_ATTR_TIMEOUT;
+    if (inode == NULL) {
+        e->entry_timeout = NFS_NEG_TIMEOUT;
+        return;
+    }
+    newfs_inode_lookup(inode);
+    e->ino = (fuse_ino_t)(uintptr_t)inode;
+    newfs_inode_stat(inode, &e->attr);
+}
+
+/**
+ * @brief 在目录中按名字找到子文件并读入其 inode，调用时持有 newfs_super.lock
+ *
+ * @param dir
+ * @param name
+ * @param dentry 返回找到的目录项，没有时为NULL
+ * @return int 0成功（包括没有），读不出 inode 时 -NFS_ERROR_IO
+ */
+static int newfs_ll_find(struct newfs_inode* dir, const char* name, struct newfs_dentry** dentry) {
+    *dentry = NULL;
+    if (!NFS_IS_DIR(dir)) {
+        return NFS_ERROR_NONE;
+    }
+    *dentry = newfs_dir_find(dir, name, strlen(name));
+    if (*dentry && (*dentry)->inode == NULL) {
+        (*dentry)->inode = newfs_read_inode(*dentry, (*dentry)->ino);
+        if ((*dentry)->inode == NULL) {                 /* 目录项留着，下次再试 */
+            *dentry = NULL;
+            return -NFS_ERROR_IO;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 挂载，在会话开始处理请求之前调用
+ *
+ * @param userdata
+ * @param conn
+ */
+static void newfs_ll_init(void* userdata, struct fuse_conn_info* conn) {
+    (void)userdata;
+#if FUSE_VERSION >= 29
+    conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE);
+#else
+    (void)conn;
+#endif
+    if (newfs_mount(newfs_options) != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] mount error\n", __func__);
+        fuse_session_exit(newfs_ll_se);
+        return;
+    }
+    if (newfs_flusher_start() != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] flusher start error\n", __func__);
+    }
+    if (newfs_readahead_start() != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] readahead start error\n", __func__);
+    }
+}
+
+/**
+ * @brief 卸载
+ *
+ * @param userdata
+ */
+static void newfs_ll_destroy(void* userdata) {
+    (void)userdata;
+    newfs_readahead_stop();
+    newfs_flusher_stop();
+    if (newfs_umount() != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] unmount error\n", __func__);
+        return;
+    }
+    ddriver_close(newfs_super.driver_fd);
+}
+
+/**
+ * @brief 在目录中按名字查找，只查这一级，不解析路径
+ *
+ * @param req
+ * @param parent
+ * @param name
+ */
+static void newfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    struct fuse_entry_param e;
+    struct newfs_dentry* dentry;
+
+    NFS_LOCK();
+    if (newfs_ll_find(newfs_ll_inode(parent), name, &dentry) != NFS_ERROR_NONE) {
+        NFS_UNLOCK();
+        fuse_reply_err(req, NFS_ERROR_IO);
+        return;
+    }
+    newfs_ll_entry(dentry ? dentry->inode : NULL, &e);
+    NFS_UNLOCK();
+    fuse_reply_entry(req, &e);
+}
+
+/**
+ * @brief 内核丢掉若干次查找，已删除的文件由最后一次 forget 释放
+ *
+ * @param req
+ * @param ino
+ * @param nlookup
+ */
+static void newfs_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+    NFS_LOCK();
+    if (ino != FUSE_ROOT_ID) {
+        newfs_inode_forget(newfs_ll_inode(ino), nlookup);
+    }
+    NFS_UNLOCK();
+    fuse_reply_none(req);
+}
+
+#if FUSE_VERSION >= 29
+/**
+ * @brief 批量 forget，一次加锁处理
+ *
+ * @param req
+ * @param count
+ * @param forgets
+ */
+static void newfs_ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data* forgets) {
+    size_t i;
+
+    NFS_LOCK();
+    for (i = 0; i < count; i++) {
+        if (forgets[i].ino != FUSE_ROOT_ID) {
+            newfs_inode_forget(newfs_ll_inode(forgets[i].ino), forgets[i].nlookup);
+        }
+    }
+    NFS_UNLOCK();
+    fuse_reply_none(req);
+}
+#endif
+
+/**
+ * @brief 获取属性
+ *
+ * @param req
+ * @param ino
+ * @param fi 可忽略
+ */
+static void newfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    struct stat st;
+    (void)fi;
+
+    memset(&st, 0, sizeof(struct stat));
+    NFS_LOCK();
+    newfs_inode_stat(newfs_ll_inode(ino), &st);
+    NFS_UNLOCK();
+    fuse_reply_attr(req, &st, NFS_ATTR_TIMEOUT);
+}
+
+/**
+ * @brief 修改属性，支持改变文件大小和时间，其余忽略
+ *
+ * @param req
+ * @param ino
+ * @param attr
+ * @param to_set FUSE_SET_ATTR_*
+ * @param fi 可忽略
+ */
+static void newfs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr,
+                             int to_set, struct fuse_file_info* fi) {
+    struct newfs_inode* inode;
+    struct stat st;
+    struct timespec tv[2];
+    int ret = NFS_ERROR_NONE;
+    (void)fi;
+
+    memset(&st, 0, sizeof(struct stat));
+    NFS_LOCK();
+    newfs_journal_reserve();
+    inode = newfs_ll_inode(ino);
+    if (to_set & FUSE_SET_ATTR_SIZE) {
+        ret = NFS_IS_DIR(inode) ? -NFS_ERROR_ISDIR : newfs_inode_setsize(inode, attr->st_size);
+    }
+    if (ret == NFS_ERROR_NONE && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))) {
+        tv[0] = attr->st_atim;
+        tv[1] = attr->st_mtim;
+        if (!(to_set & FUSE_SET_ATTR_ATIME)) {
+            tv[0].tv_nsec = UTIME_OMIT;
+        }
+        if (!(to_set & FUSE_SET_ATTR_MTIME)) {
+            tv[1].tv_nsec = UTIME_OMIT;
+        }
+#ifdef FUSE_SET_ATTR_ATIME_NOW
+        if (to_set & FUSE_SET_ATTR_ATIME_NOW) {
+            tv[0].tv_nsec = UTIME_NOW;
+        }
+        if (to_set & FUSE_SET_ATTR_MTIME_NOW) {
+            tv[1].tv_nsec = UTIME_NOW;
+        }
+#endif
+        newfs_inode_set_times(inode, tv);
+    }
+    newfs_inode_stat(inode, &st);
+    NFS_UNLOCK();
+    if (ret != NFS_ERROR_NONE) {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+    fuse_reply_attr(req, &st, NFS_ATTR_TIMEOUT);
+}
+
+/**
+ * @brief 在目录中新建文件或目录
+ *
+ * @param req
+ * @param parent
+ * @param name
+ * @param ftype
+ */
+static void newfs_ll_create_entry(fuse_req_t req, fuse_ino_t parent, const char* name,
+                                  NFS_FILE_TYPE ftype) {
+    struct fuse_entry_param e;
+    struct newfs_inode*  dir;
+    struct newfs_dentry* dentry;
+    int ret = NFS_ERROR_NONE;
+
+    NFS_LOCK();
+    newfs_journal_reserve();
+    dir = newfs_ll_inode(parent);
+    if (!NFS_IS_DIR(dir)) {
+        ret = -NFS_ERROR_NOTDIR;
+    }
+    else if (dir->orphan) {
+        ret = -NFS_ERROR_NOTFOUND;                      /* 目录已被删除 */
+    }
+    else if (strlen(name) >= NFS_MAX_FILE_NAME) {
+        ret = -NFS_ERROR_NAMETOOLONG;
+    }
+    else if (newfs_dir_find(dir, name, strlen(name))) {
+        ret = -NFS_ERROR_EXISTS;
+    }
+    else {
+        dentry = new_dentry((char*)name, ftype);
+        dentry->parent = dir->dentry;
+        if (newfs_alloc_inode(dentry) == NULL) {
+            free(dentry);
+            ret = -NFS_ERROR_NOSPACE;
+        }
+        else {
+            newfs_alloc_dentry(dir, dentry);
+            newfs_ll_entry(dentry->inode, &e);
+        }
+    }
+    NFS_UNLOCK();
+    if (ret != NFS_ERROR_NONE) {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+    fuse_reply_entry(req, &e);
+}
+
+/**
+ * @brief 创建文件
+ *
+ * @param req
+ * @param parent
+ * @param name
+ * @param mode 只支持普通文件和目录
+ * @param rdev 可忽略
+ */
+static void newfs_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char* name,
+                           mode_t mode, dev_t rdev) {
+    (void)rdev;
+    if (S_ISREG(mode)) {
+        newfs_ll_create_entry(req, parent, name, NFS_REG_FILE);
+    }
+    else if (S_ISDIR(mode)) {
+        newfs_ll_create_entry(req, parent, name, NFS_DIR);
+    }
+    else {
+        fuse_reply_err(req, NFS_ERROR_UNSUPPORTED);
+    }
+}
+
+/**
+ * @brief 创建目录
+ *
+ * @param req
+ * @param parent
+ * @param name
+ * @param mode 可忽略
+ */
+static void newfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode) {
+    (void)mode;
+    newfs_ll_create_entry(req, parent, name, NFS_DIR);
+}
+
+/**
+ * @brief 删除文件或目录，目录连同其下所有文件一起删除（同 newfs_unlink）
+ * 内核还记着的文件成为孤儿，等 forget 后释放
+ *
+ * @param req
+ * @param parent
+ * @param name
+ */
+static void newfs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    struct newfs_inode*  dir;
+    struct newfs_dentry* dentry;
+    int ret = NFS_ERROR_NONE;
+
+    NFS_LOCK();
+    newfs_journal_reserve();
+    dir = newfs_ll_inode(parent);
+    ret = newfs_ll_find(dir, name, &dentry);            /* 读不出来的不删，免得错放它的块 */
+    if (ret == NFS_ERROR_NONE && dentry == NULL) {
+        ret = -NFS_ERROR_NOTFOUND;
+    }
+    else if (ret == NFS_ERROR_NONE) {
+        newfs_pcache_invalidate();                      /* 路径缓存只按路径记录，全部作废 */
+        newfs_drop_inode(dentry->inode);
+        newfs_drop_dentry(dir, dentry);
+        free(dentry);
+    }
+    NFS_UNLOCK();
+    fuse_reply_err(req, -ret);
+}
+
+/**
+ * @brief 删除目录
+ *
+ * @param req
+ * @param parent
+ * @param name
+ */
+static void newfs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    newfs_ll_unlink(req, parent, name);
+}
+
+/**
+ * @brief 重命名，目标已存在时失败（同 newfs_rename）
+ * inode 不变，只是换一个目录项，内核手里的 inode 号继续有效
+ *
+ * @param req
+ * @param parent
+ * @param name
+ * @param newparent
+ * @param newname
+ */
+static void newfs_ll_rename(fuse_req_t req, fuse_ino_t parent, const char* name,
+                            fuse_ino_t newparent, const char* newname) {
+    struct newfs_inode*  dir;
+    struct newfs_inode*  new_dir;
+    struct newfs_dentry* from_dentry;
+    struct newfs_dentry* to_dentry;
+    struct newfs_dentry* sub_dentry;
+    struct newfs_inode*  inode;
+    int ret = NFS_ERROR_NONE;
+
+    NFS_LOCK();
+    newfs_journal_reserve();
+    dir     = newfs_ll_inode(parent);
+    new_dir = newfs_ll_inode(newparent);
+    ret = newfs_ll_find(dir, name, &from_dentry);
+    if (ret != NFS_ERROR_NONE) {
+        goto out;
+    }
+    if (from_dentry == NULL) {
+        ret = -NFS_ERROR_NOTFOUND;
+        goto out;
+    }
+    if (!NFS_IS_DIR(new_dir)) {
+        ret = -NFS_ERROR_NOTDIR;
+        goto out;
+    }
+    if (new_dir->orphan) {
+        ret = -NFS_ERROR_NOTFOUND;
+        goto out;
+    }
+    if (strlen(newname) >= NFS_MAX_FILE_NAME) {
+        ret = -NFS_ERROR_NAMETOOLONG;
+        goto out;
+    }
+    to_dentry = newfs_dir_find(new_dir, newname, strlen(newname));
+    if (to_dentry) {
+        ret = to_dentry == from_dentry ? NFS_ERROR_NONE : -NFS_ERROR_EXISTS;
+        goto out;
+    }
+
+    newfs_pcache_invalidate();
+    inode = from_dentry->inode;
+    to_dentry = new_dentry((char*)newname, from_dentry->ftype);
+    to_dentry->parent = new_dir->dentry;
+    to_dentry->ino    = inode->ino;
+    to_dentry->inode  = inode;
+    inode->dentry     = to_dentry;
+    newfs_touch_ctime(inode);
+    for (sub_dentry = inode->dentrys; sub_dentry; sub_dentry = sub_dentry->brother) {
+        sub_dentry->parent = to_dentry;
+    }
+    newfs_drop_dentry(dir, from_dentry);
+    newfs_alloc_dentry(new_dir, to_dentry);
+    free(from_dentry);
+out:
+    NFS_UNLOCK();
+    fuse_reply_err(req, -ret);
+}
+
+/**
+ * @brief 打开文件或目录，句柄关闭前 inode 不会被释放
+ *
+ * @param req
+ * @param ino
+ * @param fi
+ */
+static void newfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    NFS_LOCK();
+    newfs_inode_open(newfs_ll_inode(ino));
+    NFS_UNLOCK();
+    fuse_reply_open(req, fi);
+}
+
+/**
+ * @brief 关闭文件或目录
+ *
+ * @param req
+ * @param ino
+ * @param fi
+ */
+static void newfs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    (void)fi;
+    NFS_LOCK();
+    newfs_inode_close(newfs_ll_inode(ino));
+    NFS_UNLOCK();
+    fuse_reply_err(req, 0);
+}
+
+#if FUSE_VERSION >= 29
+/**
+ * @brief 用文件块本身回复读请求，不经过中间缓冲区
+ *
+ * @param blks
+ * @param arg 读请求
+ * @return int 回复的字节数
+ */
+static int newfs_ll_reply_blks(struct fuse_bufvec* blks, void* arg) {
+    fuse_reply_data((fuse_req_t)arg, blks, 0);          /* 块还要留着用，不能 SPLICE_MOVE */
+    return (int)fuse_buf_size(blks);
+}
+
+/**
+ * @brief 读文件，直接把内存中的文件块交给内核
+ *
+ * @param req
+ * @param ino
+ * @param size
+ * @param off
+ * @param fi 可忽略
+ */
+static void newfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                          struct fuse_file_info* fi) {
+    struct newfs_inode* inode;
+    int ret;
+    (void)fi;
+
+    NFS_LOCK();
+    newfs_journal_reserve();
+    inode = newfs_ll_inode(ino);
+    ret = NFS_IS_DIR(inode) ? -NFS_ERROR_ISDIR : newfs_inode_read_buf(inode, size, off, newfs_ll_reply_blks, req);
+    NFS_UNLOCK();
+    if (ret < 0) {
+        fuse_reply_err(req, -ret);
+    }
+    else if (ret == 0) {
+        fuse_reply_buf(req, NULL, 0);                   /* 文件末尾 */
+    }
+}
+
+/**
+ * @brief 写文件，数据（splice 时是管道）直接拷进文件块
+ *
+ * @param req
+ * @param ino
+ * @param bufv
+ * @param off
+ * @param fi 可忽略
+ */
+static void newfs_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec* bufv,
+                               off_t off, struct fuse_file_info* fi) {
+    struct newfs_inode* inode;
+    int ret;
+    (void)fi;
+
+    NFS_LOCK();
+    newfs_journal_reserve();
+    inode = newfs_ll_inode(ino);
+    ret = NFS_IS_DIR(inode) ? -NFS_ERROR_ISDIR : newfs_inode_write_buf(inode, bufv, off);
+    NFS_UNLOCK();
+    if (ret < 0) {
+        fuse_reply_err(req, -ret);
+    }
+    else {
+        fuse_reply_write(req, ret);
+    }
+}
+#else
+/**
+ * @brief 读文件，读到的内容直接作为回复
+ *
+ * @param req
+ * @param ino
+ * @param size
+ * @param off
+ * @param fi 可忽略
+ */
+static void newfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                          struct fuse_file_info* fi) {
+    struct newfs_inode* inode;
+    char* buf = (char*)malloc(size);
+    int ret;
+    (void)fi;
+
+    NFS_LOCK();
+    newfs_journal_reserve();
+    inode = newfs_ll_inode(ino);
+    ret = NFS_IS_DIR(inode) ? -NFS_ERROR_ISDIR : newfs_inode_rw(inode, buf, size, off, FALSE);
+    NFS_UNLOCK();
+    if (ret < 0) {
+        fuse_reply_err(req, -ret);
+    }
+    else {
+        fuse_reply_buf(req, buf, ret);
+    }
+    free(buf);
+}
+#endif
+
+/**
+ * @brief 写文件
+ *
+ * @param req
+ * @param ino
+ * @param buf
+ * @param size
+ * @param off
+ * @param fi 可忽略
+ */
+static void newfs_ll_write(fuse_req_t req, fuse_ino_t ino, const char* buf, size_t size,
+                           off_t off, struct fuse_file_info* fi) {
+    struct newfs_inode* inode;
+    int ret;
+    (void)fi;
+
+    NFS_LOCK();
+    newfs_journal_reserve();
+    inode = newfs_ll_inode(ino);
+    ret = NFS_IS_DIR(inode) ? -NFS_ERROR_ISDIR : newfs_inode_rw(inode, (char*)buf, size, off, TRUE);
+    NFS_UNLOCK();
+    if (ret < 0) {
+        fuse_reply_err(req, -ret);
+    }
+    else {
+        fuse_reply_write(req, ret);
+    }
+}
+
+/**
+ * @brief 读目录，一次回复尽可能多的目录项，off 为 0、1 时是 . 和 ..，之后是第 off - 2 个目录项
+ *
+ * @param req
+ * @param ino
+ * @param size 回复缓冲区大小
+ * @param off
+ * @param fi 可忽略
+ */
+static void newfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                             struct fuse_file_info* fi) {
+    struct newfs_inode*  inode;
+    struct newfs_dentry* dentry;
+    struct stat st;
+    char*  buf = (char*)malloc(size);
+    size_t pos = 0, len;
+    (void)fi;
+
+    memset(&st, 0, sizeof(struct stat));
+    NFS_LOCK();
+    newfs_journal_reserve();
+    inode = newfs_ll_inode(ino);
+    if (!NFS_IS_DIR(inode)) {
+        NFS_UNLOCK();
+        free(buf);
+        fuse_reply_err(req, NFS_ERROR_NOTDIR);
+        return;
+    }
+    newfs_touch_atime(inode);
+    for (;; off++) {
+        if (off < 2) {                                  /* . 和 .. */
+            dentry = off == 0 || inode->dentry->parent == NULL ? inode->dentry : inode->dentry->parent;
+        }
+        else if ((dentry = newfs_get_dentry(inode, off - 2)) == NULL) {
+            break;
+        }
+        newfs_dentry_stat(dentry, &st);
+        len = fuse_add_direntry(req, buf + pos, size - pos, off < 2 ? (off == 0 ? "." : "..") : dentry->fname,
+                                &st, off + 1);
+        if (len > size - pos) {
+            break;                                      /* 放不下了，下次从这一项继续 */
+        }
+        pos += len;
+    }
+    NFS_UNLOCK();
+    fuse_reply_buf(req, buf, pos);
+    free(buf);
+}
+
+static struct fuse_lowlevel_ops newfs_ll_ops = {
+    .init       = newfs_ll_init,
+    .destroy    = newfs_ll_destroy,
+    .lookup     = newfs_ll_lookup,
+    .forget     = newfs_ll_forget,
+    .getattr    = newfs_ll_getattr,
+    .setattr    = newfs_ll_setattr,
+    .mknod      = newfs_ll_mknod,
+    .mkdir      = newfs_ll_mkdir,
+    .unlink     = newfs_ll_unlink,
+    .rmdir      = newfs_ll_rmdir,
+    .rename     = newfs_ll_rename,
+    .open       = newfs_ll_open,
+    .read       = newfs_ll_read,
+    .write      = newfs_ll_write,
+    .release    = newfs_ll_release,
+    .opendir    = newfs_ll_open,
+    .readdir    = newfs_ll_readdir,
+    .releasedir = newfs_ll_release,
+#if FUSE_VERSION >= 29
+    .forget_multi = newfs_ll_forget_multi,
+    .write_buf  = newfs_ll_write_buf,
+#endif
+};
+
+/**
+ * @brief 以低层接口挂载并处理请求直到卸载
+ *
+ * @param args 已去掉 newfs 自己的选项
+ * @return int 0成功，否则失败
+ */
+int newfs_ll_main(struct fuse_args* args) {
+    struct fuse_chan* ch;
+    char* mountpoint = NULL;
+    int   multithreaded, foreground, ret = -1;
+
+    if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1) {
+        return 1;
+    }
+    ch = fuse_mount(mountpoint, args);
+    if (ch == NULL) {
+        goto out;
+    }
+    newfs_ll_se = fuse_lowlevel_new(args, &newfs_ll_ops, sizeof(newfs_ll_ops), NULL);
+    if (newfs_ll_se != NULL) {
+        if (fuse_set_signal_handlers(newfs_ll_se) != -1) {
+            fuse_session_add_chan(newfs_ll_se, ch);
+#if FUSE_VERSION >= 28
+            fuse_daemonize(foreground);
+#endif
+            ret = multithreaded ? fuse_session_loop_mt(newfs_ll_se) : fuse_session_loop(newfs_ll_se);
+            fuse_remove_signal_handlers(newfs_ll_se);
+            fuse_session_remove_chan(ch);
+        }
+        fuse_session_destroy(newfs_ll_se);
+    }
+    fuse_unmount(mountpoint, ch);
+out:
+    free(mountpoint);
+    return ret ? 1 : 0;
+}
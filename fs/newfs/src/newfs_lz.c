@@ -0,0 +1,210 @@
+#include "../include/newfs.h"
+
+/*
+ * LZ77 类的快速压缩，格式与 LZ4 块格式相同：
+ * 每个序列是一个标记字节（高 4 位字面量长度，低 4 位匹配长度 - 4），
+ * 长度为 15 时后面跟若干字节续写（255 表示还有），然后是字面量、2 字节小端偏移；
+ * 最后一个序列只有字面量
+ */
+
+/**
+ * @brief 读 4 字节（不要求对齐）
+ *
+ * @param p
+ * @return uint32_t
+ */
+static uint32_t newfs_lz_read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief 4 字节内容的哈希
+ *
+ * @param v
+ * @return int
+ */
+static int newfs_lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - NFS_LZ_HASH_BITS);
+}
+
+/**
+ * @brief 写长度的续写字节
+ *
+ * @param op 输出位置，写完后前移
+ * @param end 输出缓冲区末尾
+ * @param len 减去标记中已记下的 15 之后的长度
+ * @return boolean 放不下时返回FALSE
+ */
+static boolean newfs_lz_put_len(uint8_t** op, uint8_t* end, int len) {
+    while (len >= 255) {
+        if (*op >= end) {
+            return FALSE;
+        }
+        *(*op)++ = 255;
+        len -= 255;
+    }
+    if (*op >= end) {
+        return FALSE;
+    }
+    *(*op)++ = len;
+    return TRUE;
+}
+
+/**
+ * @brief 写一个序列：字面量 [lit, lit + lit_len)，之后是距离 off、长度 match_len 的匹配
+ *
+ * @param op 输出位置，写完后前移
+ * @param end 输出缓冲区末尾
+ * @param lit
+ * @param lit_len
+ * @param off 最后一个序列为0
+ * @param match_len
+ * @return boolean 放不下时返回FALSE
+ */
+static boolean newfs_lz_put_seq(uint8_t** op, uint8_t* end, const uint8_t* lit, int lit_len,
+                                int off, int match_len) {
+    uint8_t* token = *op;
+    int      ml    = off ? match_len - NFS_LZ_MIN_MATCH : 0;
+
+    if (*op >= end) {
+        return FALSE;
+    }
+    *token = (lit_len < 15 ? lit_len : 15) << 4 | (ml < 15 ? ml : 15);
+    (*op)++;
+    if (lit_len >= 15 && !newfs_lz_put_len(op, end, lit_len - 15)) {
+        return FALSE;
+    }
+    if (end - *op < lit_len) {
+        return FALSE;
+    }
+    memcpy(*op, lit, lit_len);
+    *op += lit_len;
+    if (off == 0) {
+        return TRUE;
+    }
+    if (end - *op < 2) {
+        return FALSE;
+    }
+    *(*op)++ = off & 0xff;
+    *(*op)++ = off >> 8;
+    if (ml >= 15 && !newfs_lz_put_len(op, end, ml - 15)) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief 压缩
+ * 在哈希表里找最近一次出现相同 4 字节的位置，找不到匹配时步长逐渐加大，
+ * 压不动的数据很快扫完
+ *
+ * @param src
+ * @param len
+ * @param dst
+ * @param cap dst 的大小，压缩结果超过它时放弃
+ * @return int 压缩后的字节数，放不下时返回 -1
+ */
+int newfs_lz_compress(const uint8_t* src, int len, uint8_t* dst, int cap) {
+    int      tab[1 << NFS_LZ_HASH_BITS];
+    uint8_t* op  = dst;
+    uint8_t* end = dst + cap;
+    int ip = 0, anchor = 0, ref, h, match;
+
+    if (cap <= 0) {
+        return -1;
+    }
+    memset(tab, 0xff, sizeof(tab));
+    while (ip + NFS_LZ_MIN_MATCH <= len) {
+        h      = newfs_lz_hash(newfs_lz_read32(src + ip));
+        ref    = tab[h];
+        tab[h] = ip;
+        if (ref < 0 || ip - ref > 0xffff || newfs_lz_read32(src + ref) != newfs_lz_read32(src + ip)) {
+            ip += 1 + ((ip - anchor) >> 6);             /* 越久找不到匹配跳得越快 */
+            continue;
+        }
+        for (match = NFS_LZ_MIN_MATCH; ip + match < len && src[ref + match] == src[ip + match]; match++)
+            ;
+        if (!newfs_lz_put_seq(&op, end, src + anchor, ip - anchor, ip - ref, match)) {
+            return -1;
+        }
+        ip    += match;
+        anchor = ip;
+    }
+    if (!newfs_lz_put_seq(&op, end, src + anchor, len - anchor, 0, 0)) {
+        return -1;
+    }
+    return op - dst;
+}
+
+/**
+ * @brief 读长度的续写字节
+ *
+ * @param ip 输入位置，读完后前移
+ * @param end 输入末尾
+ * @param len 标记中的长度，为 15 时加上续写部分
+ * @return int 输入不完整时返回 -1
+ */
+static int newfs_lz_get_len(const uint8_t** ip, const uint8_t* end, int len) {
+    uint8_t b;
+
+    if (len < 15) {
+        return len;
+    }
+    do {
+        if (*ip >= end) {
+            return -1;
+        }
+        b = *(*ip)++;
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+/**
+ * @brief 解压，输入来自磁盘，所有长度和偏移都做检查
+ *
+ * @param src
+ * @param len
+ * @param dst
+ * @param cap dst 的大小
+ * @return int 解压后的字节数，数据损坏时返回 -1
+ */
+int newfs_lz_decompress(const uint8_t* src, int len, uint8_t* dst, int cap) {
+    const uint8_t* ip  = src;
+    const uint8_t* end = src + len;
+    uint8_t* op = dst;
+    int token, lit, match, off;
+
+    while (ip < end) {
+        token = *ip++;
+        lit   = newfs_lz_get_len(&ip, end, token >> 4);
+        if (lit < 0 || end - ip < lit || dst + cap - op < lit) {
+            return -1;
+        }
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == end) {
+            break;                                      /* 最后一个序列 */
+        }
+        if (end - ip < 2) {
+            return -1;
+        }
+        off = ip[0] | ip[1] << 8;
+        ip += 2;
+        match = newfs_lz_get_len(&ip, end, token & 0xf);
+        if (match < 0 || off == 0 || off > op - dst) {
+            return -1;
+        }
+        match += NFS_LZ_MIN_MATCH;
+        if (dst + cap - op < match) {
+            return -1;
+        }
+        for (; match > 0; match--, op++) {              /* 可能与自身重叠，逐字节拷贝 */
+            *op = op[-off];
+        }
+    }
+    return op - dst;
+}
@@ -0,0 +1,296 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options newfs_options;
+
+#define NFS_PCACHE_HASH(pcache, hash)   ((hash) & ((pcache)->nr_hash - 1))
+#define NFS_PCACHE_LRU(pcache, ent)     (&(pcache)->lru[(ent)->negative ? 1 : 0])
+
+/**
+ * @brief 将缓存项从所在的LRU链表中摘下
+ *
+ * @param lru
+ * @param ent
+ */
+static void newfs_pcache_lru_unlink(struct newfs_pcache_lru* lru, struct newfs_pcache_ent* ent) {
+    if (ent->lru_prev) {
+        ent->lru_prev->lru_next = ent->lru_next;
+    }
+    else {
+        lru->head = ent->lru_next;
+    }
+    if (ent->lru_next) {
+        ent->lru_next->lru_prev = ent->lru_prev;
+    }
+    else {
+        lru->tail = ent->lru_prev;
+    }
+    ent->lru_prev = NULL;
+    ent->lru_next = NULL;
+}
+
+/**
+ * @brief 将缓存项放到LRU链表头（最近使用）
+ *
+ * @param lru
+ * @param ent
+ */
+static void newfs_pcache_lru_push(struct newfs_pcache_lru* lru, struct newfs_pcache_ent* ent) {
+    ent->lru_prev = NULL;
+    ent->lru_next = lru->head;
+    if (lru->head) {
+        lru->head->lru_prev = ent;
+    }
+    lru->head = ent;
+    if (lru->tail == NULL) {
+        lru->tail = ent;
+    }
+}
+
+/**
+ * @brief 清空缓存项并移到正项LRU链表尾，下次插入时优先复用
+ *
+ * @param pcache
+ * @param ent
+ */
+static void newfs_pcache_release(struct newfs_pcache* pcache, struct newfs_pcache_ent* ent) {
+    struct newfs_pcache_lru*  lru  = &pcache->lru[0];
+    struct newfs_pcache_ent** link = &pcache->hash[NFS_PCACHE_HASH(pcache, ent->hash)];
+    while (*link) {
+        if (*link == ent) {
+            *link = ent->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    free(ent->path);
+    ent->path      = NULL;
+    ent->dentry    = NULL;
+    ent->hash_next = NULL;
+
+    newfs_pcache_lru_unlink(NFS_PCACHE_LRU(pcache, ent), ent);
+    if (ent->negative) {
+        ent->negative = FALSE;
+        pcache->nr_neg--;
+    }
+    ent->lru_prev = lru->tail;
+    if (lru->tail) {
+        lru->tail->lru_next = ent;
+    }
+    else {
+        lru->head = ent;
+    }
+    lru->tail = ent;
+}
+
+/**
+ * @brief 查找完整路径对应的缓存项，不区分是否失效
+ *
+ * @param pcache
+ * @param path
+ * @param len
+ * @param hash
+ * @return struct newfs_pcache_ent*
+ */
+static struct newfs_pcache_ent* newfs_pcache_find(struct newfs_pcache* pcache, const char* path,
+                                                  int len, uint32_t hash) {
+    struct newfs_pcache_ent* ent = pcache->hash[NFS_PCACHE_HASH(pcache, hash)];
+    while (ent) {
+        if (ent->hash == hash && ent->len == len && memcmp(ent->path, path, len) == 0) {
+            return ent;
+        }
+        ent = ent->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 缓存项是否仍然有效
+ * 负项还要求所在目录此后没有新增过目录项
+ *
+ * @param pcache
+ * @param ent
+ * @return boolean
+ */
+static boolean newfs_pcache_valid(struct newfs_pcache* pcache, struct newfs_pcache_ent* ent) {
+    if (ent->gen != pcache->gen) {
+        return FALSE;
+    }
+    return !ent->negative ||
+           (ent->dentry->inode != NULL && ent->dentry->inode->neg_gen == ent->neg_gen);
+}
+
+/**
+ * @brief 取一个缓存项并填入路径
+ * 负项超出预算时复用最久未用的负项，不挤占正项
+ *
+ * @param pcache
+ * @param path
+ * @param len
+ * @param negative
+ * @return struct newfs_pcache_ent* 出错返回NULL
+ */
+static struct newfs_pcache_ent* newfs_pcache_get(struct newfs_pcache* pcache, const char* path,
+                                                 int len, boolean negative) {
+    struct newfs_pcache_ent* ent;
+    uint32_t hash = newfs_name_hash(path, len);
+
+    ent = newfs_pcache_find(pcache, path, len, hash);
+    if (ent) {
+        newfs_pcache_release(pcache, ent);              /* 正负可能反转，重新放置 */
+    }
+    else {
+        ent = negative && pcache->nr_neg >= NFS_PCACHE_NEG_MAX ? pcache->lru[1].tail
+                                                               : pcache->lru[0].tail;
+        if (ent->path) {
+            newfs_pcache_release(pcache, ent);
+        }
+    }
+
+    ent->path = (char*)malloc(len);
+    if (ent->path == NULL) {
+        return NULL;
+    }
+    memcpy(ent->path, path, len);
+    ent->len  = len;
+    ent->hash = hash;
+    ent->gen  = pcache->gen;
+    ent->hash_next = pcache->hash[NFS_PCACHE_HASH(pcache, hash)];
+    pcache->hash[NFS_PCACHE_HASH(pcache, hash)] = ent;
+
+    newfs_pcache_lru_unlink(&pcache->lru[0], ent);
+    ent->negative = negative;
+    if (negative) {
+        pcache->nr_neg++;
+    }
+    newfs_pcache_lru_push(NFS_PCACHE_LRU(pcache, ent), ent);
+    return ent;
+}
+
+/**
+ * @brief 初始化路径缓存
+ *
+ * @param nr_ents 缓存项数
+ * @return int
+ */
+int newfs_pcache_init(int nr_ents) {
+    struct newfs_pcache* pcache = NFS_PCACHE();
+    int i;
+
+    memset(pcache, 0, sizeof(struct newfs_pcache));
+    pcache->nr_ents = nr_ents;
+    pcache->nr_hash = 1;
+    while (pcache->nr_hash < nr_ents) {
+        pcache->nr_hash <<= 1;
+    }
+    pcache->ents = (struct newfs_pcache_ent*)calloc(nr_ents, sizeof(struct newfs_pcache_ent));
+    pcache->hash = (struct newfs_pcache_ent**)calloc(pcache->nr_hash, sizeof(struct newfs_pcache_ent*));
+    if (pcache->ents == NULL || pcache->hash == NULL) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    for (i = 0; i < nr_ents; i++) {
+        newfs_pcache_lru_push(&pcache->lru[0], &pcache->ents[i]);
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 按完整路径查找 dentry
+ *
+ * @param path
+ * @param len
+ * @param is_neg 命中负项时置为 TRUE，此时返回的是查找停下的那个目录
+ * @return struct newfs_dentry* 未命中或已失效时返回NULL
+ */
+struct newfs_dentry* newfs_pcache_lookup(const char* path, int len, boolean* is_neg) {
+    struct newfs_pcache*     pcache = NFS_PCACHE();
+    struct newfs_pcache_ent* ent;
+
+    ent = newfs_pcache_find(pcache, path, len, newfs_name_hash(path, len));
+    if (ent == NULL || !newfs_pcache_valid(pcache, ent)) {
+        if (ent) {
+            newfs_pcache_release(pcache, ent);          /* 子树被删除或改名过，或目录里新建了文件 */
+        }
+        pcache->misses++;
+        return NULL;
+    }
+    if (ent->negative) {
+        pcache->neg_hits++;
+    }
+    else {
+        pcache->hits++;
+    }
+    *is_neg = ent->negative;
+    newfs_pcache_lru_unlink(NFS_PCACHE_LRU(pcache, ent), ent);
+    newfs_pcache_lru_push(NFS_PCACHE_LRU(pcache, ent), ent);
+    return ent->dentry;
+}
+
+/**
+ * @brief 记录完整路径对应的 dentry，缓存满时淘汰最久未使用的项
+ *
+ * @param path
+ * @param len
+ * @param dentry
+ */
+void newfs_pcache_insert(const char* path, int len, struct newfs_dentry* dentry) {
+    struct newfs_pcache_ent* ent = newfs_pcache_get(NFS_PCACHE(), path, len, FALSE);
+    if (ent) {
+        ent->dentry = dentry;
+    }
+}
+
+/**
+ * @brief 记录一条不存在的路径
+ *
+ * @param path
+ * @param len
+ * @param parent 查找停下的那个目录，该目录新增目录项后本项失效
+ */
+void newfs_pcache_insert_neg(const char* path, int len, struct newfs_dentry* parent) {
+    struct newfs_pcache_ent* ent = newfs_pcache_get(NFS_PCACHE(), path, len, TRUE);
+    if (ent) {
+        ent->dentry  = parent;
+        ent->neg_gen = parent->inode->neg_gen;
+    }
+}
+
+/**
+ * @brief 删除一条路径的缓存项，用于删除或改名普通文件
+ *
+ * @param path
+ */
+void newfs_pcache_forget(const char* path) {
+    struct newfs_pcache*     pcache = NFS_PCACHE();
+    struct newfs_pcache_ent* ent;
+    int len = strlen(path);
+
+    ent = newfs_pcache_find(pcache, path, len, newfs_name_hash(path, len));
+    if (ent) {
+        newfs_pcache_release(pcache, ent);
+    }
+}
+
+/**
+ * @brief 使全部缓存项失效，用于删除或改名目录（其下所有路径都可能变化）
+ * 只增加代数，各项在下次命中时才真正释放
+ *
+ */
+void newfs_pcache_invalidate() {
+    NFS_PCACHE()->gen++;
+}
+
+/**
+ * @brief 释放路径缓存
+ *
+ */
+void newfs_pcache_destroy() {
+    struct newfs_pcache* pcache = NFS_PCACHE();
+    int i;
+    for (i = 0; i < pcache->nr_ents; i++) {
+        free(pcache->ents[i].path);
+    }
+    free(pcache->ents);
+    free(pcache->hash);
+    memset(pcache, 0, sizeof(struct newfs_pcache));
+}
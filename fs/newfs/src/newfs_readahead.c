@@ -0,0 +1,206 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options newfs_options;
+
+/**
+ * @brief 读设备写入次数，调用时持有 newfs_super.lock
+ *
+ * @return uint32_t
+ */
+static uint32_t newfs_ra_wgen() {
+    uint32_t wgen;
+    pthread_mutex_lock(&newfs_super.dev_lock);
+    wgen = newfs_super.dev_wgen;
+    pthread_mutex_unlock(&newfs_super.dev_lock);
+    return wgen;
+}
+
+/**
+ * @brief 把设备上连续的一段块放进预读队列，队列满时放弃
+ *
+ * @param blk 起始逻辑块号
+ * @param cnt
+ */
+static void newfs_ra_queue(int blk, int cnt) {
+    struct newfs_ra* ra = NFS_RA();
+
+    if (ra->cnt == NFS_RA_QUEUE) {
+        ra->drops++;
+        return;
+    }
+    ra->reqs[(ra->head + ra->cnt) % NFS_RA_QUEUE].blk = blk;
+    ra->reqs[(ra->head + ra->cnt) % NFS_RA_QUEUE].cnt = cnt;
+    ra->cnt++;
+    pthread_cond_signal(&ra->cond);
+}
+
+/**
+ * @brief 为文件块 [start, end) 发起预读
+ * 已在内存或块缓存中的块、空洞都跳过，其余按设备位置切成若干次读，
+ * 相距不超过 NFS_RA_GAP_BLKS 的两段连同中间的块合成一次读（交错写成的文件很常见）
+ *
+ * @param inode
+ * @param start
+ * @param end
+ */
+static void newfs_ra_submit(struct newfs_inode* inode, int start, int end) {
+    int lblk, pblk, blk = -1, run = 0;
+
+    if (end > inode->blks) {
+        end = inode->blks;
+    }
+    for (lblk = start; lblk <= end; lblk++) {
+        pblk = -1;
+        if (lblk < end && inode->block_pointer[lblk] == NULL) {
+            pblk = newfs_bmap(inode, lblk, FALSE);
+            if (pblk >= 0 && newfs_cache_lookup(NFS_DATA_BLK(pblk))) {
+                pblk = -1;
+            }
+        }
+        if (run && pblk >= 0 && NFS_DATA_BLK(pblk) >= blk + run &&
+            NFS_DATA_BLK(pblk) <= blk + run + NFS_RA_GAP_BLKS) {
+            run = NFS_DATA_BLK(pblk) - blk + 1;
+            continue;
+        }
+        if (run) {
+            newfs_ra_queue(blk, run);
+        }
+        blk = pblk >= 0 ? NFS_DATA_BLK(pblk) : -1;
+        run = pblk >= 0 ? 1 : 0;
+    }
+}
+
+/**
+ * @brief 读文件前调用，识别顺序读并提前读入后面的块，调用时持有 newfs_super.lock
+ * 连续顺序读时窗口逐次翻倍直到上限，一旦跳读就收回窗口；
+ * 读到上一个窗口的开头时就发起下一个窗口，预读与读者消费重叠进行
+ *
+ * @param inode
+ * @param lblk 本次读的起始文件块
+ * @param blks 本次读的块数
+ */
+void newfs_readahead(struct newfs_inode* inode, int lblk, int blks) {
+    int end = lblk + blks;
+
+    if (!NFS_RA()->running) {
+        return;
+    }
+    if (lblk != inode->ra_next && lblk + 1 != inode->ra_next) {  /* 上次读到块中间时会重读这一块 */
+        inode->ra_size = 0;                             /* 跳读 */
+        inode->ra_next = end;
+        return;
+    }
+    inode->ra_next = end;
+    if (inode->ra_size == 0) {                          /* 开始一段顺序读 */
+        inode->ra_size = blks * 2 > NFS_RA_MIN_BLKS ? blks * 2 : NFS_RA_MIN_BLKS;
+        inode->ra_end  = end;
+        inode->ra_mark = end;
+    }
+    if (end < inode->ra_mark) {
+        return;
+    }
+    if (inode->ra_end < end) {
+        inode->ra_end = end;                            /* 读者追上了预读 */
+    }
+    if (inode->ra_size > newfs_options.ra_blks) {
+        inode->ra_size = newfs_options.ra_blks;
+    }
+    newfs_ra_submit(inode, inode->ra_end, inode->ra_end + inode->ra_size);
+    NFS_RA()->windows++;
+    inode->ra_mark  = inode->ra_end;
+    inode->ra_end  += inode->ra_size;
+    inode->ra_size *= 2;
+}
+
+/**
+ * @brief 预读线程：放锁读设备，再持锁把读到的块放进块缓存
+ * 读的同时设备被写过的，读到的可能是旧内容，整段丢弃
+ *
+ * @param arg
+ * @return void*
+ */
+static void* newfs_ra_worker(void* arg) {
+    struct newfs_ra*    ra = NFS_RA();
+    struct newfs_ra_req req;
+    uint8_t*  area;
+    uint8_t** bufs;
+    uint32_t  wgen;
+    int i, ret;
+    (void)arg;
+
+    NFS_LOCK();
+    while (!ra->stop) {
+        if (ra->cnt == 0) {
+            pthread_cond_wait(&ra->cond, &newfs_super.lock);
+            continue;
+        }
+        req = ra->reqs[ra->head];
+        ra->head = (ra->head + 1) % NFS_RA_QUEUE;
+        ra->cnt--;
+
+        area = (uint8_t*)malloc(NFS_BLKS_SZ(req.cnt));
+        bufs = (uint8_t**)malloc(req.cnt * sizeof(uint8_t*));
+        for (i = 0; i < req.cnt; i++) {
+            bufs[i] = area + NFS_BLKS_SZ(i);
+        }
+        wgen = newfs_ra_wgen();
+        NFS_UNLOCK();
+        ret = newfs_dev_readv(req.blk, bufs, req.cnt);
+        NFS_LOCK();
+        if (ret != NFS_ERROR_NONE || newfs_ra_wgen() != wgen) {
+            ra->discards += req.cnt;
+        }
+        else {
+            newfs_stage_overlay(req.blk, bufs, req.cnt);
+            for (i = 0; i < req.cnt; i++) {
+                if (newfs_csum_verify(req.blk + i, bufs + i, 1) == NFS_ERROR_NONE) {
+                    newfs_cache_insert(req.blk + i, bufs[i]);   /* 坏块留给前台读时报错 */
+                }
+            }
+            ra->blks += req.cnt;
+        }
+        free(bufs);
+        free(area);
+    }
+    NFS_UNLOCK();
+    return NULL;
+}
+
+/**
+ * @brief 启动预读线程
+ *
+ * @return int
+ */
+int newfs_readahead_start() {
+    struct newfs_ra* ra = NFS_RA();
+
+    memset(ra, 0, sizeof(struct newfs_ra));
+    if (newfs_options.ra_blks <= 0) {
+        return NFS_ERROR_NONE;
+    }
+    pthread_cond_init(&ra->cond, NULL);
+    if (pthread_create(&ra->thread, NULL, newfs_ra_worker, NULL) != 0) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    ra->running = TRUE;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 停止预读线程，队列中尚未开始的请求直接丢弃，调用时不持有 newfs_super.lock
+ *
+ */
+void newfs_readahead_stop() {
+    struct newfs_ra* ra = NFS_RA();
+
+    if (!ra->running) {
+        return;
+    }
+    NFS_LOCK();
+    ra->stop = TRUE;
+    ra->running = FALSE;
+    pthread_cond_signal(&ra->cond);
+    NFS_UNLOCK();
+    pthread_join(ra->thread, NULL);
+}
@@ -1,4 +1,5 @@
 #include "../include/newfs.h"
+#include <time.h>
 
 extern struct newfs_super      newfs_super; 
 extern struct custom_options newfs_options;
@@ -45,7 +46,126 @@ int newfs_calc_lvl(const char * path) {
 
 
 /**
- * @brief 驱动读
+ * @brief 直接从磁盘读取连续的逻辑块，不经过缓存
+ * 
+ * @param blk 起始逻辑块号
+ * @param out_content 缓冲区，至少 blks 个逻辑块大小
+ * @param blks 块数
+ * @return int 
+ */
+int newfs_dev_read(int blk, uint8_t *out_content, int blks) {
+    int      size = NFS_BLKS_SZ(blks);
+    uint8_t* cur  = out_content;
+    int      ret  = NFS_ERROR_NONE;
+    pthread_mutex_lock(&newfs_super.dev_lock);
+    newfs_super.dev_seeks++;
+    ddriver_seek(NFS_DRIVER(), NFS_BLKS_SZ(blk), SEEK_SET);
+    while (size != 0)
+    {
+        if (ddriver_read(NFS_DRIVER(), (char *)cur, NFS_IO_SZ()) < 0) {
+            ret = -NFS_ERROR_IO;
+            break;
+        }
+        cur  += NFS_IO_SZ();
+        size -= NFS_IO_SZ();
+    }
+    pthread_mutex_unlock(&newfs_super.dev_lock);
+    return ret;
+}
+
+/**
+ * @brief 直接向磁盘写入连续的逻辑块，不经过缓存
+ * 
+ * @param blk 起始逻辑块号
+ * @param in_content 
+ * @param blks 块数
+ * @return int 
+ */
+int newfs_dev_write(int blk, uint8_t *in_content, int blks) {
+    int      size = NFS_BLKS_SZ(blks);
+    uint8_t* cur  = in_content;
+    int      ret  = NFS_ERROR_NONE;
+    int      i;
+    pthread_mutex_lock(&newfs_super.dev_lock);
+    for (i = 0; i < blks; i++) {
+        newfs_stage_update(blk + i, in_content + NFS_BLKS_SZ(i));
+    }
+    newfs_super.dev_wgen++;                             /* 正在进行的预读作废 */
+    newfs_super.dev_seeks++;
+    newfs_super.dev_wblks += blks;
+    ddriver_seek(NFS_DRIVER(), NFS_BLKS_SZ(blk), SEEK_SET);
+    while (size != 0)
+    {
+        if (ddriver_write(NFS_DRIVER(), (char *)cur, NFS_IO_SZ()) < 0) {
+            ret = -NFS_ERROR_IO;
+            break;
+        }
+        cur  += NFS_IO_SZ();
+        size -= NFS_IO_SZ();
+    }
+    pthread_mutex_unlock(&newfs_super.dev_lock);
+    return ret;
+}
+
+/**
+ * @brief 一次寻道读取连续的逻辑块，分别放入 blks 个块缓冲区
+ * 
+ * @param blk 起始逻辑块号
+ * @param bufs 每个逻辑块对应的缓冲区
+ * @param blks 块数
+ * @return int 
+ */
+int newfs_dev_readv(int blk, uint8_t **bufs, int blks) {
+    int i, ofs;
+    int ret = NFS_ERROR_NONE;
+    pthread_mutex_lock(&newfs_super.dev_lock);
+    newfs_super.dev_seeks++;
+    ddriver_seek(NFS_DRIVER(), NFS_BLKS_SZ(blk), SEEK_SET);
+    for (i = 0; i < blks && ret == NFS_ERROR_NONE; i++) {
+        for (ofs = 0; ofs < NFS_BLK_SZ(); ofs += NFS_IO_SZ()) {
+            if (ddriver_read(NFS_DRIVER(), (char *)bufs[i] + ofs, NFS_IO_SZ()) < 0) {
+                ret = -NFS_ERROR_IO;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&newfs_super.dev_lock);
+    return ret;
+}
+
+/**
+ * @brief 一次寻道写入连续的逻辑块，内容来自 blks 个块缓冲区
+ * 
+ * @param blk 起始逻辑块号
+ * @param bufs 
+ * @param blks 块数
+ * @return int 
+ */
+int newfs_dev_writev(int blk, uint8_t **bufs, int blks) {
+    int i, ofs;
+    int ret = NFS_ERROR_NONE;
+    pthread_mutex_lock(&newfs_super.dev_lock);
+    for (i = 0; i < blks; i++) {
+        newfs_stage_update(blk + i, bufs[i]);
+    }
+    newfs_super.dev_wgen++;
+    newfs_super.dev_seeks++;
+    newfs_super.dev_wblks += blks;
+    ddriver_seek(NFS_DRIVER(), NFS_BLKS_SZ(blk), SEEK_SET);
+    for (i = 0; i < blks && ret == NFS_ERROR_NONE; i++) {
+        for (ofs = 0; ofs < NFS_BLK_SZ(); ofs += NFS_IO_SZ()) {
+            if (ddriver_write(NFS_DRIVER(), (char *)bufs[i] + ofs, NFS_IO_SZ()) < 0) {
+                ret = -NFS_ERROR_IO;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&newfs_super.dev_lock);
+    return ret;
+}
+
+/**
+ * @brief 驱动读，经过块缓存
  * 
  * @param offset 偏移量
  * @param out_content 缓冲区，用于存放读出的内容
@@ -53,75 +173,354 @@ int newfs_calc_lvl(const char * path) {
  * @return int 
  */
 int newfs_driver_read(int offset, uint8_t *out_content, int size) {
-    int      offset_aligned = NFS_ROUND_DOWN(offset, NFS_BLK_SZ());
-    int      bias           = offset - offset_aligned; // 计算对齐后的剩下的偏移量
-    int      size_aligned   = NFS_ROUND_UP((size + bias), NFS_BLK_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    // lseek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
+    int      blk  = offset / NFS_BLK_SZ();
+    int      bias = offset % NFS_BLK_SZ(); // 块内偏移
+    int      len;
+    struct newfs_buf* buf;
+
+    while (size > 0)
     {
-        // read(NFS_DRIVER(), cur, NFS_IO_SZ());
-        ddriver_read(NFS_DRIVER(), cur, NFS_IO_SZ());
-        cur          += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();   
+        buf = newfs_cache_get(blk, TRUE);
+        if (buf == NULL) {
+            return -NFS_ERROR_IO;
+        }
+        len = NFS_BLK_SZ() - bias < size ? NFS_BLK_SZ() - bias : size;
+        memcpy(out_content, buf->data + bias, len);
+        out_content += len;
+        size        -= len;
+        bias         = 0;
+        blk++;
     }
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
     return NFS_ERROR_NONE;
 }
 
 
+/**
+ * @brief 连续的整块内容作为一个小事务立即提交
+ * 
+ * @param blk 起始逻辑块号
+ * @param in_content 
+ * @param blks 块数
+ * @return int 
+ */
+static int newfs_driver_write_now(int blk, uint8_t *in_content, int blks) {
+    uint8_t** bufs = (uint8_t**)malloc(blks * sizeof(uint8_t*));
+    int i, ret;
+
+    for (i = 0; i < blks; i++) {
+        bufs[i] = in_content + NFS_BLKS_SZ(i);
+    }
+    ret = newfs_journal_write_now(blk, bufs, blks);
+    free(bufs);
+    return ret;
+}
+
 /**
  * @brief 驱动写
- * 照抄
+ * 完整覆盖的逻辑块直接从调用者缓冲区写盘，不读也不分配；
+ * 只有首尾不完整的块经过块缓存做读-改-写
+ * 
  * @param offset 
  * @param in_content 
  * @param size 
  * @return int 
  */
 int newfs_driver_write(int offset, uint8_t *in_content, int size) {
-    int      offset_aligned = NFS_ROUND_DOWN(offset, NFS_BLK_SZ());
-    int      bias           = offset - offset_aligned;
-    int      size_aligned   = NFS_ROUND_UP((size + bias), NFS_BLK_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    newfs_driver_read(offset_aligned, temp_content, size_aligned);
-    memcpy(temp_content + bias, in_content, size);
-    
-    // lseek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
+    int      blk  = offset / NFS_BLK_SZ();
+    int      bias = offset % NFS_BLK_SZ();
+    int      len, blks, i;
+    struct newfs_buf* buf;
+
+    while (size > 0)
     {
-        // write(NFS_DRIVER(), cur, NFS_IO_SZ());
-        ddriver_write(NFS_DRIVER(), cur, NFS_IO_SZ());
-        cur          += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();   
+        if (bias == 0 && size >= NFS_BLK_SZ()) {
+            blks = size / NFS_BLK_SZ();
+            for (i = 0; i < blks; i++) {
+                newfs_csum_update(blk + i, in_content + NFS_BLKS_SZ(i));
+            }
+            if (NFS_JOURNAL()->active) {                /* 元数据先进日志 */
+                if (newfs_journal_add(blk, in_content, blks) != NFS_ERROR_NONE) {
+                    return -NFS_ERROR_IO;
+                }
+            }
+            else if (NFS_STAGE()->active) {             /* 回写线程稍后统一写盘 */
+                newfs_stage_add(blk, in_content, blks);
+            }
+            else if (newfs_csum_covered(blk)) {         /* 回写之外：和校验表项一起提交 */
+                if (newfs_driver_write_now(blk, in_content, blks) != NFS_ERROR_NONE) {
+                    return -NFS_ERROR_IO;
+                }
+            }
+            else if (newfs_dev_write(blk, in_content, blks) != NFS_ERROR_NONE) {
+                return -NFS_ERROR_IO;
+            }
+            newfs_cache_refresh(blk, in_content, blks); /* 保持缓存副本一致 */
+            len = NFS_BLKS_SZ(blks);
+        }
+        else {
+            len = NFS_BLK_SZ() - bias < size ? NFS_BLK_SZ() - bias : size;
+            buf = newfs_cache_get(blk, TRUE);
+            if (buf == NULL) {
+                return -NFS_ERROR_IO;
+            }
+            memcpy(buf->data + bias, in_content, len);
+            newfs_cache_dirty(buf);
+            blks = 1;
+        }
+        in_content += len;
+        size       -= len;
+        bias        = 0;
+        blk        += blks;
+    }
+    return NFS_ERROR_NONE;
+}
+
+
+
+/**
+ * @brief 按块读取连续的逻辑块
+ * 已在缓存中的块直接拷贝，其余连续未命中的块合并成一次设备读
+ * 
+ * @param blk 起始逻辑块号
+ * @param bufs 每个逻辑块对应的缓冲区
+ * @param blks 块数
+ * @return int 
+ */
+int newfs_driver_read_blks(int blk, uint8_t **bufs, int blks) {
+    struct newfs_buf* buf;
+    int i, run = 0;
+
+    for (i = 0; i <= blks; i++) {
+        buf = i < blks ? newfs_cache_lookup(blk + i) : NULL;
+        if (i < blks && buf == NULL) {
+            run++;
+            continue;
+        }
+        if (run) {
+            if (newfs_dev_readv(blk + i - run, bufs + i - run, run) != NFS_ERROR_NONE) {
+                return -NFS_ERROR_IO;
+            }
+            newfs_stage_overlay(blk + i - run, bufs + i - run, run);
+            if (newfs_csum_verify(blk + i - run, bufs + i - run, run) != NFS_ERROR_NONE) {
+                return -NFS_ERROR_IO;
+            }
+        }
+        run = 0;
+        if (buf) {
+            memcpy(bufs[i], buf->data, NFS_BLK_SZ());
+        }
     }
+    return NFS_ERROR_NONE;
+}
 
-    free(temp_content);
+/**
+ * @brief 按块写入连续的逻辑块，一次寻道直接写盘
+ * 
+ * @param blk 起始逻辑块号
+ * @param bufs 
+ * @param blks 块数
+ * @return int 
+ */
+int newfs_driver_write_blks(int blk, uint8_t **bufs, int blks) {
+    int i;
+    for (i = 0; i < blks; i++) {
+        newfs_csum_update(blk + i, bufs[i]);
+    }
+    if (NFS_STAGE()->active) {
+        for (i = 0; i < blks; i++) {
+            newfs_stage_add(blk + i, bufs[i], 1);
+        }
+    }
+    else if (newfs_csum_covered(blk)) {                 /* 回写之外：和校验表项一起提交 */
+        if (newfs_journal_write_now(blk, bufs, blks) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+    }
+    else if (newfs_dev_writev(blk, bufs, blks) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    for (i = 0; i < blks; i++) {
+        newfs_cache_refresh(blk + i, bufs[i], 1);
+    }
     return NFS_ERROR_NONE;
 }
 
+/**
+ * @brief 标记 inode 有改动，第一次变脏时挂到脏 inode 链表上
+ * 
+ * @param inode 
+ * @param flags NFS_DIRTY_*
+ */
+void newfs_mark_dirty(struct newfs_inode* inode, flag16 flags) {
+    if (inode->orphan) {
+        return;                                         /* 已经删除，只是还开着 */
+    }
+    if (!inode->dirty) {
+        inode->dirty_prev = NULL;
+        inode->dirty_next = newfs_super.dirty_head;
+        if (newfs_super.dirty_head) {
+            newfs_super.dirty_head->dirty_prev = inode;
+        }
+        newfs_super.dirty_head = inode;
+        newfs_super.dirty_blks++;                       /* inode 块本身 */
+        newfs_flusher_kick();
+    }
+    inode->dirty |= flags;
+}
+
+/**
+ * @brief 当前时间
+ * 
+ * @return uint64_t 纳秒
+ */
+static uint64_t newfs_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * NFS_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * @brief 文件内容或目录项有改变，更新 mtime 和 ctime
+ * 
+ * @param inode 
+ */
+static void newfs_touch_mtime(struct newfs_inode* inode) {
+    inode->mtime = newfs_now();
+    inode->ctime = inode->mtime;
+    newfs_mark_dirty(inode, NFS_DIRTY_INODE);
+}
+
+/**
+ * @brief inode 本身有改变（改名、改时间），更新 ctime，调用时持有 newfs_super.lock
+ * 
+ * @param inode 
+ */
+void newfs_touch_ctime(struct newfs_inode* inode) {
+    inode->ctime = newfs_now();
+    newfs_mark_dirty(inode, NFS_DIRTY_INODE);
+}
+
+/**
+ * @brief 读文件或目录后按 relatime 规则更新 atime，调用时持有 newfs_super.lock
+ * 只有 atime 不晚于 mtime / ctime，或已经超过一天没更新时才写，只读负载不必每次都写 inode
+ * 
+ * @param inode 
+ */
+void newfs_touch_atime(struct newfs_inode* inode) {
+    uint64_t now = newfs_now();
+
+    if (inode->atime > inode->mtime && inode->atime > inode->ctime &&
+        now < inode->atime + NFS_RELATIME_SEC * NFS_NSEC_PER_SEC) {
+        return;
+    }
+    inode->atime = now;
+    newfs_mark_dirty(inode, NFS_DIRTY_INODE);
+}
+
+/**
+ * @brief 按 utimens 的约定设置 atime 和 mtime，调用时持有 newfs_super.lock
+ * 
+ * @param inode 
+ * @param tv atime、mtime，tv_nsec 可以是 UTIME_NOW 或 UTIME_OMIT
+ */
+void newfs_inode_set_times(struct newfs_inode* inode, const struct timespec tv[2]) {
+    uint64_t  now = newfs_now();
+    uint64_t* times[2] = { &inode->atime, &inode->mtime };
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (tv[i].tv_nsec == UTIME_OMIT) {
+            continue;
+        }
+        *times[i] = tv[i].tv_nsec == UTIME_NOW ? now
+                                               : (uint64_t)tv[i].tv_sec * NFS_NSEC_PER_SEC + tv[i].tv_nsec;
+    }
+    inode->ctime = now;
+    newfs_mark_dirty(inode, NFS_DIRTY_INODE);
+}
+
+/**
+ * @brief 标记文件的一个数据块为脏
+ * 
+ * @param inode 
+ * @param lblk 
+ */
+static void newfs_mark_blk_dirty(struct newfs_inode* inode, int lblk) {
+    if (!inode->blk_dirty[lblk]) {
+        inode->blk_dirty[lblk] = TRUE;
+        newfs_super.dirty_blks++;
+        newfs_flusher_kick();
+    }
+}
+
+/**
+ * @brief 标记目录从第 blk 个目录块起需要重写
+ * 
+ * @param inode 
+ * @param blk 
+ */
+static void newfs_mark_dir_dirty(struct newfs_inode* inode, int blk) {
+    if (!(inode->dirty & NFS_DIRTY_DIR) || blk < inode->dir_dirty_from) {
+        inode->dir_dirty_from = blk;
+    }
+    newfs_mark_dirty(inode, NFS_DIRTY_DIR | NFS_DIRTY_INODE);
+}
 
+/**
+ * @brief 清除脏标志并从脏 inode 链表上摘下
+ * 
+ * @param inode 
+ */
+static void newfs_mark_clean(struct newfs_inode* inode) {
+    if (!inode->dirty) {
+        return;
+    }
+    if (inode->dirty_prev) {
+        inode->dirty_prev->dirty_next = inode->dirty_next;
+    }
+    else {
+        newfs_super.dirty_head = inode->dirty_next;
+    }
+    if (inode->dirty_next) {
+        inode->dirty_next->dirty_prev = inode->dirty_prev;
+    }
+    inode->dirty_prev = NULL;
+    inode->dirty_next = NULL;
+    inode->dirty      = 0;
+}
 
 /**
- * @brief 为一个inode分配dentry的bro，采用头插法
+ * @brief 把 dentry 尾插到目录的链表和哈希表里，只改内存结构，
+ * 从盘上读入目录时使用，不动时间戳也不标脏
  * 
  * @param inode 
  * @param dentry 
- * @return int 
  */
-int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+static void newfs_link_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    dentry->brother = NULL;
     if (inode->dentrys == NULL) {
         inode->dentrys = dentry;
     }
     else {
-        dentry->brother = inode->dentrys;
-        inode->dentrys = dentry;
+        inode->dentrys_tail->brother = dentry;
     }
+    inode->dentrys_tail = dentry;
     inode->dir_cnt++;
+    newfs_dir_hash_insert(inode, dentry);
+}
+
+/**
+ * @brief 为一个inode分配dentry的bro，采用尾插法，保持插入顺序
+ * 
+ * @param inode 
+ * @param dentry 
+ * @return int 
+ */
+int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    newfs_link_dentry(inode, dentry);
+    inode->neg_gen++;                                   /* 该目录下缓存的不存在路径可能已经存在了 */
+    newfs_mark_dir_dirty(inode, (inode->dir_cnt - 1) / NFS_DENTRY_PER_BLK());
+    newfs_touch_mtime(inode);
     return inode->dir_cnt;
 }
 
@@ -135,15 +534,18 @@ int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
 int newfs_drop_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry) {
     boolean is_find = FALSE;
     struct newfs_dentry* dentry_cursor;
+    int pos = 0;                                        /* dentry 在目录中的序号 */
     dentry_cursor = inode->dentrys;
     
     if (dentry_cursor == dentry) {
         inode->dentrys = dentry->brother;
+        dentry_cursor = NULL;
         is_find = TRUE;
     }
     else {
         while (dentry_cursor)
         {
+            pos++;
             if (dentry_cursor->brother == dentry) {
                 dentry_cursor->brother = dentry->brother;
                 is_find = TRUE;
@@ -155,101 +557,1009 @@ int newfs_drop_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry)
     if (!is_find) {
         return -NFS_ERROR_NOTFOUND;
     }
-    inode->dir_cnt--;
-    return inode->dir_cnt;
+    if (inode->dentrys_tail == dentry) {
+        inode->dentrys_tail = dentry_cursor;            /* 前驱成为新的尾 */
+    }
+    newfs_dir_hash_remove(inode, dentry);
+    inode->rd_cursor = NULL;                            /* 序号变了 */
+    newfs_mark_dir_dirty(inode, pos / NFS_DENTRY_PER_BLK()); /* 后面的目录项都前移了 */
+    newfs_touch_mtime(inode);
+    inode->dir_cnt--;
+    return inode->dir_cnt;
+}
+
+/**
+ * @brief 新建一个索引
+ * 
+ * @param dentry 要分配索引的dentry
+ * @return newfs_inode 空间不足时返回NULL，新的普通文件先内联存放数据
+ */
+struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
+    struct newfs_inode* inode;
+    int ino;
+
+    // 从索引位图中取空闲
+    ino = newfs_bitmap_alloc(&newfs_super.inode_bmap);
+    if (ino < 0)
+        return NULL;
+
+    // 分配一个 inode，数据块在写入时再按需分配
+    inode = (struct newfs_inode*)calloc(1, sizeof(struct newfs_inode));
+    pthread_rwlock_init(&inode->rwlock, NULL);
+    inode->ino  = ino; 
+    inode->size = 0;
+    inode->atime = newfs_now();
+    inode->mtime = inode->atime;
+    inode->ctime = inode->atime;
+
+    /* dentry指向inode */
+    dentry->inode = inode;
+    dentry->ino   = inode->ino;
+    
+    /* inode指回dentry */
+    inode->dentry = dentry;
+    
+    inode->dir_cnt = 0;
+    inode->dentrys = NULL;
+
+    inode->map_mode = newfs_options.indirect ? NFS_MAP_INDIRECT : NFS_MAP_EXTENT;
+    memset(inode->bno, 0xff, sizeof(inode->bno));
+    inode->ind.bno  = -1;
+    inode->dind.bno = -1;
+    inode->inline_data = dentry->ftype == NFS_REG_FILE;
+    inode->compress    = dentry->ftype == NFS_REG_FILE && newfs_options.compress;
+    newfs_mark_dirty(inode, NFS_DIRTY_INODE);
+    return inode;
+}
+
+/**
+ * @brief 将文件逻辑块映射到数据块
+ * 
+ * @param inode 
+ * @param lblk 文件逻辑块号
+ * @param create 未映射时是否分配
+ * @return int 数据块号，未映射或空间不足时返回 -1
+ */
+int newfs_bmap(struct newfs_inode* inode, int lblk, boolean create) {
+    if (inode->inline_data) {
+        return -1;                                      /* 数据在 inode 块中 */
+    }
+    if (inode->map_mode == NFS_MAP_INDIRECT) {
+        return newfs_indirect_bmap(inode, lblk, create);
+    }
+    return newfs_extent_bmap(inode, lblk, create);
+}
+
+/**
+ * @brief 解除文件逻辑块的映射并释放数据块，压缩的簇用它空出后面的块
+ * 
+ * @param inode 
+ * @param lblk 
+ * @return int 
+ */
+int newfs_bunmap(struct newfs_inode* inode, int lblk) {
+    newfs_mark_dirty(inode, NFS_DIRTY_INODE);
+    if (inode->map_mode == NFS_MAP_INDIRECT) {
+        return newfs_indirect_unmap(inode, lblk);
+    }
+    return newfs_extent_unmap(inode, lblk);
+}
+
+/**
+ * @brief 把文件逻辑块改映射到指定的数据块，去重和写时复制用它换块
+ * 
+ * @param inode 
+ * @param lblk 
+ * @param pblk 已分配的数据块
+ * @return int 
+ */
+int newfs_bmap_set(struct newfs_inode* inode, int lblk, int pblk) {
+    newfs_mark_dirty(inode, NFS_DIRTY_INODE);
+    if (inode->map_mode == NFS_MAP_INDIRECT) {
+        return newfs_indirect_set(inode, lblk, pblk);
+    }
+    return newfs_extent_set(inode, lblk, pblk);
+}
+
+/**
+ * @brief 释放文件逻辑块号不小于 blks 的数据块
+ * 
+ * @param inode 
+ * @param blks 保留的块数
+ */
+static void newfs_map_truncate(struct newfs_inode* inode, int blks) {
+    newfs_mark_dirty(inode, NFS_DIRTY_INODE);
+    if (inode->map_mode == NFS_MAP_INDIRECT) {
+        newfs_indirect_truncate(inode, blks);
+    }
+    else {
+        newfs_extent_truncate(inode, blks);
+    }
+}
+
+/**
+ * @brief 从磁盘 inode 读入块映射
+ * 
+ * @param inode 
+ * @param inode_d 
+ * @return int 
+ */
+static int newfs_map_load(struct newfs_inode* inode, struct newfs_inode_d* inode_d) {
+    inode->map_mode = inode_d->map_mode;
+    if (inode->map_mode == NFS_MAP_INDIRECT) {
+        return newfs_indirect_load(inode, inode_d);
+    }
+    return newfs_extent_load(inode, inode_d);
+}
+
+/**
+ * @brief 将块映射写入磁盘 inode
+ * 
+ * @param inode 
+ * @param inode_d 
+ * @return int 
+ */
+static int newfs_map_sync(struct newfs_inode* inode, struct newfs_inode_d* inode_d) {
+    inode_d->map_mode = inode->map_mode;
+    if (inode->map_mode == NFS_MAP_INDIRECT) {
+        return newfs_indirect_sync(inode, inode_d);
+    }
+    return newfs_extent_sync(inode, inode_d);
+}
+
+/**
+ * @brief 有 blks 个数据块时写回映射最多写几个映射块
+ * 
+ * @param inode 
+ * @param blks 
+ * @return int 
+ */
+static int newfs_map_sync_blks(struct newfs_inode* inode, int blks) {
+    if (inode->map_mode == NFS_MAP_INDIRECT) {
+        return newfs_indirect_sync_blks(blks);
+    }
+    return newfs_extent_sync_blks(blks);
+}
+
+/**
+ * @brief 释放 inode 的全部数据块及映射本身
+ * 
+ * @param inode 
+ */
+static void newfs_map_free(struct newfs_inode* inode) {
+    if (inode->map_mode == NFS_MAP_INDIRECT) {
+        newfs_indirect_free(inode);
+    }
+    else {
+        newfs_extent_free(inode);
+    }
+}
+
+/**
+ * @brief 压缩文件按簇写回，有脏块的簇整簇重新压缩
+ * 
+ * @param inode 
+ * @param start 起始文件逻辑块号
+ * @param blks 块数
+ * @return int 
+ */
+static int newfs_inode_writeback_packed(struct newfs_inode* inode, int start, int blks) {
+    int clu, lblk, end, ret;
+
+    for (clu = start / NFS_COMP_CLUSTER_BLKS; clu * NFS_COMP_CLUSTER_BLKS < start + blks; clu++) {
+        lblk = clu * NFS_COMP_CLUSTER_BLKS;
+        end  = lblk + NFS_COMP_CLUSTER_BLKS < inode->blks ? lblk + NFS_COMP_CLUSTER_BLKS : inode->blks;
+        while (lblk < end && !inode->blk_dirty[lblk]) {
+            lblk++;
+        }
+        if (lblk == end) {
+            continue;
+        }
+        ret = newfs_comp_write(inode, clu);
+        if (ret != NFS_ERROR_NONE) {
+            return ret;
+        }
+        lblk = clu * NFS_COMP_CLUSTER_BLKS;
+        memset(inode->blk_dirty + lblk, 0, end - lblk);
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 在 [start, start + blks) 范围内写回脏块，映射到连续数据块的合并成一次设备写，
+ * 写完清除脏标志。每块写之前先经过去重表，可能改为共享已有块或换到新块；
+ * 开启去重时逐块写出，后面的块比较内容时才能读到前面刚写的块
+ * （回写时进入暂存区，写盘时仍按块号合并）
+ * 
+ * @param inode 
+ * @param start 起始文件逻辑块号
+ * @param blks 块数
+ * @return int 
+ */
+static int newfs_inode_writeback(struct newfs_inode* inode, int start, int blks) {
+    int lblk = start, run, pblk, ret;
+
+    if (inode->compress) {
+        return newfs_inode_writeback_packed(inode, start, blks);
+    }
+
+    while (lblk < start + blks) {
+        if (!inode->blk_dirty[lblk] || newfs_bmap(inode, lblk, FALSE) < 0) {   /* 空洞或不需要写 */
+            lblk++;
+            continue;
+        }
+        ret = newfs_dedup_block(inode, lblk);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret > 0) {                                  /* 与已有块共享 */
+            inode->blk_dirty[lblk] = FALSE;
+            lblk++;
+            continue;
+        }
+        pblk = newfs_bmap(inode, lblk, FALSE);
+        for (run = 1; !newfs_options.dedup && lblk + run < start + blks; run++) {
+            if (!inode->blk_dirty[lblk + run] ||
+                newfs_bmap(inode, lblk + run, FALSE) != pblk + run)
+                break;
+            ret = newfs_dedup_block(inode, lblk + run);     /* 不去重时只会写时复制，不会重复处理 */
+            if (ret < 0) {
+                return ret;
+            }
+            if (newfs_bmap(inode, lblk + run, FALSE) != pblk + run)
+                break;
+        }
+        ret = newfs_driver_write_blks(NFS_DATA_BLK(pblk), inode->block_pointer + lblk, run);
+        if (ret != NFS_ERROR_NONE) {
+            return ret;
+        }
+        memset(inode->blk_dirty + lblk, 0, run);
+        lblk += run;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将文件从常驻链表上摘下
+ * 
+ * @param inode 
+ */
+static void newfs_res_unlink(struct newfs_inode* inode) {
+    if (inode->res_prev == NULL && newfs_super.res_head != inode) {
+        return;                                         /* 不在链表上 */
+    }
+    if (inode->res_prev) {
+        inode->res_prev->res_next = inode->res_next;
+    }
+    else {
+        newfs_super.res_head = inode->res_next;
+    }
+    if (inode->res_next) {
+        inode->res_next->res_prev = inode->res_prev;
+    }
+    else {
+        newfs_super.res_tail = inode->res_prev;
+    }
+    inode->res_prev = NULL;
+    inode->res_next = NULL;
+}
+
+/**
+ * @brief 将文件放到常驻链表头（最近访问）
+ * 
+ * @param inode 
+ */
+static void newfs_res_touch(struct newfs_inode* inode) {
+    if (newfs_super.res_head == inode) {
+        return;
+    }
+    newfs_res_unlink(inode);
+    inode->res_next = newfs_super.res_head;
+    if (newfs_super.res_head) {
+        newfs_super.res_head->res_prev = inode;
+    }
+    newfs_super.res_head = inode;
+    if (newfs_super.res_tail == NULL) {
+        newfs_super.res_tail = inode;
+    }
+}
+
+/**
+ * @brief 释放文件在内存中的第 lblk 个数据块
+ * 
+ * @param inode 
+ * @param lblk 
+ */
+static void newfs_res_drop(struct newfs_inode* inode, int lblk) {
+    if (inode->block_pointer[lblk] == NULL) {
+        return;
+    }
+    free(inode->block_pointer[lblk]);
+    inode->block_pointer[lblk] = NULL;
+    inode->blks_loaded--;
+    newfs_super.res_blks--;
+}
+
+/**
+ * @brief 内存中的文件数据块超过上限时，从最久未访问的文件开始释放干净块，
+ * 脏块要等写回之后才能淘汰，别的操作正在读写的文件也跳过（可能正在放锁拷贝）
+ * 
+ * @param keep 正在访问的文件
+ * @param start keep 中正在访问的范围，不能淘汰
+ * @param blks 
+ */
+static void newfs_res_shrink(struct newfs_inode* keep, int start, int blks) {
+    struct newfs_inode* inode = newfs_super.res_tail;
+    struct newfs_inode* prev;
+    int lblk;
+
+    if (newfs_options.file_blks <= 0) {
+        return;
+    }
+    while (inode && newfs_super.res_blks > newfs_options.file_blks) {
+        prev = inode->res_prev;
+        if (inode->ref > (inode == keep ? 1 : 0)) {
+            inode = prev;
+            continue;
+        }
+        for (lblk = 0; lblk < inode->blks && newfs_super.res_blks > newfs_options.file_blks; lblk++) {
+            if (inode->block_pointer[lblk] == NULL || inode->blk_dirty[lblk] ||
+                (inode == keep && lblk >= start && lblk < start + blks)) {
+                continue;
+            }
+            newfs_res_drop(inode, lblk);
+            newfs_super.evicts++;
+        }
+        if (inode->blks_loaded == 0) {
+            newfs_res_unlink(inode);
+        }
+        inode = prev;
+    }
+}
+
+/**
+ * @brief 把内联数据读进内存，成为文件的第 0 块
+ * 
+ * @param inode 内联存放且第 0 块不在内存中
+ * @param inode_blk 已读出的 inode 块，NULL 时从块缓存读
+ * @return int 
+ */
+static int newfs_inline_load(struct newfs_inode* inode, uint8_t* inode_blk) {
+    uint8_t* blk = (uint8_t*)calloc(1, NFS_BLK_SZ());
+
+    if (inode_blk) {
+        memcpy(blk, inode_blk + sizeof(struct newfs_inode_d), inode->size);
+    }
+    else if (newfs_driver_read(NFS_INO_OFS(inode->ino) + sizeof(struct newfs_inode_d),
+                               blk, inode->size) != NFS_ERROR_NONE) {
+        free(blk);
+        return -NFS_ERROR_IO;
+    }
+    inode->block_pointer[0] = blk;
+    inode->blks_loaded++;
+    newfs_super.res_blks++;
+    newfs_res_touch(inode);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 缺块是否需要从盘上读入：读时都要，写时只有没被整块覆盖的要
+ * 
+ * @param lblk 
+ * @param offset 
+ * @param size 
+ * @param is_write 
+ * @return boolean 
+ */
+static boolean newfs_fault_fill(int lblk, int offset, int size, boolean is_write) {
+    return !is_write || offset > NFS_BLKS_SZ(lblk) || offset + size < NFS_BLKS_SZ(lblk + 1);
+}
+
+/**
+ * @brief 读入压缩存放的一簇：缺的块都解压出来留在内存中，写时被整块覆盖的只分配
+ * 
+ * @param inode 
+ * @param clu 
+ * @param offset 
+ * @param size 
+ * @param is_write 
+ * @return int 
+ */
+static int newfs_inode_fault_packed(struct newfs_inode* inode, int clu, int offset, int size, boolean is_write) {
+    uint8_t* bufs[NFS_COMP_CLUSTER_BLKS] = { NULL };
+    int base = clu * NFS_COMP_CLUSTER_BLKS, lblk, fill = 0;
+
+    for (lblk = base; lblk < base + NFS_COMP_CLUSTER_BLKS && lblk < inode->blks; lblk++) {
+        if (inode->block_pointer[lblk]) {
+            continue;
+        }
+        inode->block_pointer[lblk] = (uint8_t*)calloc(1, NFS_BLK_SZ());
+        inode->blks_loaded++;
+        newfs_super.res_blks++;
+        if (newfs_fault_fill(lblk, offset, size, is_write)) {
+            bufs[lblk - base] = inode->block_pointer[lblk];
+            fill++;
+        }
+    }
+    if (fill == 0) {
+        return NFS_ERROR_NONE;
+    }
+    if (newfs_comp_read(inode, clu, bufs) != NFS_ERROR_NONE) {
+        for (lblk = base; lblk < base + NFS_COMP_CLUSTER_BLKS; lblk++) {
+            if (bufs[lblk - base]) {
+                newfs_res_drop(inode, lblk);
+            }
+        }
+        return -NFS_ERROR_IO;
+    }
+    newfs_super.faults += fill;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 保证 [offset, offset + size) 涉及的已有数据块都在内存中，缺的按需读入，
+ * 映射到连续数据块的缺块合并成一次设备读
+ * 
+ * @param inode 
+ * @param offset 
+ * @param size 
+ * @param is_write 写时被整块覆盖的块不必读，只分配内存
+ * @return int 
+ */
+static int newfs_inode_fault(struct newfs_inode* inode, int offset, int size, boolean is_write) {
+    int start = offset / NFS_BLK_SZ();
+    int end   = NFS_BLKS_OF(offset + size) < inode->blks ? NFS_BLKS_OF(offset + size) : inode->blks;
+    int lblk  = start, run, pblk, i;
+
+    while (lblk < end) {
+        if (inode->block_pointer[lblk]) {
+            lblk++;
+            continue;
+        }
+        if (inode->inline_data) {                       /* 只有第 0 块，在 inode 块中 */
+            if (newfs_inline_load(inode, NULL) != NFS_ERROR_NONE) {
+                return -NFS_ERROR_IO;
+            }
+            newfs_super.faults++;
+            lblk++;
+            continue;
+        }
+        if (inode->compress && newfs_comp_packed(inode, lblk / NFS_COMP_CLUSTER_BLKS)) {
+            if (newfs_inode_fault_packed(inode, lblk / NFS_COMP_CLUSTER_BLKS, offset, size,
+                                         is_write) != NFS_ERROR_NONE) {
+                return -NFS_ERROR_IO;
+            }
+            lblk = (lblk / NFS_COMP_CLUSTER_BLKS + 1) * NFS_COMP_CLUSTER_BLKS;
+            continue;
+        }
+        pblk = newfs_fault_fill(lblk, offset, size, is_write) ? newfs_bmap(inode, lblk, FALSE) : -1;
+        for (run = 1; pblk >= 0 && lblk + run < end; run++) {
+            if (inode->block_pointer[lblk + run] || !newfs_fault_fill(lblk + run, offset, size, is_write) ||
+                (inode->compress && (lblk + run) % NFS_COMP_CLUSTER_BLKS == 0) ||   /* 下一簇可能是压缩的 */
+                newfs_bmap(inode, lblk + run, FALSE) != pblk + run)
+                break;
+        }
+        for (i = 0; i < run; i++) {
+            inode->block_pointer[lblk + i] = (uint8_t*)calloc(1, NFS_BLK_SZ()); /* 空洞读出为零 */
+        }
+        inode->blks_loaded     += run;
+        newfs_super.res_blks   += run;
+        if (pblk >= 0) {
+            if (newfs_driver_read_blks(NFS_DATA_BLK(pblk), inode->block_pointer + lblk,
+                                       run) != NFS_ERROR_NONE) {
+                for (i = 0; i < run; i++) {
+                    newfs_res_drop(inode, lblk + i);
+                }
+                return -NFS_ERROR_IO;
+            }
+            newfs_super.faults += run;
+        }
+        lblk += run;
+    }
+    if (inode->blks_loaded) {
+        newfs_res_touch(inode);
+    }
+    newfs_res_shrink(inode, start, end - start);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 调整文件在内存中的块数，增长时分配并映射新的数据块
+ * 
+ * @param inode 
+ * @param blks 调整后的块数
+ * @return int 
+ */
+int newfs_inode_resize(struct newfs_inode* inode, int blks) {
+    int old = inode->blks, lblk;
+    uint8_t** block_pointer;
+    uint8_t*  blk_dirty;
+
+    if (blks > old) {
+        block_pointer = (uint8_t**)realloc(inode->block_pointer, blks * sizeof(uint8_t*));
+        if (block_pointer == NULL) {
+            return -NFS_ERROR_NOSPACE;
+        }
+        inode->block_pointer = block_pointer;
+        blk_dirty = (uint8_t*)realloc(inode->blk_dirty, blks);
+        if (blk_dirty == NULL) {
+            return -NFS_ERROR_NOSPACE;
+        }
+        inode->blk_dirty = blk_dirty;
+        newfs_mark_dirty(inode, NFS_DIRTY_DATA | NFS_DIRTY_INODE);
+        for (lblk = old; lblk < blks; lblk++) {
+            inode->block_pointer[lblk] = (uint8_t*)calloc(1, NFS_BLK_SZ());
+            inode->blk_dirty[lblk] = FALSE;
+            inode->blks_loaded++;
+            newfs_super.res_blks++;
+            newfs_mark_blk_dirty(inode, lblk);          /* 新块在盘上是旧内容，要写一次零 */
+            inode->blks = lblk + 1;
+            if (!inode->inline_data && newfs_bmap(inode, lblk, TRUE) < 0) {
+                newfs_inode_resize(inode, old);           /* 回滚 */
+                return -NFS_ERROR_NOSPACE;
+            }
+        }
+        newfs_res_touch(inode);
+    }
+    else {
+        for (lblk = blks; lblk < old; lblk++) {
+            newfs_res_drop(inode, lblk);
+        }
+        inode->blks = blks;
+        newfs_map_truncate(inode, blks);
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 文件要超过内联的上限时，把内联数据搬到一个数据块里，之后按普通文件读写
+ * 
+ * @param inode 内联存放的文件
+ * @return int 
+ */
+static int newfs_inline_promote(struct newfs_inode* inode) {
+    int ret;
+
+    if (inode->blks) {
+        ret = newfs_inode_fault(inode, 0, 1, FALSE);    /* 先把内联数据读进内存 */
+        if (ret != NFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+    inode->inline_data = FALSE;
+    if (inode->blks) {
+        if (newfs_bmap(inode, 0, TRUE) < 0) {
+            inode->inline_data = TRUE;
+            return -NFS_ERROR_NOSPACE;
+        }
+        newfs_mark_blk_dirty(inode, 0);
+    }
+    newfs_mark_dirty(inode, NFS_DIRTY_DATA | NFS_DIRTY_INODE);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 读文件前截到文件末尾，发起预读并读入缺块
+ * 
+ * @param inode 
+ * @param size 
+ * @param offset 
+ * @return int 实际要读的字节数
+ */
+static int newfs_file_read_prep(struct newfs_inode* inode, int size, int offset) {
+    int lblk = offset / NFS_BLK_SZ();
+
+    newfs_touch_atime(inode);
+    if (offset >= inode->size) {
+        return 0;
+    }
+    if (offset + size > inode->size) {
+        size = inode->size - offset;
+    }
+    newfs_readahead(inode, lblk, NFS_BLKS_OF(offset + size) - lblk);
+    if (newfs_inode_fault(inode, offset, size, FALSE) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    return size;
+}
+
+/**
+ * @brief 从文件中读取数据
+ * 调用时持有 inode 读锁和一层 newfs_super.lock，缺块读入后放开 lock 拷贝
+ * 
+ * @param inode 
+ * @param buf 
+ * @param size 
+ * @param offset 
+ * @return int 实际读取的字节数
+ */
+int newfs_file_read(struct newfs_inode* inode, char* buf, int size, int offset) {
+    int lblk = offset / NFS_BLK_SZ(), bias = offset % NFS_BLK_SZ();
+    int len, done = 0;
+
+    size = newfs_file_read_prep(inode, size, offset);
+    if (size <= 0) {
+        return size;
+    }
+    NFS_UNLOCK();                                       /* 这些块被钉住，不会被淘汰 */
+    while (done < size) {
+        len = NFS_BLK_SZ() - bias < size - done ? NFS_BLK_SZ() - bias : size - done;
+        memcpy(buf + done, inode->block_pointer[lblk] + bias, len);
+        done += len;
+        bias  = 0;
+        lblk++;
+    }
+    NFS_LOCK();
+    return size;
+}
+
+/**
+ * @brief 写文件前读入缺块、分配新块并标记好脏，之后只剩拷贝
+ * 
+ * @param inode 
+ * @param size 
+ * @param offset 
+ * @return int 
+ */
+static int newfs_file_write_prep(struct newfs_inode* inode, int size, int offset) {
+    int lblk, ret;
+
+    if (offset > inode->size) {
+        return -NFS_ERROR_SEEK;
+    }
+    if (inode->inline_data && offset + size > NFS_INLINE_SZ()) {
+        ret = newfs_inline_promote(inode);
+        if (ret != NFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+    /* 新增的块由 resize 分配，内容为零 */
+    ret = newfs_inode_fault(inode, offset, size, TRUE);
+    if (ret != NFS_ERROR_NONE) {
+        return ret;
+    }
+    if (NFS_BLKS_OF(offset + size) > inode->blks) {
+        ret = newfs_inode_resize(inode, NFS_BLKS_OF(offset + size));
+        if (ret != NFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+    for (lblk = offset / NFS_BLK_SZ(); lblk < NFS_BLKS_OF(offset + size); lblk++) {
+        newfs_mark_blk_dirty(inode, lblk);
+    }
+    newfs_mark_dirty(inode, NFS_DIRTY_DATA);
+    if (offset + size > inode->size) {
+        inode->size = offset + size;
+    }
+    newfs_touch_mtime(inode);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 向文件写入数据，需要时为文件分配新的数据块
+ * 调用时持有 inode 写锁和一层 newfs_super.lock，分配好块、标记好脏之后放开 lock 拷贝，
+ * 回写线程拿不到 inode 锁，不会在拷贝中途写回
+ * 
+ * @param inode 
+ * @param buf 
+ * @param size 
+ * @param offset 
+ * @return int 实际写入的字节数
+ */
+int newfs_file_write(struct newfs_inode* inode, const char* buf, int size, int offset) {
+    int lblk = offset / NFS_BLK_SZ(), bias = offset % NFS_BLK_SZ();
+    int len, done = 0, ret;
+
+    ret = newfs_file_write_prep(inode, size, offset);
+    if (ret != NFS_ERROR_NONE) {
+        return ret;
+    }
+    NFS_UNLOCK();
+    while (done < size) {
+        len = NFS_BLK_SZ() - bias < size - done ? NFS_BLK_SZ() - bias : size - done;
+        memcpy(inode->block_pointer[lblk] + bias, buf + done, len);
+        done += len;
+        bias  = 0;
+        lblk++;
+    }
+    NFS_LOCK();
+    return size;
+}
+
+/**
+ * @brief 改变文件大小，变长的部分读出为零，截成空文件后重新内联存放
+ * 调用时持有 inode 写锁和 newfs_super.lock
+ * 
+ * @param inode 
+ * @param size 新的大小
+ * @return int 
+ */
+int newfs_file_truncate(struct newfs_inode* inode, int size) {
+    int lblk = size / NFS_BLK_SZ(), bias = size % NFS_BLK_SZ();
+    int base, i, ret;
+
+    if (inode->inline_data && size > NFS_INLINE_SZ()) {
+        ret = newfs_inline_promote(inode);
+        if (ret != NFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+    base = NFS_BLKS_OF(size) / NFS_COMP_CLUSTER_BLKS * NFS_COMP_CLUSTER_BLKS;
+    if (inode->compress && !inode->inline_data && size < inode->size && NFS_BLKS_OF(size) > base) {
+        /* 最后一簇变短后映射的块可能不再少于簇的块数，无法再认出是压缩的，整簇读进内存重写 */
+        ret = newfs_inode_fault(inode, NFS_BLKS_SZ(base), size - NFS_BLKS_SZ(base), FALSE);
+        if (ret != NFS_ERROR_NONE) {
+            return ret;
+        }
+        for (i = base; i < NFS_BLKS_OF(size); i++) {
+            newfs_mark_blk_dirty(inode, i);
+        }
+        newfs_mark_dirty(inode, NFS_DIRTY_DATA);
+    }
+    if (size < inode->size && bias) {
+        /* 最后一块中新末尾之后的内容清零，以后再变长时读出为零 */
+        ret = newfs_inode_fault(inode, size, 1, FALSE);
+        if (ret != NFS_ERROR_NONE) {
+            return ret;
+        }
+        memset(inode->block_pointer[lblk] + bias, 0, NFS_BLK_SZ() - bias);
+        newfs_mark_blk_dirty(inode, lblk);
+        newfs_mark_dirty(inode, NFS_DIRTY_DATA);
+    }
+    if (NFS_BLKS_OF(size) != inode->blks) {
+        ret = newfs_inode_resize(inode, NFS_BLKS_OF(size));
+        if (ret != NFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+    if (size == 0) {
+        inode->inline_data = TRUE;                      /* 数据块已全部释放 */
+    }
+    inode->size = size;
+    newfs_touch_mtime(inode);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 读写文件前加 inode 锁，调用时持有一层 newfs_super.lock
+ * 先钉住 inode 再放锁，按 inode 锁 -> 全局锁的顺序重新加锁；
+ * 有一轮回写在等拷贝中的文件时，写者先不开始新的拷贝
+ * 
+ * @param inode 
+ * @param is_write 
+ */
+static void newfs_inode_lock(struct newfs_inode* inode, boolean is_write) {
+    newfs_inode_get(inode);
+    for (;;) {
+        while (is_write && newfs_super.sync_gate) {
+            pthread_cond_wait(&newfs_super.stage_cond, &newfs_super.lock);
+        }
+        NFS_UNLOCK();
+        if (is_write) {
+            pthread_rwlock_wrlock(&inode->rwlock);
+        }
+        else {
+            pthread_rwlock_rdlock(&inode->rwlock);
+        }
+        NFS_LOCK();
+        if (!is_write || !newfs_super.sync_gate) {
+            break;
+        }
+        pthread_rwlock_unlock(&inode->rwlock);          /* 放锁期间回写开始等了，让它先 */
+    }
+}
+
+/**
+ * @brief 放开 inode 锁并解除钉住，调用时持有 newfs_super.lock
+ * 
+ * @param inode 
+ */
+static void newfs_inode_unlock(struct newfs_inode* inode) {
+    pthread_rwlock_unlock(&inode->rwlock);
+    newfs_inode_put(inode);
+}
+
+/**
+ * @brief 按 inode 读写文件，两种 FUSE 接口共用，调用时持有一层 newfs_super.lock
+ * 
+ * @param inode 普通文件
+ * @param buf 
+ * @param size 
+ * @param offset 
+ * @param is_write 
+ * @return int 实际读写的字节数
+ */
+int newfs_inode_rw(struct newfs_inode* inode, char* buf, int size, int offset, boolean is_write) {
+    int ret;
+
+    newfs_inode_lock(inode, is_write);
+    if (inode->size < offset) {
+        ret = -NFS_ERROR_SEEK;
+    }
+    else if (is_write) {
+        ret = newfs_file_write(inode, buf, size, offset);
+    }
+    else {
+        ret = newfs_file_read(inode, buf, size, offset);
+    }
+    newfs_inode_unlock(inode);
+    return ret;
+}
+
+/**
+ * @brief 按 inode 改变文件大小，加锁方式同 newfs_inode_rw
+ * 
+ * @param inode 普通文件
+ * @param size 
+ * @return int 
+ */
+int newfs_inode_setsize(struct newfs_inode* inode, int size) {
+    int ret;
+
+    newfs_inode_lock(inode, TRUE);
+    ret = newfs_file_truncate(inode, size);
+    newfs_inode_unlock(inode);
+    return ret;
+}
+
+#if FUSE_VERSION >= 29
+/**
+ * @brief 把文件 [offset, offset + size) 按所在的块切成缓冲区向量，直接指向内存中的块
+ * 
+ * @param inode 涉及的块都已在内存中
+ * @param size 大于0
+ * @param offset 
+ * @return struct fuse_bufvec* 用完后free，出错返回NULL
+ */
+static struct fuse_bufvec* newfs_file_bufvec(struct newfs_inode* inode, int size, int offset) {
+    struct fuse_bufvec* vec;
+    int lblk = offset / NFS_BLK_SZ(), bias = offset % NFS_BLK_SZ();
+    int cnt  = NFS_BLKS_OF(offset + size) - lblk;
+    int len, done = 0, i;
+
+    vec = (struct fuse_bufvec*)calloc(1, sizeof(struct fuse_bufvec) + (cnt - 1) * sizeof(struct fuse_buf));
+    if (vec == NULL) {
+        return NULL;
+    }
+    vec->count = cnt;
+    for (i = 0; i < cnt; i++) {
+        len = NFS_BLK_SZ() - bias < size - done ? NFS_BLK_SZ() - bias : size - done;
+        vec->buf[i].mem  = inode->block_pointer[lblk + i] + bias;
+        vec->buf[i].size = len;
+        vec->buf[i].fd   = -1;
+        done += len;
+        bias  = 0;
+    }
+    return vec;
+}
+
+/**
+ * @brief 按 inode 读文件，不拷贝：把内存中的块作为缓冲区向量交给 fn（例如直接回复内核），
+ * fn 在放开 newfs_super.lock、仍持有 inode 读锁时调用，返回前这些块不会被改写或淘汰。
+ * 调用时持有一层 newfs_super.lock
+ * 
+ * @param inode 普通文件
+ * @param size 
+ * @param offset 
+ * @param fn 只在有数据可读时调用
+ * @param arg 传给 fn
+ * @return int fn 的返回值，读到文件末尾时返回0
+ */
+int newfs_inode_read_buf(struct newfs_inode* inode, int size, int offset, newfs_buf_fn fn, void* arg) {
+    struct fuse_bufvec* vec;
+    int ret;
+
+    newfs_inode_lock(inode, FALSE);
+    ret = inode->size < offset ? -NFS_ERROR_SEEK : newfs_file_read_prep(inode, size, offset);
+    if (ret > 0) {
+        vec = newfs_file_bufvec(inode, ret, offset);
+        if (vec == NULL) {
+            ret = -NFS_ERROR_NOSPACE;
+        }
+        else {
+            NFS_UNLOCK();
+            ret = fn(vec, arg);
+            NFS_LOCK();
+            free(vec);
+        }
+    }
+    newfs_inode_unlock(inode);
+    return ret;
+}
+
+/**
+ * @brief 按 inode 写文件，src 中的数据（可能是 splice 来的管道）直接拷进内存中的块，
+ * 省去先拷到临时缓冲区的一次拷贝。调用时持有一层 newfs_super.lock
+ * 
+ * @param inode 普通文件
+ * @param src 
+ * @param offset 
+ * @return int 实际写入的字节数
+ */
+int newfs_inode_write_buf(struct newfs_inode* inode, struct fuse_bufvec* src, int offset) {
+    struct fuse_bufvec* vec;
+    int size = fuse_buf_size(src), old_size, end, ret;
+    ssize_t copied;
+
+    if (size == 0) {
+        return 0;
+    }
+    newfs_inode_lock(inode, TRUE);
+    old_size = inode->size;
+    ret = inode->size < offset ? -NFS_ERROR_SEEK : newfs_file_write_prep(inode, size, offset);
+    if (ret != NFS_ERROR_NONE) {
+        goto out;
+    }
+    vec = newfs_file_bufvec(inode, size, offset);
+    if (vec == NULL) {
+        ret = -NFS_ERROR_NOSPACE;
+        goto out;
+    }
+    NFS_UNLOCK();
+    copied = fuse_buf_copy(vec, src, 0);
+    NFS_LOCK();
+    free(vec);
+    ret = copied < 0 ? -NFS_ERROR_IO : (int)copied;
+    end = offset + (copied > 0 ? (int)copied : 0);
+    if (ret < size && inode->size > old_size) {
+        newfs_file_truncate(inode, end > old_size ? end : old_size);    /* 没拿到那么多数据，只增长到实际写入处 */
+    }
+out:
+    newfs_inode_unlock(inode);
+    return ret;
 }
+#endif
 
 /**
- * @brief 新建一个索引
+ * @brief 按 inode 填充文件属性，调用时持有 newfs_super.lock
  * 
- * @param dentry 要分配索引的dentry
- * @return newfs_inode
+ * @param inode 
+ * @param st 
  */
-struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
-    struct newfs_inode* inode;
-    int byte_cursor  = 0; // 字节游标
-    int bit_cursor   = 0; // 比特游标
-    int ino_cursor   = 0; 
-    int bno_cursor   = 0;
-    int data_blk_cnt = 0;
-    boolean is_find_free_entry = FALSE; // 是否已经在位图中找到空闲位
-    boolean is_enough_data_blk = FALSE;
+void newfs_inode_stat(struct newfs_inode* inode, struct stat* st) {
+    boolean is_root = inode == newfs_super.root_dentry->inode;
 
-    // 从索引位图中取空闲
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(newfs_super.map_inode_blks); 
-         byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((newfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                /* 当前ino_cursor位置空闲 */
-                newfs_super.map_inode[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;           
-                break;
-            }
-            ino_cursor++;
-        }
-        if (is_find_free_entry) {
-            break;
-        }
+    if (NFS_IS_DIR(inode)) {
+        st->st_mode = __S_IFDIR | NFS_DEFAULT_PERM;
+        st->st_size = inode->dir_cnt * sizeof(struct newfs_dentry_d);
     }
-
-    if (!is_find_free_entry || ino_cursor == newfs_super.max_ino)
-        return -NFS_ERROR_NOSPACE;
-
-    // 分配一个 inode
-    inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
-    inode->ino  = ino_cursor; 
-    inode->size = 0;
-
-    // 从数据块位图中找空位
-    if(dentry->ftype == NFS_DIR)
-        for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(newfs_super.map_data_blks); 
-            byte_cursor++)
-        {
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-                if((newfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                    // 当前ino_cursor位置空闲
-                    newfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);
-
-                    inode->bno[data_blk_cnt++] = bno_cursor;
-                        is_enough_data_blk = TRUE;
-                        break;
-                }
-                bno_cursor++;
-            }
-            if (is_enough_data_blk) {
-                break;
-            }
-        }
-
-    if (!is_enough_data_blk || bno_cursor == newfs_super.max_data)
-        return -NFS_ERROR_NOSPACE;
-
-    /* dentry指向inode */
-    dentry->inode = inode;
-    dentry->ino   = inode->ino;
-    
-    /* inode指回dentry */
-    inode->dentry = dentry;
-    
-    inode->dir_cnt = 0;
-    inode->dentrys = NULL;
-    
-    /* 对于文件，还需要预分配 pointer，指向内存中的随机块 */
-    if (NFS_IS_REG(inode)) {
-        for(int p_count = 0; p_count < NFS_DATA_PER_FILE; p_count++){
-            inode->block_pointer[p_count] = (uint8_t *)malloc(NFS_BLK_SZ());
-        }
+    else if (NFS_IS_REG(inode)) {
+        st->st_mode = __S_IFREG | NFS_DEFAULT_PERM;
+        st->st_size = inode->size;
     }
 
-    return inode;
+    st->st_ino     = inode->ino + 1;                    /* 0 在 FUSE 中有特殊含义 */
+    st->st_nlink   = 1;
+    st->st_uid     = getuid();
+    st->st_gid     = getgid();
+    st->st_atim.tv_sec  = inode->atime / NFS_NSEC_PER_SEC;
+    st->st_atim.tv_nsec = inode->atime % NFS_NSEC_PER_SEC;
+    st->st_mtim.tv_sec  = inode->mtime / NFS_NSEC_PER_SEC;
+    st->st_mtim.tv_nsec = inode->mtime % NFS_NSEC_PER_SEC;
+    st->st_ctim.tv_sec  = inode->ctime / NFS_NSEC_PER_SEC;
+    st->st_ctim.tv_nsec = inode->ctime % NFS_NSEC_PER_SEC;
+    st->st_blksize = NFS_BLK_SZ();
+
+    if (is_root) {
+        st->st_size   = newfs_super.sz_usage; 
+        st->st_blocks = NFS_DISK_SZ() / NFS_BLK_SZ();
+        st->st_nlink  = 2;                              /* !特殊，根目录link数为2 */
+    }
 }
 
-
-
+/**
+ * @brief 填充 readdir 用的属性，只有 inode 号和类型，不必读入 inode
+ * 
+ * @param dentry 
+ * @param st 
+ */
+void newfs_dentry_stat(struct newfs_dentry* dentry, struct stat* st) {
+    st->st_ino  = (dentry->inode ? dentry->inode->ino : dentry->ino) + 1;
+    st->st_mode = dentry->ftype == NFS_DIR ? __S_IFDIR : __S_IFREG;
+}
 
 /**
- * @brief 将内存中的索引inode刷回磁盘（递归）
+ * @brief 将内存中一个inode的改动刷回磁盘，只写脏的部分
  * 
  * @param inode 
  * @return int 
@@ -257,72 +1567,256 @@ struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
 int newfs_sync_inode(struct newfs_inode * inode) {
     struct newfs_inode_d  inode_d;
     struct newfs_dentry*  dentry_cursor;
-    struct newfs_dentry_d dentry_d;
+    struct newfs_dentry_d* dentry_d;
+    uint8_t* blk_buf;
     int ino             = inode->ino;
-    inode_d.ino         = ino;
-    inode_d.size        = inode->size;
-    inode_d.ftype       = inode->dentry->ftype;
-    inode_d.dir_cnt     = inode->dir_cnt;
-
-    int blk_cnt = 0;
-    for(blk_cnt = 0; blk_cnt < NFS_DATA_PER_FILE; blk_cnt++)
-        inode_d.bno[blk_cnt] = inode->bno[blk_cnt]; /* 数据块的块号也要赋值 */
+    int cnt, blk_cnt, bno;
+    int ret             = NFS_ERROR_NONE;
 
-    int offset, offset_limit;  /* 用于密集写回 dentry */
-    
-    /* inode 非密集写回，间隔一个 BLK */
-    if (newfs_driver_write(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
-                     sizeof(struct newfs_inode_d)) != NFS_ERROR_NONE) {
-        NFS_DBG("[%s] io error\n", __func__);
-        return -NFS_ERROR_IO;
+    if (!inode->dirty) {
+        return NFS_ERROR_NONE;
     }
+    blk_buf = (uint8_t*)calloc(1, NFS_BLK_SZ());
 
-    // 如果inode指向一个目录，则需要递归进入其子目录进行刷回操作
-    if (NFS_IS_DIR(inode)) {      
+    // 目录：从第一个改动过的目录块开始重写，前面的块内容不变
+    if (NFS_IS_DIR(inode) && (inode->dirty & NFS_DIRTY_DIR)) {      
+        cnt = 0;
         blk_cnt = 0;                    
         dentry_cursor = inode->dentrys; // 指针指向当前索引对应的目录项
 
-        while(dentry_cursor != NULL && blk_cnt < NFS_DATA_PER_FILE){
-            offset = NFS_DATA_OFS(inode->bno[blk_cnt]); // dentry 从 inode 分配的首个数据块开始存
-            offset_limit = NFS_DATA_OFS(inode->bno[blk_cnt] + 1);
-            /* 写满一个 blk 时换到下一个 bno */
-            while (dentry_cursor != NULL)
-            {
-                memcpy(dentry_d.fname, dentry_cursor->fname, NFS_MAX_FILE_NAME);
-                dentry_d.ftype = dentry_cursor->ftype;
-                dentry_d.ino = dentry_cursor->ino;
-                /* dentry 密集写回 */
-                if (newfs_driver_write(offset, (uint8_t *)&dentry_d, 
-                                    sizeof(struct newfs_dentry_d)) != NFS_ERROR_NONE) {
-                    NFS_DBG("[%s] io error\n", __func__);
-                    return -NFS_ERROR_IO;                     
-                }
-                
-                if (dentry_cursor->inode != NULL) {
-                    newfs_sync_inode(dentry_cursor->inode); // 递归刷新下一个节点
-                }
+        /* dentry 在块内密集存放，攒满一个块后整块写回 */
+        while (dentry_cursor != NULL)
+        {
+            if (blk_cnt >= inode->dir_dirty_from) {
+                dentry_d = (struct newfs_dentry_d*)blk_buf + cnt % NFS_DENTRY_PER_BLK();
+                memcpy(dentry_d->fname, dentry_cursor->fname, NFS_MAX_FILE_NAME);
+                dentry_d->ftype = dentry_cursor->ftype;
+                dentry_d->ino = dentry_cursor->ino;
+            }
 
-                dentry_cursor = dentry_cursor->brother; /* 深搜 */
-                offset += sizeof(struct newfs_dentry_d);
-                if(offset + sizeof(struct newfs_dentry_d) > offset_limit)
-                    break;
+            dentry_cursor = dentry_cursor->brother;
+            cnt++;
+            if (cnt % NFS_DENTRY_PER_BLK() == 0 || dentry_cursor == NULL) {
+                if (blk_cnt >= inode->dir_dirty_from) {
+                    bno = newfs_bmap(inode, blk_cnt, TRUE);
+                    if (bno < 0) {
+                        ret = -NFS_ERROR_NOSPACE;
+                        goto out;
+                    }
+                    if (newfs_driver_write(NFS_DATA_OFS(bno), blk_buf, NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+                        NFS_DBG("[%s] io error\n", __func__);
+                        ret = -NFS_ERROR_IO;
+                        goto out;
+                    }
+                    memset(blk_buf, 0, NFS_BLK_SZ());
+                }
+                blk_cnt++; /* 访问下一个指向的数据块 */
             }
-            blk_cnt++; /* 访问下一个指向的数据块 */
         }
+        newfs_map_truncate(inode, blk_cnt); /* 目录项变少后释放多余的块 */
     }
-    else if (NFS_IS_REG(inode)) {
-        for(blk_cnt = 0; blk_cnt < NFS_DATA_PER_FILE; blk_cnt++){
-            if (newfs_driver_write(NFS_DATA_OFS(inode->bno[blk_cnt]), 
-                    inode->block_pointer[blk_cnt], NFS_BLK_SZ()) != NFS_ERROR_NONE) {
-                NFS_DBG("[%s] io error\n", __func__);
-                return -NFS_ERROR_IO;
+    else if (NFS_IS_REG(inode) && (inode->dirty & NFS_DIRTY_DATA) && inode->inline_data) {
+        inode->dirty |= NFS_DIRTY_INODE;                /* 内联数据随 inode 块一起写 */
+    }
+    else if (NFS_IS_REG(inode) && (inode->dirty & NFS_DIRTY_DATA)) {
+        ret = newfs_inode_writeback(inode, 0, inode->blks);
+        if (ret != NFS_ERROR_NONE) {
+            NFS_DBG("[%s] io error\n", __func__);
+            goto out;
+        }
+    }
+
+    /* 数据块映射可能在上面发生变化，最后写 inode */
+    if (inode->dirty & NFS_DIRTY_INODE) {
+        memset(&inode_d, 0, sizeof(struct newfs_inode_d));
+        inode_d.ino         = ino;
+        inode_d.size        = inode->size;
+        inode_d.ftype       = inode->dentry->ftype;
+        inode_d.dir_cnt     = inode->dir_cnt;
+        inode_d.atime       = inode->atime;
+        inode_d.mtime       = inode->mtime;
+        inode_d.ctime       = inode->ctime;
+        inode_d.inline_data = inode->inline_data;
+        inode_d.compress    = inode->compress;
+        ret = newfs_map_sync(inode, &inode_d);
+        if (ret != NFS_ERROR_NONE) {
+            goto out;
+        }
+    
+        /* inode 独占一个 BLK，整块写回，内联数据紧跟其后 */
+        memset(blk_buf, 0, NFS_BLK_SZ());
+        if (inode->inline_data && inode->blks && inode->block_pointer[0]) {
+            memcpy(blk_buf + sizeof(struct newfs_inode_d), inode->block_pointer[0], inode->size);
+            inode->blk_dirty[0] = FALSE;
+        }
+        else if (inode->inline_data && inode->blks &&    /* 内联数据已被淘汰，保留盘上的 */
+                 newfs_driver_read(NFS_INO_OFS(ino), blk_buf, NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+            ret = -NFS_ERROR_IO;
+            goto out;
+        }
+        memcpy(blk_buf, &inode_d, sizeof(struct newfs_inode_d));
+        if (newfs_driver_write(NFS_INO_OFS(ino), blk_buf, NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+            NFS_DBG("[%s] io error\n", __func__);
+            ret = -NFS_ERROR_IO;
+            goto out;
+        }
+    }
+    newfs_mark_clean(inode);
+out:
+    free(blk_buf);
+    return ret;
+}
+
+/**
+ * @brief 现在做一轮回写最多往日志里写多少块，调用时持有 newfs_super.lock
+ * 每个脏 inode 算 inode 块、从 dir_dirty_from 起的目录块和全部映射块，
+ * 位图、去重表、校验表按整个重写算
+ * 
+ * @return int 
+ */
+int newfs_sync_estimate() {
+    struct newfs_inode* inode;
+    int blks = newfs_super.map_inode_blks + newfs_super.map_data_blks +
+               NFS_DEDUP()->blks + NFS_CSUM()->blks;
+    int n;
+
+    for (inode = newfs_super.dirty_head; inode; inode = inode->dirty_next) {
+        n = NFS_IS_DIR(inode) ? (inode->dir_cnt + NFS_DENTRY_PER_BLK() - 1) / NFS_DENTRY_PER_BLK()
+                              : inode->blks;
+        blks += 1 + newfs_map_sync_blks(inode, n);
+        if (NFS_IS_DIR(inode) && (inode->dirty & NFS_DIRTY_DIR) && n > inode->dir_dirty_from) {
+            blks += n - inode->dir_dirty_from;
+        }
+    }
+    return blks;
+}
+
+/**
+ * @brief 开始一轮回写：等上一轮写完盘，再等放锁拷贝数据的脏文件拷完，之后暂存区开始收集。
+ * 调用时持有 newfs_super.lock（只持有一层）；等待时放锁，等完从头再查一遍。
+ * 等待期间新的写者停在 newfs_inode_lock，不会一直有文件在拷贝；
+ * 每次只等一个文件、等完就放开，不同时持有多个 inode 锁
+ * 
+ */
+void newfs_sync_begin() {
+    struct newfs_inode* inode;
+    boolean waited;
+
+    do {
+        newfs_stage_wait();
+        newfs_super.sync_gate = TRUE;
+        waited = FALSE;
+        for (inode = newfs_super.dirty_head; inode; inode = inode->dirty_next) {
+            if (pthread_rwlock_tryrdlock(&inode->rwlock) == 0) {
+                pthread_rwlock_unlock(&inode->rwlock);  /* 没有写者，持锁期间也不会有 */
+                continue;
             }
+            newfs_inode_lock(inode, FALSE);             /* 钉住后放锁等写者拷完 */
+            newfs_inode_unlock(inode);
+            waited = TRUE;
+            break;
+        }
+    } while (waited);
+    NFS_STAGE()->active   = TRUE;
+    newfs_super.sync_gate = FALSE;                      /* 写者要等本轮收集完、放锁后才能继续 */
+    pthread_cond_broadcast(&newfs_super.stage_cond);
+}
+
+/**
+ * @brief 沿脏 inode 链表刷回所有改动，再写回改动过的位图
+ * 耗时只与改动量有关，与文件系统大小无关；
+ * 其间的 inode、目录块、映射块和位图作为一个日志事务提交。
+ * 所有要写的块都先收进暂存区，不在回写线程中时最后按块号排序、
+ * 合并相邻块一起写盘，各 inode 的块不再各自寻道
+ * 
+ * @return int 
+ */
+int newfs_sync_all() {
+    struct newfs_stage* stage  = NFS_STAGE();
+    struct newfs_inode* inode;
+    boolean             staged = stage->active;         /* 回写线程已经在收集 */
+    int ret = NFS_ERROR_NONE;
+
+    if (!staged) {
+        newfs_sync_begin();
+    }
+    newfs_journal_begin();
+    /* 没有文件在放锁拷贝数据，持锁期间也不会开始新的拷贝，inode 都可以直接写 */
+    inode = newfs_super.dirty_head;
+    while (inode) {
+        ret = newfs_sync_inode(inode);
+        if (ret != NFS_ERROR_NONE) {
+            goto out;
         }
+        inode = newfs_super.dirty_head;                 /* 写目录时可能又有 inode 变脏 */
     }
-    return NFS_ERROR_NONE;
+    if (newfs_super.inode_bmap.dirty) {
+        if (newfs_driver_write(newfs_super.map_inode_offset, newfs_super.map_inode,
+                               NFS_BLKS_SZ(newfs_super.map_inode_blks)) != NFS_ERROR_NONE) {
+            ret = -NFS_ERROR_IO;
+            goto out;
+        }
+        newfs_super.inode_bmap.dirty = FALSE;
+    }
+    if (newfs_super.data_bmap.dirty) {
+        if (newfs_driver_write(newfs_super.map_data_offset, newfs_super.map_data,
+                               NFS_BLKS_SZ(newfs_super.map_data_blks)) != NFS_ERROR_NONE) {
+            ret = -NFS_ERROR_IO;
+            goto out;
+        }
+        newfs_super.data_bmap.dirty = FALSE;
+    }
+    if (newfs_dedup_sync() != NFS_ERROR_NONE) {
+        ret = -NFS_ERROR_IO;
+        goto out;
+    }
+    if (newfs_cache_flush() != NFS_ERROR_NONE) {        /* 少量不足一块的写还留在块缓存里 */
+        ret = -NFS_ERROR_IO;
+        goto out;
+    }
+    if (newfs_csum_sync() != NFS_ERROR_NONE) {          /* 最后写，本轮写的块都已记下校验和 */
+        ret = -NFS_ERROR_IO;
+    }
+out:
+    if (ret != NFS_ERROR_NONE) {
+        newfs_journal_abort();                          /* 没收全的一轮不提交，留到下一轮 */
+    }
+    else if (newfs_journal_commit() != NFS_ERROR_NONE) {
+        ret = -NFS_ERROR_IO;
+    }
+    if (!staged) {
+        stage->active = FALSE;
+        if (ret == NFS_ERROR_NONE) {
+            ret = newfs_stage_sync();
+        }
+        if (ret == NFS_ERROR_NONE) {
+            newfs_journal_checkpointed();
+        }
+    }
+    return ret;
 }
 
 
+/**
+ * @brief 释放 inode 占用的内存，磁盘上的位已经清除
+ * 
+ * @param inode 
+ */
+static void newfs_inode_free(struct newfs_inode* inode) {
+    int blk_cnt;
+
+    if (inode->block_pointer) {                         /* 普通文件 */
+        for (blk_cnt = 0; blk_cnt < inode->blks; blk_cnt++)
+            newfs_res_drop(inode, blk_cnt);
+        newfs_res_unlink(inode);
+        free(inode->block_pointer);
+        free(inode->blk_dirty);
+    }
+    newfs_dir_hash_free(inode);
+    pthread_rwlock_destroy(&inode->rwlock);
+    free(inode);
+}
+
 /**
  * @brief 删除内存中的一个inode， 暂时不释放
  * Case 1: Reg File
@@ -356,11 +1850,6 @@ int newfs_drop_inode(struct newfs_inode * inode) {
     struct newfs_dentry*  dentry_to_free;
     struct newfs_inode*   inode_cursor;
 
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    boolean is_find = FALSE;
-
     if (inode == newfs_super.root_dentry->inode) {
         return NFS_ERROR_INVAL;
     }
@@ -371,111 +1860,214 @@ int newfs_drop_inode(struct newfs_inode * inode) {
         while (dentry_cursor)
         {   
             inode_cursor = dentry_cursor->inode;
-            newfs_drop_inode(inode_cursor);
+            if (inode_cursor == NULL) {               /* 还没读进来的子项也要释放位图 */
+                inode_cursor = newfs_read_inode(dentry_cursor, dentry_cursor->ino);
+            }
+            if (inode_cursor) {
+                newfs_drop_inode(inode_cursor);
+            }
+            else {                                    /* 读不出来就不知道它的块，宁可漏掉也不能错放 */
+                NFS_DBG("[%s] skip unreadable ino %d\n", __func__, dentry_cursor->ino);
+                newfs_bitmap_free(&newfs_super.inode_bmap, dentry_cursor->ino);
+            }
             newfs_drop_dentry(inode, dentry_cursor);
             dentry_to_free = dentry_cursor;
             dentry_cursor = dentry_cursor->brother;
             free(dentry_to_free);
         }
     }
-    else if (NFS_IS_REG(inode) || NFS_IS_SYM_LINK(inode)) {
-        for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(newfs_super.map_inode_blks); 
-            byte_cursor++)                            /* 调整inodemap */
-        {
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-                if (ino_cursor == inode->ino) {
-                     newfs_super.map_inode[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                     is_find = TRUE;
-                     break;
-                }
-                ino_cursor++;
-            }
-            if (is_find == TRUE) {
-                break;
-            }
-        }
-        if (inode->data)
-            free(inode->data);
-        free(inode);
+
+    /* 按下标直接清除位图 */
+    newfs_bitmap_free(&newfs_super.inode_bmap, inode->ino);
+    newfs_mark_clean(inode);                            /* 已经不在盘上了，不必再写 */
+    if (inode->ref || inode->opens || inode->nlookup) {
+        /* 还开着、正在拷贝数据或内核还记着它：数据块留到最后一个使用者释放，目录项换成自己的副本 */
+        inode->orphan = TRUE;
+        inode->dentry = new_dentry(inode->dentry->fname, inode->dentry->ftype);
+        inode->dentry->inode = inode;
+        return NFS_ERROR_NONE;
     }
+    newfs_map_free(inode);
+    newfs_inode_free(inode);
     return NFS_ERROR_NONE;
 }
 
+/**
+ * @brief 已删除的 inode 没有人再使用时释放
+ * 
+ * @param inode 
+ */
+static void newfs_orphan_release(struct newfs_inode* inode) {
+    if (!inode->orphan || inode->ref || inode->opens || inode->nlookup) {
+        return;
+    }
+    newfs_map_free(inode);
+    free(inode->dentry);
+    newfs_inode_free(inode);
+}
+
+/**
+ * @brief 钉住 inode：读写文件放开 newfs_super.lock 期间 inode 及其数据块不会被释放或淘汰，
+ * 调用时持有 newfs_super.lock
+ * 
+ * @param inode 
+ */
+void newfs_inode_get(struct newfs_inode* inode) {
+    inode->ref++;
+}
+
+/**
+ * @brief 解除钉住，期间已被删除的 inode 由最后一个使用者释放，调用时持有 newfs_super.lock
+ * 
+ * @param inode 
+ */
+void newfs_inode_put(struct newfs_inode* inode) {
+    inode->ref--;
+    newfs_orphan_release(inode);
+}
+
+/**
+ * @brief 打开文件或目录，句柄存在期间 inode 不会被释放，调用时持有 newfs_super.lock
+ * 与 newfs_inode_get 不同，打开的文件仍可以被淘汰干净块
+ * 
+ * @param inode 
+ */
+void newfs_inode_open(struct newfs_inode* inode) {
+    inode->opens++;
+}
+
+/**
+ * @brief 关闭句柄，调用时持有 newfs_super.lock
+ * 
+ * @param inode 
+ */
+void newfs_inode_close(struct newfs_inode* inode) {
+    inode->opens--;
+    newfs_orphan_release(inode);
+}
+
+/**
+ * @brief 回复内核一次查找，内核 forget 之前 inode 不会被释放，调用时持有 newfs_super.lock
+ * 
+ * @param inode 
+ */
+void newfs_inode_lookup(struct newfs_inode* inode) {
+    inode->nlookup++;
+}
+
+/**
+ * @brief 内核不再记着这么多次查找，调用时持有 newfs_super.lock
+ * 
+ * @param inode 
+ * @param nlookup 
+ */
+void newfs_inode_forget(struct newfs_inode* inode, int nlookup) {
+    inode->nlookup -= nlookup;
+    newfs_orphan_release(inode);
+}
+
+
+/**
+ * @brief 丢弃读了一半的 inode：只释放内存，盘上的位图和块保持不变
+ * 
+ * @param inode 
+ */
+static void newfs_inode_discard(struct newfs_inode* inode) {
+    struct newfs_dentry* dentry_cursor = inode->dentrys;
+    struct newfs_dentry* dentry_to_free;
+
+    while (dentry_cursor) {                             /* 已经读入的子项还没有 inode */
+        dentry_to_free = dentry_cursor;
+        dentry_cursor  = dentry_cursor->brother;
+        free(dentry_to_free);
+    }
+    newfs_extent_release(inode);                        /* 两种映射的字段互不重叠，都放掉即可 */
+    newfs_indirect_release(inode);
+    newfs_inode_free(inode);
+}
 
 /**
  * @brief 
  * 
  * @param dentry dentry指向ino，读取该inode
  * @param ino inode唯一编号
- * @return struct newfs_inode* 
+ * @return struct newfs_inode* 读盘失败或校验不过时返回 NULL，不留下任何半成品
  */
 struct newfs_inode* newfs_read_inode(struct newfs_dentry * dentry, int ino) {
-    struct newfs_inode* inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
+    struct newfs_inode* inode = (struct newfs_inode*)calloc(1, sizeof(struct newfs_inode));
     struct newfs_inode_d inode_d;
     struct newfs_dentry* sub_dentry; /* 指向 子dentry 数组 */
-    struct newfs_dentry_d dentry_d;
-    int    blk_cnt = 0; /* 用于读取多个 bno */
-    int    dir_cnt = 0, offset, offset_limit; /* 用于读取目录项 不连续的 dentrys */
-
-    if (newfs_driver_read(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
-                        sizeof(struct newfs_inode_d)) != NFS_ERROR_NONE) {
-        NFS_DBG("[%s] io error\n", __func__);
-        return NULL;
+    struct newfs_dentry_d* dentry_d;
+    uint8_t* blk_buf = NULL;
+    uint8_t* inode_blk = (uint8_t*)malloc(NFS_BLK_SZ());
+    int    blk_cnt = 0, bno; /* 用于读取多个 bno */
+    int    dir_cnt = 0, cnt;
+
+    pthread_rwlock_init(&inode->rwlock, NULL);
+    /* 整块读入，小文件的数据也在里面 */
+    if (newfs_driver_read(NFS_INO_OFS(ino), inode_blk, NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+        goto err;
     }
+    memcpy(&inode_d, inode_blk, sizeof(struct newfs_inode_d));
     inode->dir_cnt = 0;
     inode->ino = inode_d.ino;
     inode->size = inode_d.size;
+    inode->atime = inode_d.atime;
+    inode->mtime = inode_d.mtime;
+    inode->ctime = inode_d.ctime;
     inode->dentry = dentry;     /* 指回父级 dentry*/
     inode->dentrys = NULL;
-    for(blk_cnt = 0; blk_cnt < NFS_DATA_PER_FILE; blk_cnt++)
-        inode->bno[blk_cnt] = inode_d.bno[blk_cnt]; /* 数据块的块号也要赋值 */
+    inode->inline_data = inode_d.inline_data;
+    inode->compress    = inode_d.compress;
+    if (newfs_map_load(inode, &inode_d) != NFS_ERROR_NONE) {
+        goto err;
+    }
     
     if (NFS_IS_DIR(inode)) {
         dir_cnt = inode_d.dir_cnt;
-        blk_cnt = 0; /* 离散的块号 */
+        blk_buf = (uint8_t*)malloc(NFS_BLK_SZ());
         
-        while(dir_cnt != 0){
-            offset = NFS_DATA_OFS(inode->bno[blk_cnt]); // dentry 从 inode 分配的首个数据块开始存
-            offset_limit = NFS_DATA_OFS(inode->bno[blk_cnt] + 1);
-            /* 写满一个 blk 时换到下一个 bno */
-            while (offset + sizeof(struct newfs_dentry_d) < offset_limit)
-            {
-                if (newfs_driver_read(offset, (uint8_t *)&dentry_d, 
-                                    sizeof(struct newfs_dentry_d)) != NFS_ERROR_NONE) {
-                    NFS_DBG("[%s] io error\n", __func__);
-                    return NULL;                    
-                }
-                
-                sub_dentry = new_dentry(dentry_d.fname, dentry_d.ftype);
+        for (blk_cnt = 0; dir_cnt != 0; blk_cnt++) {
+            bno = newfs_bmap(inode, blk_cnt, FALSE);
+            if (bno < 0 || newfs_driver_read(NFS_DATA_OFS(bno), blk_buf, 
+                                             NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+                goto err;
+            }
+            /* 一个块内密集存放 dentry */
+            for (cnt = 0; cnt < NFS_DENTRY_PER_BLK() && dir_cnt != 0; cnt++, dir_cnt--) {
+                dentry_d = (struct newfs_dentry_d*)blk_buf + cnt;
+                sub_dentry = new_dentry(dentry_d->fname, dentry_d->ftype);
                 sub_dentry->parent = inode->dentry;
-                sub_dentry->ino    = dentry_d.ino; 
-                newfs_alloc_dentry(inode, sub_dentry);
-
-                offset += sizeof(struct newfs_dentry_d);
-                dir_cnt--;
-                if(dir_cnt == 0) 
-                    break;  /* 减到 0 后提前退出 */
+                sub_dentry->ino    = dentry_d->ino; 
+                newfs_link_dentry(inode, sub_dentry);  /* 读入的目录项与盘上一致，不改时间 */
             }
-            blk_cnt++; /* 访问下一个指向的数据块 */
         }
+        free(blk_buf);
     }
     else if (NFS_IS_REG(inode)) {
-        for(blk_cnt = 0; blk_cnt < NFS_DATA_PER_FILE; blk_cnt++){
-            inode->block_pointer[blk_cnt] = (uint8_t *)malloc(NFS_BLK_SZ()); /* 只分配一个块 */
-            if (newfs_driver_read(NFS_DATA_OFS(inode->bno[blk_cnt]), inode->block_pointer[blk_cnt], 
-                                NFS_BLK_SZ()) != NFS_ERROR_NONE) {
-                NFS_DBG("[%s] io error\n", __func__);
-                return NULL;                    
-            }
+        /* 只建立块表，数据块在第一次读写时才读入 */
+        inode->blks = NFS_BLKS_OF(inode->size);
+        inode->block_pointer = (uint8_t**)calloc(inode->blks, sizeof(uint8_t*));
+        inode->blk_dirty     = (uint8_t*)calloc(inode->blks, 1);
+        if (inode->inline_data && inode->blks) {
+            newfs_inline_load(inode, inode_blk);        /* 已经读出来了，不必等到第一次读写 */
         }
     }
+    free(inode_blk);
     return inode;
+
+err:
+    NFS_DBG("[%s] io error, ino %d\n", __func__, ino);
+    free(blk_buf);
+    free(inode_blk);
+    newfs_inode_discard(inode);
+    return NULL;
 }
 
 
 
 /**
- * @brief 
+ * @brief 取目录中的第 dir 个目录项，按序号递增取时每次 O(1)
  * 
  * @param inode 
  * @param dir [0...]
@@ -484,9 +2076,16 @@ struct newfs_inode* newfs_read_inode(struct newfs_dentry * dentry, int ino) {
 struct newfs_dentry* newfs_get_dentry(struct newfs_inode * inode, int dir) {
     struct newfs_dentry* dentry_cursor = inode->dentrys;
     int    cnt = 0;
+
+    if (inode->rd_cursor && inode->rd_pos <= dir) {     /* 顺序遍历时不必每次从头找 */
+        dentry_cursor = inode->rd_cursor;
+        cnt = inode->rd_pos;
+    }
     while (dentry_cursor)
     {
         if (dir == cnt) {
+            inode->rd_cursor = dentry_cursor;
+            inode->rd_pos    = cnt;
             return dentry_cursor;
         }
         cnt++;
@@ -510,7 +2109,7 @@ struct newfs_dentry* newfs_get_dentry(struct newfs_inode * inode, int dir) {
  *      2) find qwe's dentry
  * 
  * @param path 
- * @return struct newfs_inode* 
+ * @return struct newfs_dentry* 途经的 inode 读不出来时返回 NULL，调用者按 -NFS_ERROR_IO 处理
  */
 struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean* is_root) {
     struct newfs_dentry* dentry_cursor = newfs_super.root_dentry;
@@ -518,23 +2117,45 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
     struct newfs_inode*  inode; 
     int   total_lvl = newfs_calc_lvl(path);
     int   lvl = 0;
-    boolean is_hit;
+    boolean is_hit, is_neg = FALSE;
     char* fname = NULL;
-    char* path_cpy = (char*)malloc(sizeof(path));
+    char* path_cpy;
+    int   path_len = strlen(path);
+    *is_find = FALSE;
     *is_root = FALSE;
-    strcpy(path_cpy, path);
     
     if (total_lvl == 0) {                           /* 根目录 */
         *is_find = TRUE;
         *is_root = TRUE;
-        dentry_ret = newfs_super.root_dentry;
+        return newfs_super.root_dentry;
+    }
+
+    /* 先查路径缓存，命中就不必逐级查找 */
+    dentry_ret = newfs_pcache_lookup(path, path_len, &is_neg);
+    if (dentry_ret) {
+        *is_find = !is_neg;
+        if (dentry_ret->inode == NULL) {
+            dentry_ret->inode = newfs_read_inode(dentry_ret, dentry_ret->ino);
+        }
+        if (dentry_ret->inode == NULL) {
+            *is_find = FALSE;
+            return NULL;
+        }
+        return dentry_ret;
     }
+
+    path_cpy = strdup(path);
     fname = strtok(path_cpy, "/");       
     while (fname)
     {   
         lvl++;
         if (dentry_cursor->inode == NULL) {           /* Cache机制，如果没有可能是被换出了 */
-            newfs_read_inode(dentry_cursor, dentry_cursor->ino);
+            dentry_cursor->inode = newfs_read_inode(dentry_cursor, dentry_cursor->ino);
+        }
+        if (dentry_cursor->inode == NULL) {           /* 读不出来，下次再试 */
+            *is_find = FALSE;
+            free(path_cpy);
+            return NULL;
         }
         /* 注意，这里有 bug，因为没考虑 dentry 块也会被换出 */
         /* 但是因为这里根本没有实现换出（假设内存大于 4MiB）所以没事 */
@@ -547,17 +2168,8 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
             break;
         }
         if (NFS_IS_DIR(inode)) {
-            dentry_cursor = inode->dentrys;
-            is_hit        = FALSE;
-
-            while (dentry_cursor)
-            {
-                if (memcmp(dentry_cursor->fname, fname, strlen(fname)) == 0) {
-                    is_hit = TRUE;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother; /* 遍历目录下的子文件 */
-            }
+            dentry_cursor = newfs_dir_find(inode, fname, strlen(fname)); /* 按名字哈希查找子文件 */
+            is_hit        = dentry_cursor != NULL;
             
             if (!is_hit) {
                 *is_find = FALSE;
@@ -579,16 +2191,60 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
     if (dentry_ret->inode == NULL) {
         dentry_ret->inode = newfs_read_inode(dentry_ret, dentry_ret->ino);
     }
+    if (dentry_ret->inode == NULL) {
+        *is_find = FALSE;
+        free(path_cpy);
+        return NULL;
+    }
+    if (*is_find) {
+        newfs_pcache_insert(path, path_len, dentry_ret);
+    }
+    else if (NFS_IS_DIR(dentry_ret->inode)) {   /* 路径中途遇到普通文件的不缓存 */
+        newfs_pcache_insert_neg(path, path_len, dentry_ret);
+    }
+    free(path_cpy);
     return dentry_ret;
 }
 
 
 
+/**
+ * @brief 超级块的校验和，计算时 csum 一项按 0 算
+ * 
+ * @param super_d 
+ * @return uint32_t 
+ */
+static uint32_t newfs_super_csum(const struct newfs_super_d* super_d) {
+    struct newfs_super_d copy = *super_d;
+    copy.csum = 0;
+    return newfs_crc32c(0, &copy, sizeof(struct newfs_super_d));
+}
+
+/**
+ * @brief 同步写回超级块：凑成整块直接写盘，不留在块缓存里
+ * 
+ * @param super_d 除 csum 外都已填好
+ * @return int 
+ */
+static int newfs_super_write(struct newfs_super_d* super_d) {
+    uint8_t* blk_buf = (uint8_t*)calloc(1, NFS_BLK_SZ());
+    int      ret;
+
+    super_d->csum = newfs_super_csum(super_d);
+    memcpy(blk_buf, super_d, sizeof(struct newfs_super_d));
+    ret = newfs_driver_write(NFS_SUPER_OFS, blk_buf, NFS_BLK_SZ());
+    free(blk_buf);
+    if (ret == NFS_ERROR_NONE) {
+        newfs_super.super_dirty = FALSE;
+    }
+    return ret;
+}
+
 /**
  * @brief 挂载
  * 
  * Layout
- * @brief | Super | Inode Map | Data Map | Data |
+ * @brief | Super | Inode Map | Data Map | Inode | Data |
  * 
  *  BLK_SZ = 2 * IO_SZ
  * 
@@ -602,10 +2258,30 @@ int newfs_mount(struct custom_options options){
     struct newfs_super_d  newfs_super_d; // 读出的磁盘超级块
     struct newfs_dentry*  root_dentry;
     struct newfs_inode*   root_inode;
+    pthread_mutexattr_t   lock_attr;
     
     boolean             is_init = FALSE; // 判断是否进行了重建，用于后续判断是否需要初始化根节点root_inode
 
     newfs_super.is_mounted = FALSE;
+    newfs_super.dirty_head = NULL;
+    newfs_super.dirty_blks = 0;
+    newfs_super.res_head   = NULL;
+    newfs_super.res_tail   = NULL;
+    newfs_super.res_blks   = 0;
+    newfs_super.faults     = 0;
+    newfs_super.evicts     = 0;
+    newfs_super.dev_seeks  = 0;
+    newfs_super.dev_wblks  = 0;
+    memset(NFS_STAGE(), 0, sizeof(struct newfs_stage));
+    memset(NFS_COMP(), 0, sizeof(struct newfs_comp));
+
+    pthread_mutexattr_init(&lock_attr);
+    pthread_mutexattr_settype(&lock_attr, PTHREAD_MUTEX_RECURSIVE); /* rmdir/rename 会调用其他操作 */
+    pthread_mutex_init(&newfs_super.lock, &lock_attr);
+    pthread_mutexattr_destroy(&lock_attr);
+    pthread_mutex_init(&newfs_super.dev_lock, NULL);
+    pthread_cond_init(&newfs_super.flush_cond, NULL);
+    pthread_cond_init(&newfs_super.stage_cond, NULL);
 
     driver_fd = ddriver_open(options.device);
 
@@ -621,6 +2297,13 @@ int newfs_mount(struct custom_options options){
     // 初始化逻辑块大小
     newfs_super.sz_blk = newfs_super.sz_io * 2;
 
+    if (newfs_pcache_init(NFS_PCACHE_ENTS) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (newfs_cache_init(options.cache_blks) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_NOSPACE;
+    }
+
     root_dentry = new_dentry("/", NFS_DIR);
 
     // 从磁盘读取超级块到newfs_super_d
@@ -629,20 +2312,28 @@ int newfs_mount(struct custom_options options){
         return -NFS_ERROR_IO;
     }   
     // 如果磁盘超级块未设置幻数，说明还未进行过挂载
+    newfs_super.max_ino = NFS_INODE_BLKS;
+    newfs_super.max_data = NFS_DATA_BLKS;
+
     if (newfs_super_d.magic_num != NFS_MAGIC_NUM) {   
         // 初始化磁盘超级块数据
         // 注：这里其实不需要初始化这些变量，直接使用宏定义也未尝不可，但进行初始化更加符合实际的文件系统功能
-        newfs_super.max_ino = NFS_INODE_BLKS;
-
-        newfs_super.max_data = NFS_DATA_BLKS;
-
         newfs_super_d.magic_num = NFS_MAGIC_NUM;
 
         newfs_super_d.map_inode_offset = NFS_SUPER_OFS + NFS_BLKS_SZ(NFS_SUPER_BLKS); // 索引位图偏移量
 
         newfs_super_d.map_data_offset  = newfs_super_d.map_inode_offset + NFS_BLKS_SZ(NFS_MAP_INODE_BLKS); // 数据位图偏移量 = 索引位图偏移量 ＋ 索引位图大小
 
-        newfs_super_d.inode_offset = newfs_super_d.map_data_offset + NFS_BLKS_SZ(NFS_MAP_DATA_BLKS);
+        newfs_super_d.journal_offset = newfs_super_d.map_data_offset + NFS_BLKS_SZ(NFS_MAP_DATA_BLKS);
+        newfs_super_d.journal_blks   = NFS_JOURNAL_BLKS;
+
+        newfs_super_d.dedup_offset = newfs_super_d.journal_offset + NFS_BLKS_SZ(NFS_JOURNAL_BLKS);
+        newfs_super_d.dedup_blks   = NFS_DEDUP_BLKS;
+
+        newfs_super_d.csum_offset = newfs_super_d.dedup_offset + NFS_BLKS_SZ(NFS_DEDUP_BLKS);
+        newfs_super_d.csum_blks   = NFS_CSUM_BLKS;
+
+        newfs_super_d.inode_offset = newfs_super_d.csum_offset + NFS_BLKS_SZ(NFS_CSUM_BLKS);
         
         newfs_super_d.data_offset  = newfs_super_d.inode_offset + NFS_BLKS_SZ(newfs_super.max_ino);
 
@@ -653,6 +2344,10 @@ int newfs_mount(struct custom_options options){
 
         is_init = TRUE;
     }
+    else if (newfs_super_d.csum != newfs_super_csum(&newfs_super_d)) {
+        NFS_DBG("[%s] superblock checksum mismatch\n", __func__);
+        return -NFS_ERROR_IO;
+    }
 
     // 将磁盘超级块的内容写入内存超级块
     newfs_super.sz_usage   = newfs_super_d.sz_usage;     
@@ -671,6 +2366,18 @@ int newfs_mount(struct custom_options options){
     newfs_super.inode_offset = newfs_super_d.inode_offset;
     newfs_super.data_offset = newfs_super_d.data_offset;
 
+    // 重放日志，之后读到的位图和 inode 才是一致的
+    if (newfs_journal_init(newfs_super_d.journal_offset / NFS_BLK_SZ(), newfs_super_d.journal_blks,
+                           is_init) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+
+    // 读入校验表，之后从盘上读出的块都要校验
+    if (newfs_csum_init(newfs_super_d.csum_offset / NFS_BLK_SZ(), newfs_super_d.csum_blks,
+                        is_init) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+
     // 读取索引位图和数据块位图到内存
     if (newfs_driver_read(newfs_super_d.map_inode_offset, (uint8_t *)(newfs_super.map_inode), 
                         NFS_BLKS_SZ(newfs_super_d.map_inode_blks)) != NFS_ERROR_NONE) {
@@ -682,15 +2389,38 @@ int newfs_mount(struct custom_options options){
         return -NFS_ERROR_IO;
     }
 
+    // 新建的磁盘位图内容未定义，先清零
+    if (is_init) {
+        memset(newfs_super.map_inode, 0, NFS_BLKS_SZ(newfs_super_d.map_inode_blks));
+        memset(newfs_super.map_data, 0, NFS_BLKS_SZ(newfs_super_d.map_data_blks));
+    }
+    newfs_bitmap_init(&newfs_super.inode_bmap, newfs_super.map_inode, newfs_super.max_ino);
+    newfs_bitmap_init(&newfs_super.data_bmap, newfs_super.map_data, newfs_super.max_data);
+    newfs_super.super_dirty = is_init;
+
+    // 读入去重表，文件块可能是共享的
+    if (newfs_dedup_init(newfs_super_d.dedup_offset / NFS_BLK_SZ(), newfs_super_d.dedup_blks,
+                         is_init) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+
 
     // 如果挂载时进行了初始化，则需要将初始化的根节点写入磁盘
+    // 根目录、位图和校验表作为一个事务提交，之后才写超级块：超级块落盘之前崩溃只会重新格式化
     if (is_init) {
         root_inode = newfs_alloc_inode(root_dentry);    
-        newfs_sync_inode(root_inode);  
+        if (root_inode == NULL || newfs_sync_all() != NFS_ERROR_NONE ||
+            newfs_super_write(&newfs_super_d) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+    }
+    else {
+        /* 如果磁盘有数据，则先读入根结点，其他暂时不读 (Cache) */
+        root_inode = newfs_read_inode(root_dentry, NFS_ROOT_INO); 
+        if (root_inode == NULL) {
+            return -NFS_ERROR_IO;
+        }
     }
-    
-    /* 如果磁盘有数据，则先读入根结点，其他暂时不读 (Cache) */
-    root_inode            = newfs_read_inode(root_dentry, NFS_ROOT_INO); 
     root_dentry->inode    = root_inode;
     newfs_super.root_dentry = root_dentry;
     newfs_super.is_mounted  = TRUE;
@@ -712,7 +2442,10 @@ int newfs_umount() {
         return NFS_ERROR_NONE;
     }
 
-    newfs_sync_inode(newfs_super.root_dentry->inode); // 刷回根节点
+    // 只刷回有改动的 inode 和位图
+    if (newfs_sync_all() != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
 
     // 将内存超级块中的信息写到磁盘超级块中                             
     newfs_super_d.magic_num           = NFS_MAGIC_NUM;
@@ -722,30 +2455,36 @@ int newfs_umount() {
     newfs_super_d.map_inode_offset    = newfs_super.map_inode_offset;
     newfs_super_d.map_data_blks       = newfs_super.map_data_blks;
     newfs_super_d.map_data_offset     = newfs_super.map_data_offset;
+    newfs_super_d.journal_offset      = NFS_BLKS_SZ(NFS_JOURNAL()->offset);
+    newfs_super_d.journal_blks        = NFS_JOURNAL()->blks;
+    newfs_super_d.dedup_offset        = NFS_BLKS_SZ(NFS_DEDUP()->offset);
+    newfs_super_d.dedup_blks          = NFS_DEDUP()->blks;
+    newfs_super_d.csum_offset         = NFS_BLKS_SZ(NFS_CSUM()->offset);
+    newfs_super_d.csum_blks           = NFS_CSUM()->blks;
 
     newfs_super_d.inode_offset        = newfs_super.inode_offset;
     newfs_super_d.data_offset         = newfs_super.data_offset;
     
-    // 将超级块写回磁盘
-    if (newfs_driver_write(NFS_SUPER_OFS, (uint8_t *)&newfs_super_d, 
-                     NFS_BLKS_SZ(NFS_SUPER_BLKS)) != NFS_ERROR_NONE) {
+    // 将超级块写回磁盘，挂载后内容没变时不必写
+    if (newfs_super.super_dirty && newfs_super_write(&newfs_super_d) != NFS_ERROR_NONE) {
         return -NFS_ERROR_IO;
     }
 
-    // 将索引位图写回磁盘
-    if (newfs_driver_write(newfs_super_d.map_inode_offset, (uint8_t *)(newfs_super.map_inode), 
-                         NFS_BLKS_SZ(newfs_super_d.map_inode_blks)) != NFS_ERROR_NONE) {
+    if (newfs_journal_close() != NFS_ERROR_NONE) {
         return -NFS_ERROR_IO;
     }
 
-    // 将数据块位图写回磁盘
-    if (newfs_driver_write(newfs_super_d.map_data_offset, (uint8_t *)(newfs_super.map_data), 
-                         NFS_BLKS_SZ(newfs_super_d.map_data_blks)) != NFS_ERROR_NONE) {
+    // 写回并释放块缓存
+    newfs_dump_cache_stats();
+    newfs_pcache_destroy();
+    if (newfs_cache_destroy() != NFS_ERROR_NONE) {
         return -NFS_ERROR_IO;
     }
 
     free(newfs_super.map_inode);
     free(newfs_super.map_data);
+    newfs_dedup_destroy();
+    newfs_csum_destroy();
     ddriver_close(NFS_DRIVER());
     printf("**********完成卸载**********\n");
     return NFS_ERROR_NONE;
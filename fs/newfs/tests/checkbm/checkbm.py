@@ -30,6 +30,7 @@ ddriver = home + "/ddriver"
 parser = argparse.ArgumentParser()
 parser.add_argument("-l", "--layout", help="absolute path of .layout file")
 parser.add_argument("-r", "--rules", help="absolute path of golden rule json file")
+parser.add_argument("-c", "--count", action="store_true", help="print valid bits of inode map and data map instead of checking them")
 args = parser.parse_args() 
 
 if args.layout == None:
@@ -191,6 +192,11 @@ def check_map(f: TextIOWrapper, map_ofs: int, map_blks: int, golden_cnt: int):
     return [ valid_count == golden_cnt, valid_count, golden_cnt]
 
 with open(ddriver, "rb") as f:
+    if args.count:
+        res1 = check_map(f, inode_map_ofs, inode_map_blks, valid_inode)
+        res2 = check_map(f, data_map_ofs, data_map_blks, valid_data)
+        print("%d %d" % (res1[1], res2[1]))
+        exit(ERR_OK)
     if is_check_inode_map:
         res1 = check_map(f, inode_map_ofs, inode_map_blks, valid_inode)
         if not res1[0]:
@@ -5,6 +5,9 @@ TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh)
 # mount.sh mkdir.sh touch.sh ls.sh remount.sh (read.sh write.sh cp.sh)
 ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
 ALL_TEST_SCORES=(1 4 5 4 16 2 2)
+# 进阶功能测试, 只在测试等级 7 中单独运行, 不计入上面的总分
+EXTRA_TEST_CASES=(rename.sh truncate.sh unlink.sh mtime.sh compress.sh dedup.sh csum.sh indirect.sh lowlevel.sh)
+EXTRA_TEST_SCORES=(3 3 3 2 3 3 3 3 3)
 MNTPOINT='./mnt'
 PROJECT_NAME="newfs"
 
@@ -35,6 +38,10 @@ elif [[ "${LEVEL}" == "6" ]]; then
     echo "开始mount, mkdir, touch, ls, read&write, cp, umount测试"
     TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
     sleep 1
+elif [[ "${LEVEL}" == "7" ]]; then
+    echo "开始进阶功能测试(单独计分, 不计入基础测试总分)"
+    TEST_CASES=("${EXTRA_TEST_CASES[@]}")
+    sleep 1
 else
     echo "未知测试参数"
     exit 1
@@ -96,7 +103,7 @@ function fail() {
 
 # Utils
 function mount_fuse() {
-    "$ROOT_PATH"/../build/"${PROJECT_NAME}" --device="$HOME"/ddriver "${MNTPOINT}"
+    "$ROOT_PATH"/../build/"${PROJECT_NAME}" --device="$HOME"/ddriver "$@" "${MNTPOINT}"
 }
 
 function check_mount() {
@@ -117,6 +124,32 @@ function try_mount_or_fail() {
     fi
 }
 
+function remount_or_fail() {
+    sleep 1
+    umount "${MNTPOINT}"
+    sleep 1
+    mount_fuse "$@"
+    if ! check_mount; then
+        fail "$TEST_CASE: 重新挂载失败, 请仔细检查"
+        exit 1
+    fi
+}
+
+# 卸载后用 checkbm.py 数出盘上数据位图的有效位数放在 DATA_BLKS 中, 再按给定参数挂载回去
+function remount_and_count() {
+    sleep 1
+    umount "${MNTPOINT}"
+    ROOT_PARENT_PATH=$(cd "$(dirname "$ROOT_PATH")"; pwd)
+    DATA_BLKS=$(python3 "$ROOT_PATH"/checkbm/checkbm.py -l "$ROOT_PARENT_PATH"/include/fs.layout \
+                -r "$ROOT_PATH"/checkbm/golden.json -c | tail -n 1 | cut -d ' ' -f 2)
+    sleep 1
+    mount_fuse "$@"
+    if ! check_mount; then
+        fail "$TEST_CASE: 重新挂载失败, 请仔细检查"
+        exit 1
+    fi
+}
+
 function clean_mount() {
     while true; do
         if ! check_mount; then
@@ -150,14 +183,64 @@ function touch_and_check () {
     fi
 }
 
+# 进阶测试的金标准文件放在 GOLDEN_DIR 中, 挂载点下的同名文件与之比较
+function golden_init() {
+    GOLDEN_DIR=$(mktemp -d)
+}
+
+function golden_clean() {
+    rm -rf "$GOLDEN_DIR"
+}
+
+function golden_copy() {
+    local test_case=$1
+    shift
+    for name in "$@"; do
+        if ! cp "$GOLDEN_DIR"/"$name" "${MNTPOINT}"/"$name"; then
+            fail "$test_case: 写入文件${MNTPOINT}/$name失败"
+            return 1
+        fi
+    done
+    return 0
+}
+
+function golden_check() {
+    local test_case=$1
+    shift
+    for name in "$@"; do
+        if ! cmp -s "$GOLDEN_DIR"/"$name" "${MNTPOINT}"/"$name"; then
+            fail "$test_case: 文件${MNTPOINT}/$name内容不正确"
+            return 1
+        fi
+    done
+    return 0
+}
+
+# 用同一段 3000 字节的随机内容改写金标准文件和挂载点下的文件, 从第 $3 字节开始
+function golden_patch() {
+    local test_case=$1
+    local name=$2
+    local seek=$3
+    head -c 3000 /dev/urandom > "$GOLDEN_DIR"/.patch
+    dd if="$GOLDEN_DIR"/.patch of="$GOLDEN_DIR"/"$name" bs=1 seek="$seek" conv=notrunc status=none
+    if ! dd if="$GOLDEN_DIR"/.patch of="${MNTPOINT}"/"$name" bs=3000 oflag=seek_bytes seek="$seek" \
+            conv=notrunc status=none; then
+        fail "$test_case: 改写文件${MNTPOINT}/$name失败"
+        return 1
+    fi
+    return 0
+}
+
 # Test
 function register_testcase() {
+    CASES=("${ALL_TEST_CASES[@]}" "${EXTRA_TEST_CASES[@]}")
+    SCORES=("${ALL_TEST_SCORES[@]}" "${EXTRA_TEST_SCORES[@]}")
     for target_test_case in "${TEST_CASES[@]}"; do
         ID=0
         echo "测试用例: $ROOT_PATH/stages/$target_test_case"
-        for test_case in "${ALL_TEST_CASES[@]}"; do
+        for test_case in "${CASES[@]}"; do
             if [[ "${test_case}" == "${target_test_case}" ]]; then
-                TOTAL_POINTS=$((TOTAL_POINTS + ALL_TEST_SCORES[ID]))
+                TOTAL_POINTS=$((TOTAL_POINTS + SCORES[ID]))
                 break
             fi
             ID=$((ID + 1))
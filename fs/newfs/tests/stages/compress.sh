@@ -0,0 +1,63 @@
+#!/bin/bash
+
+TEST_CASE="case 12 - compress"
+
+golden_init
+
+function check_write () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    remount_and_count --compress
+    BASE=$DATA_BLKS
+    # 大小相同, 一个容易压缩, 一个几乎不能压缩
+    yes "Lorem ipsum dolor sit amet" | head -c 65536 > "$GOLDEN_DIR"/cfile0
+    head -c 65536 /dev/urandom > "$GOLDEN_DIR"/cfile1
+    if ! golden_copy "$_TEST_CASE" cfile0; then
+        return 1
+    fi
+    remount_and_count --compress
+    USED0=$((DATA_BLKS - BASE))
+    BASE=$DATA_BLKS
+    if ! golden_copy "$_TEST_CASE" cfile1; then
+        return 1
+    fi
+    remount_and_count --compress
+    USED1=$((DATA_BLKS - BASE))
+    if (( USED0 * 2 > USED1 )); then
+        fail "$_TEST_CASE: 文件${MNTPOINT}/cfile0占用${USED0}个数据块, 随机内容的cfile1占用${USED1}个, 压缩没有生效"
+        return 1
+    fi
+    golden_check "$_TEST_CASE" cfile0 cfile1
+}
+
+function check_patch () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 改写压缩块中间的一段
+    if ! golden_patch "$_TEST_CASE" cfile0 5000; then
+        return 1
+    fi
+    remount_or_fail --compress
+    golden_check "$_TEST_CASE" cfile0 cfile1
+}
+
+function check_remount_plain () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 不带 --compress 挂载也要能读出压缩过的块
+    remount_or_fail
+    golden_check "$_TEST_CASE" cfile0 cfile1
+}
+
+try_mount_or_fail
+
+TEST_CASE="case 12.1 - write a compressible and a random file, compare data blocks used"
+core_tester echo "$TEST_CASE" check_write "$TEST_CASE"
+
+TEST_CASE="case 12.2 - patch a compressed cluster, remount with --compress and read back"
+core_tester echo "$TEST_CASE" check_patch "$TEST_CASE"
+
+TEST_CASE="case 12.3 - remount without --compress and read back"
+core_tester echo "$TEST_CASE" check_remount_plain "$TEST_CASE"
+
+golden_clean
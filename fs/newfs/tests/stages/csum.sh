@@ -0,0 +1,92 @@
+#!/bin/bash
+
+TEST_CASE="case 14 - checksum"
+
+GOLDEN_DIR=$(mktemp -d)
+
+function check_prepare () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 大于一个块, 不会内联在 inode 里
+    head -c 4096 /dev/urandom > "$GOLDEN_DIR"/sfile0
+    head -c 4096 /dev/urandom > "$GOLDEN_DIR"/sfile1
+    for name in sfile0 sfile1; do
+        if ! cp "$GOLDEN_DIR"/$name "${MNTPOINT}"/$name; then
+            fail "$_TEST_CASE: 写入文件${MNTPOINT}/$name失败"
+            return 1
+        fi
+    done
+    sleep 1
+    umount "${MNTPOINT}"
+    sleep 1
+    # 在介质上找到 sfile0 的第一个数据块, 翻转其中一位
+    if ! python3 - "$HOME"/ddriver "$GOLDEN_DIR"/sfile0 <<'PY'
+import sys
+with open(sys.argv[2], "rb") as f:
+    marker = f.read(256)
+with open(sys.argv[1], "r+b") as dev:
+    data = dev.read()
+    pos  = data.find(marker)
+    if pos < 0 or data.find(marker, pos + 1) >= 0:
+        sys.exit(1)
+    dev.seek(pos + 10)
+    dev.write(bytes([data[pos + 10] ^ 0x40]))
+PY
+    then
+        fail "$_TEST_CASE: 没有在介质$HOME/ddriver上找到文件sfile0的数据块"
+        return 1
+    fi
+    mount_fuse
+    if ! check_mount; then
+        fail "$_TEST_CASE: 重新挂载失败, 请仔细检查"
+        return 1
+    fi
+    return 0
+}
+
+function check_eio () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ERR=$(cat "${MNTPOINT}"/sfile0 2>&1 > /dev/null); then
+        fail "$_TEST_CASE: 读损坏的文件${MNTPOINT}/sfile0成功, 应该返回EIO"
+        return 1
+    fi
+    if [[ "${ERR}" != *"Input/output error"* ]]; then
+        fail "$_TEST_CASE: 读损坏的文件${MNTPOINT}/sfile0失败, 但错误不是EIO: $ERR"
+        return 1
+    fi
+    if ! cmp -s "$GOLDEN_DIR"/sfile1 "${MNTPOINT}"/sfile1; then
+        fail "$_TEST_CASE: 没有损坏的文件${MNTPOINT}/sfile1内容不正确"
+        return 1
+    fi
+    return 0
+}
+
+function check_repair () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 整块重写即修复
+    if ! dd if="$GOLDEN_DIR"/sfile0 of="${MNTPOINT}"/sfile0 bs=4096 count=1 conv=notrunc status=none; then
+        fail "$_TEST_CASE: 重写文件${MNTPOINT}/sfile0失败"
+        return 1
+    fi
+    remount_or_fail
+    if ! cmp -s "$GOLDEN_DIR"/sfile0 "${MNTPOINT}"/sfile0; then
+        fail "$_TEST_CASE: 重写后重新挂载, 文件${MNTPOINT}/sfile0内容不正确"
+        return 1
+    fi
+    return 0
+}
+
+try_mount_or_fail
+
+TEST_CASE="case 14.1 - write ${MNTPOINT}/sfile0 and corrupt it on the device"
+core_tester echo "$TEST_CASE" check_prepare "$TEST_CASE"
+
+TEST_CASE="case 14.2 - read ${MNTPOINT}/sfile0 returns EIO"
+core_tester echo "$TEST_CASE" check_eio "$TEST_CASE"
+
+TEST_CASE="case 14.3 - rewrite ${MNTPOINT}/sfile0 and read it back"
+core_tester echo "$TEST_CASE" check_repair "$TEST_CASE"
+
+rm -rf "$GOLDEN_DIR"
@@ -0,0 +1,67 @@
+#!/bin/bash
+
+TEST_CASE="case 13 - dedup"
+
+golden_init
+
+function check_write () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    remount_and_count --dedup
+    BASE=$DATA_BLKS
+    # 三个文件内容相同, 数据块共享
+    head -c 16384 /dev/urandom > "$GOLDEN_DIR"/dfile0
+    cp "$GOLDEN_DIR"/dfile0 "$GOLDEN_DIR"/dfile1
+    cp "$GOLDEN_DIR"/dfile0 "$GOLDEN_DIR"/dfile2
+    if ! golden_copy "$_TEST_CASE" dfile0; then
+        return 1
+    fi
+    remount_and_count --dedup
+    ONE=$((DATA_BLKS - BASE))
+    if ! golden_copy "$_TEST_CASE" dfile1 dfile2; then
+        return 1
+    fi
+    remount_and_count --dedup
+    ALL=$((DATA_BLKS - BASE))
+    if (( ALL >= ONE * 2 )); then
+        fail "$_TEST_CASE: 一个文件占用${ONE}个数据块, 三个相同的文件占用${ALL}个, 去重没有生效"
+        return 1
+    fi
+    golden_check "$_TEST_CASE" dfile0 dfile1 dfile2
+}
+
+function check_cow () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 改写其中一个, 其余两个不能跟着变
+    if ! golden_patch "$_TEST_CASE" dfile1 2000; then
+        return 1
+    fi
+    remount_or_fail --dedup
+    golden_check "$_TEST_CASE" dfile0 dfile1 dfile2
+}
+
+function check_unlink () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 删除一个共享者后, 另一个共享者的块仍然有效
+    if ! rm "${MNTPOINT}"/dfile0; then
+        fail "$_TEST_CASE: 删除文件${MNTPOINT}/dfile0失败, 返回值非0"
+        return 1
+    fi
+    remount_or_fail
+    golden_check "$_TEST_CASE" dfile1 dfile2
+}
+
+try_mount_or_fail
+
+TEST_CASE="case 13.1 - write identical files, compare data blocks used"
+core_tester echo "$TEST_CASE" check_write "$TEST_CASE"
+
+TEST_CASE="case 13.2 - modify one sharer, remount with --dedup and read back"
+core_tester echo "$TEST_CASE" check_cow "$TEST_CASE"
+
+TEST_CASE="case 13.3 - unlink one sharer, remount and read the others"
+core_tester echo "$TEST_CASE" check_unlink "$TEST_CASE"
+
+golden_clean
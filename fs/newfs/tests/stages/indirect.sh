@@ -0,0 +1,89 @@
+#!/bin/bash
+
+TEST_CASE="case 15 - indirect"
+
+# 直接块 12 + 一级间接块 256 = 268KB, 400KB 的文件要用到二级间接块
+golden_init
+
+function check_size () {
+    _FILE=$1
+    _SIZE=$2
+    _TEST_CASE=$3
+    SIZE=$(stat -c %s "$_FILE")
+    if [[ "${SIZE}" != "${_SIZE}" ]]; then
+        fail "$_TEST_CASE: 文件$_FILE大小为$SIZE, 应该为$_SIZE"
+        return 1
+    fi
+    return 0
+}
+
+function check_write () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    remount_and_count --indirect
+    BASE=$DATA_BLKS
+    head -c 409600 /dev/urandom > "$GOLDEN_DIR"/ifile0
+    if ! golden_copy "$_TEST_CASE" ifile0; then
+        return 1
+    fi
+    remount_and_count --indirect
+    FULL=$((DATA_BLKS - BASE))
+    if (( FULL < 400 )); then
+        fail "$_TEST_CASE: 400KB的文件只占用了${FULL}个数据块"
+        return 1
+    fi
+    golden_check "$_TEST_CASE" ifile0
+}
+
+function check_shrink () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 截到一级间接块的范围内, 二级间接块及其下的数据块都要释放
+    truncate -s 102400 "$GOLDEN_DIR"/ifile0
+    if ! truncate -s 102400 "${MNTPOINT}"/ifile0; then
+        fail "$_TEST_CASE: 缩短文件${MNTPOINT}/ifile0失败, 返回值非0"
+        return 1
+    fi
+    remount_and_count --indirect
+    CUT=$((DATA_BLKS - BASE))
+    if (( FULL - CUT < 300 )); then
+        fail "$_TEST_CASE: 从400KB截到100KB后数据块从${FULL}个变为${CUT}个, 释放的块太少"
+        return 1
+    fi
+    if ! check_size "${MNTPOINT}"/ifile0 102400 "$_TEST_CASE"; then
+        return 1
+    fi
+    golden_check "$_TEST_CASE" ifile0
+}
+
+function check_grow () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 重新加长到二级间接块的范围, 中间是空洞, 末尾再写一段
+    truncate -s 307200 "$GOLDEN_DIR"/ifile0
+    if ! truncate -s 307200 "${MNTPOINT}"/ifile0; then
+        fail "$_TEST_CASE: 加长文件${MNTPOINT}/ifile0失败, 返回值非0"
+        return 1
+    fi
+    if ! golden_patch "$_TEST_CASE" ifile0 300000; then
+        return 1
+    fi
+    remount_or_fail --indirect
+    if ! check_size "${MNTPOINT}"/ifile0 307200 "$_TEST_CASE"; then
+        return 1
+    fi
+    golden_check "$_TEST_CASE" ifile0
+}
+
+try_mount_or_fail
+
+TEST_CASE="case 15.1 - write a 400KB file with --indirect and remount"
+core_tester echo "$TEST_CASE" check_write "$TEST_CASE"
+
+TEST_CASE="case 15.2 - truncate it to 100KB, remount and compare data blocks used"
+core_tester echo "$TEST_CASE" check_shrink "$TEST_CASE"
+
+TEST_CASE="case 15.3 - extend it to 300KB, write at the end and remount"
+core_tester echo "$TEST_CASE" check_grow "$TEST_CASE"
+
+golden_clean
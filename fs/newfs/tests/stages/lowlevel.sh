@@ -0,0 +1,87 @@
+#!/bin/bash
+
+TEST_CASE="case 16 - lowlevel"
+
+golden_init
+
+function check_rw () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 低层接口按 inode 寻址, 重新挂载时换成 --lowlevel
+    remount_or_fail --lowlevel
+    head -c 20000 /dev/urandom > "$GOLDEN_DIR"/lfile0
+    head -c 3000 /dev/urandom > "$GOLDEN_DIR"/lfile1
+    mkdir_and_check "${MNTPOINT}"/ldir0
+    if ! golden_copy "$_TEST_CASE" lfile0 lfile1; then
+        return 1
+    fi
+    if ! golden_patch "$_TEST_CASE" lfile0 9000; then
+        return 1
+    fi
+    golden_check "$_TEST_CASE" lfile0 lfile1
+}
+
+function check_rename () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    INO=$(stat -c %i "${MNTPOINT}"/lfile0)
+    if ! mv "${MNTPOINT}"/lfile0 "${MNTPOINT}"/ldir0/lfile0; then
+        fail "$_TEST_CASE: 移动文件${MNTPOINT}/lfile0到${MNTPOINT}/ldir0失败, 返回值非0"
+        return 1
+    fi
+    if stat "${MNTPOINT}"/lfile0 > /dev/null 2>&1; then
+        fail "$_TEST_CASE: 移动后文件${MNTPOINT}/lfile0仍然存在"
+        return 1
+    fi
+    NEW_INO=$(stat -c %i "${MNTPOINT}"/ldir0/lfile0)
+    if [[ "${NEW_INO}" != "${INO}" ]]; then
+        fail "$_TEST_CASE: 移动后inode号从${INO}变为${NEW_INO}, 应该保持不变"
+        return 1
+    fi
+    if ! cmp -s "$GOLDEN_DIR"/lfile0 "${MNTPOINT}"/ldir0/lfile0; then
+        fail "$_TEST_CASE: 移动后文件${MNTPOINT}/ldir0/lfile0内容不正确"
+        return 1
+    fi
+    return 0
+}
+
+function check_unlink_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 打开后删除, 通过句柄仍能读出原内容
+    exec 3< "${MNTPOINT}"/lfile1
+    if ! rm "${MNTPOINT}"/lfile1; then
+        exec 3<&-
+        fail "$_TEST_CASE: 删除文件${MNTPOINT}/lfile1失败, 返回值非0"
+        return 1
+    fi
+    if ! cmp -s "$GOLDEN_DIR"/lfile1 - <&3; then
+        exec 3<&-
+        fail "$_TEST_CASE: 删除后通过打开的句柄读出的内容不正确"
+        return 1
+    fi
+    exec 3<&-
+    remount_or_fail --lowlevel
+    if stat "${MNTPOINT}"/lfile1 > /dev/null 2>&1; then
+        fail "$_TEST_CASE: 重新挂载后已删除的文件${MNTPOINT}/lfile1仍然存在"
+        return 1
+    fi
+    if ! cmp -s "$GOLDEN_DIR"/lfile0 "${MNTPOINT}"/ldir0/lfile0; then
+        fail "$_TEST_CASE: 重新挂载后文件${MNTPOINT}/ldir0/lfile0内容不正确"
+        return 1
+    fi
+    return 0
+}
+
+try_mount_or_fail
+
+TEST_CASE="case 16.1 - remount with --lowlevel, write and read back"
+core_tester echo "$TEST_CASE" check_rw "$TEST_CASE"
+
+TEST_CASE="case 16.2 - move ${MNTPOINT}/lfile0 into ${MNTPOINT}/ldir0, inode number kept"
+core_tester echo "$TEST_CASE" check_rename "$TEST_CASE"
+
+TEST_CASE="case 16.3 - unlink while open, remount with --lowlevel and read back"
+core_tester echo "$TEST_CASE" check_unlink_remount "$TEST_CASE"
+
+golden_clean
@@ -0,0 +1,50 @@
+#!/bin/bash
+
+TEST_CASE="case 11 - mtime"
+
+MTIME="2001-02-03 04:05:06"
+
+function check_mtime () {
+    _FILE=$1
+    _TEST_CASE=$2
+    EXPECT=$(date -d "$MTIME" +%s)
+    OUTPUT=$(stat -c %Y "$_FILE")
+    if [[ "${OUTPUT}" != "${EXPECT}" ]]; then
+        fail "$_TEST_CASE: 文件$_FILE的修改时间为$(date -d @"$OUTPUT"), 应该为$MTIME"
+        return 1
+    fi
+    return 0
+}
+
+function check_set_mtime () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    mkdir_and_check "${MNTPOINT}"/mdir0
+    touch_and_check "${MNTPOINT}"/mdir0/file0
+    # 目录项改完之后再设置时间
+    if ! touch -d "$MTIME" "${MNTPOINT}"/mdir0/file0 "${MNTPOINT}"/mdir0; then
+        fail "$_TEST_CASE: 设置${MNTPOINT}/mdir0的修改时间失败, 返回值非0"
+        return 1
+    fi
+    check_mtime "${MNTPOINT}"/mdir0 "$_TEST_CASE" && check_mtime "${MNTPOINT}"/mdir0/file0 "$_TEST_CASE"
+}
+
+function check_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    remount_or_fail
+    # 列目录会读入目录项, 不能改变目录的时间
+    if ! ls "${MNTPOINT}"/mdir0 > /dev/null; then
+        fail "$_TEST_CASE: ls ${MNTPOINT}/mdir0返回值非0"
+        return 1
+    fi
+    check_mtime "${MNTPOINT}"/mdir0 "$_TEST_CASE" && check_mtime "${MNTPOINT}"/mdir0/file0 "$_TEST_CASE"
+}
+
+try_mount_or_fail
+
+TEST_CASE="case 11.1 - set mtime of ${MNTPOINT}/mdir0"
+core_tester echo "$TEST_CASE" check_set_mtime "$TEST_CASE"
+
+TEST_CASE="case 11.2 - remount and check mtime of ${MNTPOINT}/mdir0"
+core_tester echo "$TEST_CASE" check_remount "$TEST_CASE"
@@ -0,0 +1,69 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - rename"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua."
+
+function check_prepare () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    mkdir_and_check "${MNTPOINT}"/rdir0
+    mkdir_and_check "${MNTPOINT}"/rdir0/sub
+    touch_and_check "${MNTPOINT}"/rdir0/sub/file0
+    if ! echo "$GOLDEN" | tee "${MNTPOINT}"/rdir0/sub/file0 > /dev/null; then
+        fail "$_TEST_CASE: 写入文件${MNTPOINT}/rdir0/sub/file0失败"
+        return 1
+    fi
+    # 先访问一次, 让旧路径进入缓存
+    if ! stat "${MNTPOINT}"/rdir0/sub/file0 > /dev/null; then
+        fail "$_TEST_CASE: stat文件${MNTPOINT}/rdir0/sub/file0返回值非0"
+        return 1
+    fi
+    return 0
+}
+
+function check_rename () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! mv "${MNTPOINT}"/rdir0 "${MNTPOINT}"/rdir1; then
+        fail "$_TEST_CASE: 重命名目录${MNTPOINT}/rdir0为rdir1失败, 返回值非0"
+        return 1
+    fi
+    if stat "${MNTPOINT}"/rdir0/sub/file0 > /dev/null 2>&1; then
+        fail "$_TEST_CASE: 重命名后旧路径${MNTPOINT}/rdir0/sub/file0仍然存在"
+        return 1
+    fi
+    OUTPUT=$(cat "${MNTPOINT}"/rdir1/sub/file0)
+    if [[ "${OUTPUT}" != "${GOLDEN}" ]]; then
+        fail "$_TEST_CASE: 重命名后读文件${MNTPOINT}/rdir1/sub/file0内容不正确, 应该为: $GOLDEN"
+        return 1
+    fi
+    return 0
+}
+
+function check_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    remount_or_fail
+    if [ -e "${MNTPOINT}"/rdir0 ]; then
+        fail "$_TEST_CASE: 重新挂载后旧目录${MNTPOINT}/rdir0仍然存在"
+        return 1
+    fi
+    OUTPUT=$(cat "${MNTPOINT}"/rdir1/sub/file0)
+    if [[ "${OUTPUT}" != "${GOLDEN}" ]]; then
+        fail "$_TEST_CASE: 重新挂载后读文件${MNTPOINT}/rdir1/sub/file0内容不正确, 应该为: $GOLDEN"
+        return 1
+    fi
+    return 0
+}
+
+try_mount_or_fail
+
+TEST_CASE="case 8.1 - prepare ${MNTPOINT}/rdir0/sub/file0"
+core_tester echo "$TEST_CASE" check_prepare "$TEST_CASE"
+
+TEST_CASE="case 8.2 - rename ${MNTPOINT}/rdir0 to ${MNTPOINT}/rdir1"
+core_tester echo "$TEST_CASE" check_rename "$TEST_CASE"
+
+TEST_CASE="case 8.3 - remount and read ${MNTPOINT}/rdir1/sub/file0"
+core_tester echo "$TEST_CASE" check_remount "$TEST_CASE"
@@ -0,0 +1,81 @@
+#!/bin/bash
+
+TEST_CASE="case 9 - truncate"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua."
+
+function check_size () {
+    _FILE=$1
+    _SIZE=$2
+    _TEST_CASE=$3
+    SIZE=$(stat -c %s "$_FILE")
+    if [[ "${SIZE}" != "${_SIZE}" ]]; then
+        fail "$_TEST_CASE: 文件$_FILE大小为$SIZE, 应该为$_SIZE"
+        return 1
+    fi
+    return 0
+}
+
+function check_truncate () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    touch_and_check "${MNTPOINT}"/tfile0
+    echo "$GOLDEN" > "${MNTPOINT}"/tfile0
+    # 以 O_TRUNC 打开, 按路径截断为 0
+    if ! : > "${MNTPOINT}"/tfile0; then
+        fail "$_TEST_CASE: 截断文件${MNTPOINT}/tfile0失败"
+        return 1
+    fi
+    check_size "${MNTPOINT}"/tfile0 0 "$_TEST_CASE"
+}
+
+function check_ftruncate () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    echo "$GOLDEN" > "${MNTPOINT}"/tfile1
+    # truncate 命令打开文件后用 ftruncate 改变大小
+    if ! truncate -s 10 "${MNTPOINT}"/tfile1; then
+        fail "$_TEST_CASE: 缩短文件${MNTPOINT}/tfile1失败, 返回值非0"
+        return 1
+    fi
+    if ! check_size "${MNTPOINT}"/tfile1 10 "$_TEST_CASE"; then
+        return 1
+    fi
+    OUTPUT=$(cat "${MNTPOINT}"/tfile1)
+    if [[ "${OUTPUT}" != "${GOLDEN:0:10}" ]]; then
+        fail "$_TEST_CASE: 缩短后文件${MNTPOINT}/tfile1内容不正确, 应该为: ${GOLDEN:0:10}"
+        return 1
+    fi
+    if ! truncate -s 3000 "${MNTPOINT}"/tfile1; then
+        fail "$_TEST_CASE: 加长文件${MNTPOINT}/tfile1失败, 返回值非0"
+        return 1
+    fi
+    return 0
+}
+
+function check_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    remount_or_fail
+    if ! check_size "${MNTPOINT}"/tfile0 0 "$_TEST_CASE" ||
+       ! check_size "${MNTPOINT}"/tfile1 3000 "$_TEST_CASE"; then
+        return 1
+    fi
+    # 加长的部分读出来是 0
+    if ! cmp -s <(echo -n "${GOLDEN:0:10}"; head -c 2990 /dev/zero) "${MNTPOINT}"/tfile1; then
+        fail "$_TEST_CASE: 重新挂载后文件${MNTPOINT}/tfile1内容不正确, 前10字节之后应该全为0"
+        return 1
+    fi
+    return 0
+}
+
+try_mount_or_fail
+
+TEST_CASE="case 9.1 - truncate ${MNTPOINT}/tfile0 to 0"
+core_tester echo "$TEST_CASE" check_truncate "$TEST_CASE"
+
+TEST_CASE="case 9.2 - ftruncate ${MNTPOINT}/tfile1 to 10 and 3000"
+core_tester echo "$TEST_CASE" check_ftruncate "$TEST_CASE"
+
+TEST_CASE="case 9.3 - remount and check sizes"
+core_tester echo "$TEST_CASE" check_remount "$TEST_CASE"
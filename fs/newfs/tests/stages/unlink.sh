@@ -0,0 +1,84 @@
+#!/bin/bash
+
+TEST_CASE="case 10 - unlink while open"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua."
+
+function check_read_unlinked () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    touch_and_check "${MNTPOINT}"/ufile0
+    echo "$GOLDEN" > "${MNTPOINT}"/ufile0
+    exec 3< "${MNTPOINT}"/ufile0
+    if ! rm "${MNTPOINT}"/ufile0; then
+        exec 3<&-
+        fail "$_TEST_CASE: 删除文件${MNTPOINT}/ufile0失败, 返回值非0"
+        return 1
+    fi
+    if stat "${MNTPOINT}"/ufile0 > /dev/null 2>&1; then
+        exec 3<&-
+        fail "$_TEST_CASE: 删除后文件${MNTPOINT}/ufile0仍然存在"
+        return 1
+    fi
+    OUTPUT=$(cat <&3)
+    exec 3<&-
+    if [[ "${OUTPUT}" != "${GOLDEN}" ]]; then
+        fail "$_TEST_CASE: 删除后通过打开的句柄读出的内容不正确, 应该为: $GOLDEN"
+        return 1
+    fi
+    return 0
+}
+
+function check_write_unlinked () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    touch_and_check "${MNTPOINT}"/ufile1
+    # 打开、删除后继续写, 再从头读回来
+    if ! python3 - "${MNTPOINT}"/ufile1 "$GOLDEN" <<'PY'
+import os, sys
+fd = os.open(sys.argv[1], os.O_RDWR)
+os.unlink(sys.argv[1])
+data = sys.argv[2].encode() * 40
+os.write(fd, data)
+os.lseek(fd, 0, os.SEEK_SET)
+out = b""
+while len(out) < len(data):
+    buf = os.read(fd, len(data) - len(out))
+    if not buf:
+        break
+    out += buf
+os.close(fd)
+sys.exit(0 if out == data else 1)
+PY
+    then
+        fail "$_TEST_CASE: 删除后通过打开的句柄写入再读出的内容不正确"
+        return 1
+    fi
+    return 0
+}
+
+function check_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    remount_or_fail
+    if [ -e "${MNTPOINT}"/ufile0 ] || [ -e "${MNTPOINT}"/ufile1 ]; then
+        fail "$_TEST_CASE: 重新挂载后已删除的文件仍然存在"
+        return 1
+    fi
+    if ! touch "${MNTPOINT}"/ufile0; then
+        fail "$_TEST_CASE: 重新挂载后无法重新创建${MNTPOINT}/ufile0"
+        return 1
+    fi
+    return 0
+}
+
+try_mount_or_fail
+
+TEST_CASE="case 10.1 - read ${MNTPOINT}/ufile0 after unlink"
+core_tester echo "$TEST_CASE" check_read_unlinked "$TEST_CASE"
+
+TEST_CASE="case 10.2 - write ${MNTPOINT}/ufile1 after unlink"
+core_tester echo "$TEST_CASE" check_write_unlinked "$TEST_CASE"
+
+TEST_CASE="case 10.3 - remount after closing unlinked files"
+core_tester echo "$TEST_CASE" check_remount "$TEST_CASE"